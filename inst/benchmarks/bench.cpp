@@ -0,0 +1,342 @@
+// A standalone benchmark harness for the sourcetools C++ library,
+// measuring the throughput of reading, tokenizing and navigating a
+// corpus of R files. Build it against the package headers (which
+// require the R headers) with, for example:
+//
+//    g++ -O2 -I../include $(R CMD config --cppflags) bench.cpp -o bench
+//
+// and run it over a set of files:
+//
+//    ./bench [-n <iterations>] <file>...
+//
+// For each stage, the harness reports the bytes and tokens processed
+// per second, and the bytes allocated (via 'operator new') per pass
+// over the corpus.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+# include <sys/time.h>
+#else
+# include <ctime>
+#endif
+
+#include <sourcetools/read/read.h>
+#include <sourcetools/tokenization/tokenization.h>
+#include <sourcetools/cursor/cursor.h>
+
+// Count the bytes allocated through 'operator new'.
+namespace {
+
+std::size_t s_allocated = 0;
+
+} // anonymous namespace
+
+#if __cplusplus >= 201103L
+# define BENCH_THROW
+# define BENCH_NOTHROW noexcept
+#else
+# define BENCH_THROW throw(std::bad_alloc)
+# define BENCH_NOTHROW throw()
+#endif
+
+void* operator new(std::size_t size) BENCH_THROW
+{
+  s_allocated += size;
+  void* data = std::malloc(size == 0 ? 1 : size);
+  if (data == NULL)
+    throw std::bad_alloc();
+  return data;
+}
+
+void operator delete(void* data) BENCH_NOTHROW
+{
+  std::free(data);
+}
+
+namespace {
+
+using namespace sourcetools;
+
+double now()
+{
+#ifndef _WIN32
+  struct timeval tv;
+  ::gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1E6;
+#else
+  return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+struct Corpus
+{
+  std::vector<std::string> paths;
+  std::vector<std::string> contents;
+  std::size_t bytes;
+  std::size_t tokens;
+};
+
+struct Result
+{
+  double seconds;
+  std::size_t allocated;
+  std::size_t checksum;
+};
+
+// Each stage makes one pass over the corpus, returning a checksum so
+// that the work cannot be optimized away.
+typedef std::size_t (*Stage)(const Corpus&);
+
+std::size_t readStage(const Corpus& corpus)
+{
+  std::size_t checksum = 0;
+  for (std::size_t i = 0; i < corpus.paths.size(); ++i)
+  {
+    std::string contents;
+    detail::MemoryMappedReader::read(corpus.paths[i].c_str(), &contents);
+    checksum += contents.size();
+  }
+  return checksum;
+}
+
+std::size_t readLinesStage(const Corpus& corpus)
+{
+  std::size_t checksum = 0;
+  for (std::size_t i = 0; i < corpus.paths.size(); ++i)
+  {
+    std::vector<std::string> lines;
+    detail::MemoryMappedReader::read_lines(corpus.paths[i].c_str(), &lines);
+    checksum += lines.size();
+  }
+  return checksum;
+}
+
+std::size_t tokenizeStage(const Corpus& corpus)
+{
+  std::size_t checksum = 0;
+  for (std::size_t i = 0; i < corpus.contents.size(); ++i)
+    checksum += tokenize(corpus.contents[i]).size();
+  return checksum;
+}
+
+std::size_t tokenizeCompactStage(const Corpus& corpus)
+{
+  std::size_t checksum = 0;
+  for (std::size_t i = 0; i < corpus.contents.size(); ++i)
+  {
+    tokens::TokenBuffer buffer;
+    tokenize(corpus.contents[i], &buffer);
+    checksum += buffer.size();
+  }
+  return checksum;
+}
+
+// Walk over the significant tokens, matching brackets along the way.
+std::size_t cursorStage(const Corpus& corpus)
+{
+  std::size_t checksum = 0;
+  for (std::size_t i = 0; i < corpus.contents.size(); ++i)
+  {
+    tokens::TokenBuffer buffer;
+    tokenize(corpus.contents[i], &buffer);
+    if (buffer.empty())
+      continue;
+
+    cursors::CompactTokenCursor cursor(buffer);
+    while (cursor.moveToNextSignificantToken())
+    {
+      if (cursor.isType(tokens::LPAREN))
+      {
+        cursors::CompactTokenCursor clone = cursor;
+        if (clone.fwdToMatchingBracket())
+          ++checksum;
+      }
+    }
+  }
+  return checksum;
+}
+
+// As above, but with matching brackets found through a bracket table.
+std::size_t bracketTableStage(const Corpus& corpus)
+{
+  std::size_t checksum = 0;
+  for (std::size_t i = 0; i < corpus.contents.size(); ++i)
+  {
+    tokens::TokenBuffer buffer;
+    tokenize(corpus.contents[i], &buffer);
+    if (buffer.empty())
+      continue;
+
+    tokens::BracketTable brackets(buffer.view());
+    cursors::CompactTokenCursor cursor(buffer, brackets);
+    while (cursor.moveToNextSignificantToken())
+    {
+      if (cursor.isType(tokens::LPAREN))
+      {
+        cursors::CompactTokenCursor clone = cursor;
+        if (clone.fwdToMatchingBracket())
+          ++checksum;
+      }
+    }
+  }
+  return checksum;
+}
+
+// As above, but skipping whitespace and comments through a skip table.
+std::size_t skipTableStage(const Corpus& corpus)
+{
+  std::size_t checksum = 0;
+  for (std::size_t i = 0; i < corpus.contents.size(); ++i)
+  {
+    tokens::TokenBuffer buffer;
+    tokenize(corpus.contents[i], &buffer);
+    if (buffer.empty())
+      continue;
+
+    tokens::SkipTable skips(buffer.view());
+    cursors::CompactTokenCursor cursor(buffer);
+    cursor.use(skips);
+    while (cursor.moveToNextSignificantToken())
+    {
+      if (cursor.isType(tokens::LPAREN))
+      {
+        cursors::CompactTokenCursor clone = cursor;
+        if (clone.fwdToMatchingBracket())
+          ++checksum;
+      }
+    }
+  }
+  return checksum;
+}
+
+// Move to the position of every 16th token, as e.g. for hover
+// lookups, optionally through a line table.
+std::size_t positionStage(const Corpus& corpus, bool useLines)
+{
+  std::size_t checksum = 0;
+  for (std::size_t i = 0; i < corpus.contents.size(); ++i)
+  {
+    tokens::TokenBuffer buffer;
+    tokenize(corpus.contents[i], &buffer);
+    if (buffer.empty())
+      continue;
+
+    tokens::LineTable lines;
+    cursors::CompactTokenCursor cursor(buffer);
+    if (useLines)
+    {
+      lines.build(buffer.view());
+      cursor.use(lines);
+    }
+
+    tokens::TokenView view = buffer.view();
+    for (std::size_t j = 0; j < view.size(); j += 16)
+      if (cursor.moveToPosition(view.position(j)))
+        checksum += cursor.offset();
+  }
+  return checksum;
+}
+
+std::size_t positionSearchStage(const Corpus& corpus)
+{
+  return positionStage(corpus, false);
+}
+
+std::size_t positionLinesStage(const Corpus& corpus)
+{
+  return positionStage(corpus, true);
+}
+
+Result run(Stage stage, const Corpus& corpus, int iterations)
+{
+  Result result;
+  result.checksum = 0;
+
+  // Warm up (e.g. the page cache) before timing.
+  stage(corpus);
+
+  std::size_t allocated = s_allocated;
+  double start = now();
+  for (int i = 0; i < iterations; ++i)
+    result.checksum += stage(corpus);
+  result.seconds = (now() - start) / iterations;
+  result.allocated = (s_allocated - allocated) / iterations;
+  return result;
+}
+
+void report(const char* name, const Result& result, const Corpus& corpus)
+{
+  double seconds = result.seconds > 0 ? result.seconds : 1E-9;
+  std::printf("%-16s %12.3f %12.2f %12.2f %14lu\n",
+              name,
+              seconds * 1E3,
+              corpus.bytes / seconds / 1E6,
+              corpus.tokens / seconds / 1E6,
+              static_cast<unsigned long>(result.allocated));
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+  int iterations = 10;
+  Corpus corpus;
+  corpus.bytes = 0;
+  corpus.tokens = 0;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+    {
+      iterations = std::atoi(argv[++i]);
+      if (iterations < 1)
+        iterations = 1;
+      continue;
+    }
+
+    std::string contents;
+    if (!detail::MemoryMappedReader::read(argv[i], &contents))
+    {
+      std::fprintf(stderr, "Failed to read file '%s'\n", argv[i]);
+      continue;
+    }
+
+    corpus.paths.push_back(argv[i]);
+    corpus.bytes += contents.size();
+    corpus.tokens += tokenize(contents).size();
+    corpus.contents.push_back(contents);
+  }
+
+  if (corpus.paths.empty())
+  {
+    std::fprintf(stderr, "Usage: %s [-n <iterations>] <file>...\n", argv[0]);
+    return 1;
+  }
+
+  std::printf("%lu files, %lu bytes, %lu tokens, %d iterations\n\n",
+              static_cast<unsigned long>(corpus.paths.size()),
+              static_cast<unsigned long>(corpus.bytes),
+              static_cast<unsigned long>(corpus.tokens),
+              iterations);
+
+  std::printf("%-16s %12s %12s %12s %14s\n",
+              "stage", "ms/pass", "MB/s", "Mtokens/s", "bytes alloc");
+
+  report("read", run(readStage, corpus, iterations), corpus);
+  report("read_lines", run(readLinesStage, corpus, iterations), corpus);
+  report("tokenize", run(tokenizeStage, corpus, iterations), corpus);
+  report("tokenize_compact", run(tokenizeCompactStage, corpus, iterations), corpus);
+  report("cursor", run(cursorStage, corpus, iterations), corpus);
+  report("cursor_brackets", run(bracketTableStage, corpus, iterations), corpus);
+  report("cursor_skips", run(skipTableStage, corpus, iterations), corpus);
+  report("position", run(positionSearchStage, corpus, iterations), corpus);
+  report("position_lines", run(positionLinesStage, corpus, iterations), corpus);
+
+  return 0;
+}
@@ -3,6 +3,7 @@
 
 #include <sourcetools/core/core.h>
 #include <sourcetools/platform/platform.h>
+#include <sourcetools/parallel/parallel.h>
 #include <sourcetools/collection/collection.h>
 #include <sourcetools/utf8/utf8.h>
 #include <sourcetools/cursor/cursor.h>
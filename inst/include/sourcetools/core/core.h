@@ -3,5 +3,8 @@
 
 #include <sourcetools/core/macros.h>
 #include <sourcetools/core/util.h>
+#include <sourcetools/core/hash.h>
+#include <sourcetools/core/stats.h>
+#include <sourcetools/core/files.h>
 
 #endif /* SOURCETOOLS_CORE_CORE_H */
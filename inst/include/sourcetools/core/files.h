@@ -0,0 +1,57 @@
+#ifndef SOURCETOOLS_CORE_FILES_H
+#define SOURCETOOLS_CORE_FILES_H
+
+#include <cstdio>
+
+#include <string>
+
+#ifdef _WIN32
+# undef Realloc
+# undef Free
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
+
+namespace sourcetools {
+namespace utils {
+
+// A name for a temporary file alongside 'path', unique to the process
+// (by its id) and to the call (by a counter), so that processes or
+// threads writing the same file at once never share a temporary file.
+inline std::string temporaryPath(const std::string& path)
+{
+  static unsigned long counter = 0;
+
+  unsigned long count;
+#ifdef _OPENMP
+  #pragma omp critical(sourcetools_temporary_path)
+#endif
+  count = counter++;
+
+#ifdef _WIN32
+  unsigned long pid = static_cast<unsigned long>(::GetCurrentProcessId());
+#else
+  unsigned long pid = static_cast<unsigned long>(::getpid());
+#endif
+
+  char suffix[64];
+  std::sprintf(suffix, ".%lu.%lu.tmp", pid, count);
+  return path + suffix;
+}
+
+// Move the file at 'from' to 'to', replacing any file already there.
+// (On Windows, 'std::rename()' fails when the target exists.)
+inline bool replaceFile(const char* from, const char* to)
+{
+#ifdef _WIN32
+  return ::MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return std::rename(from, to) == 0;
+#endif
+}
+
+} // namespace utils
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_CORE_FILES_H */
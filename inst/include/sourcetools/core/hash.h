@@ -0,0 +1,84 @@
+#ifndef SOURCETOOLS_CORE_HASH_H
+#define SOURCETOOLS_CORE_HASH_H
+
+#include <cstddef>
+#include <cstring>
+
+namespace sourcetools {
+namespace detail {
+
+inline unsigned int rotl32(unsigned int x, int r)
+{
+  return (x << r) | (x >> (32 - r));
+}
+
+inline unsigned int read32(const char* data)
+{
+  unsigned int value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+} // namespace detail
+
+// The 32-bit xxHash (XXH32) of '[data, data + n)'. Words are read in
+// native byte order, so hashes are only comparable between machines
+// of the same endianness.
+inline unsigned int xxhash32(const char* data,
+                             std::size_t n,
+                             unsigned int seed = 0)
+{
+  using detail::rotl32;
+  using detail::read32;
+
+  static const unsigned int PRIME1 = 2654435761u;
+  static const unsigned int PRIME2 = 2246822519u;
+  static const unsigned int PRIME3 = 3266489917u;
+  static const unsigned int PRIME4 = 668265263u;
+  static const unsigned int PRIME5 = 374761393u;
+
+  const char* it = data;
+  const char* end = data + n;
+  unsigned int hash;
+
+  if (n >= 16)
+  {
+    unsigned int v1 = seed + PRIME1 + PRIME2;
+    unsigned int v2 = seed + PRIME2;
+    unsigned int v3 = seed;
+    unsigned int v4 = seed - PRIME1;
+
+    for (; end - it >= 16; it += 16)
+    {
+      v1 = rotl32(v1 + read32(it +  0) * PRIME2, 13) * PRIME1;
+      v2 = rotl32(v2 + read32(it +  4) * PRIME2, 13) * PRIME1;
+      v3 = rotl32(v3 + read32(it +  8) * PRIME2, 13) * PRIME1;
+      v4 = rotl32(v4 + read32(it + 12) * PRIME2, 13) * PRIME1;
+    }
+
+    hash = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+  }
+  else
+  {
+    hash = seed + PRIME5;
+  }
+
+  hash += static_cast<unsigned int>(n);
+
+  for (; end - it >= 4; it += 4)
+    hash = rotl32(hash + read32(it) * PRIME3, 17) * PRIME4;
+
+  for (; it < end; ++it)
+    hash = rotl32(hash + static_cast<unsigned char>(*it) * PRIME5, 11) * PRIME1;
+
+  hash ^= hash >> 15;
+  hash *= PRIME2;
+  hash ^= hash >> 13;
+  hash *= PRIME3;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_CORE_HASH_H */
@@ -15,6 +15,13 @@
 # define UNLIKELY(x) x
 #endif
 
+/* Storage local to each thread, where the compiler provides it */
+#if defined(__GNUC__)
+# define SOURCE_TOOLS_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+# define SOURCE_TOOLS_THREAD_LOCAL __declspec(thread)
+#endif
+
 #define SOURCE_TOOLS_CHECK_MASK(__SELF__, __MASK__)                    \
   ((__MASK__ & __SELF__) == __MASK__)
 
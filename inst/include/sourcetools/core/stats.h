@@ -0,0 +1,206 @@
+#ifndef SOURCETOOLS_CORE_STATS_H
+#define SOURCETOOLS_CORE_STATS_H
+
+#include <cstddef>
+
+#ifdef _WIN32
+# undef Realloc
+# undef Free
+# include <windows.h>
+#else
+# include <time.h>
+# include <sys/time.h>
+#endif
+
+// Process-wide counters and timers for the stages of reading and
+// tokenizing files, so that time spent can be attributed without a
+// profiler. Nothing is collected until 'enabled()' is set, so that by
+// default no clock is read and no shared counter is updated; define
+// 'SOURCETOOLS_NO_STATS' to compile them out altogether.
+//
+// Stages are timed with a monotonic clock; time spent on worker
+// threads is summed over the threads.
+
+namespace sourcetools {
+namespace stats {
+
+enum Stage
+{
+  // Opening and mapping (or reading) files.
+  STAGE_OPEN,
+
+  // Copying file contents into strings.
+  STAGE_COPY,
+
+  // Tokenizing code.
+  STAGE_TOKENIZE,
+
+  // Converting tokens to R objects.
+  STAGE_CONVERT,
+
+  STAGE_COUNT
+};
+
+enum Counter
+{
+  COUNTER_FILES,
+  COUNTER_BYTES_MAPPED,
+  COUNTER_BYTES_READ,
+  COUNTER_BYTES_COPIED,
+  COUNTER_TOKENS,
+  COUNTER_CHARSXPS,
+
+  COUNTER_COUNT
+};
+
+inline const char* stageName(Stage stage)
+{
+  static const char* names[] = { "open", "copy", "tokenize", "convert" };
+  return names[stage];
+}
+
+inline const char* counterName(Counter counter)
+{
+  static const char* names[] = {
+    "files", "bytes_mapped", "bytes_read", "bytes_copied", "tokens", "charsxps"
+  };
+  return names[counter];
+}
+
+struct Stats
+{
+  Stats()
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    for (std::size_t i = 0; i < STAGE_COUNT; ++i)
+    {
+      calls[i] = 0;
+      seconds[i] = 0;
+    }
+
+    for (std::size_t i = 0; i < COUNTER_COUNT; ++i)
+      counters[i] = 0;
+  }
+
+  std::size_t calls[STAGE_COUNT];
+  double seconds[STAGE_COUNT];
+  std::size_t counters[COUNTER_COUNT];
+};
+
+inline Stats& global()
+{
+  static Stats stats;
+  return stats;
+}
+
+// Whether statistics are collected. Should only be changed while no
+// worker threads are running.
+inline bool& enabled()
+{
+  static bool enabled = false;
+  return enabled;
+}
+
+// Seconds elapsed on a monotonic clock, from an arbitrary origin.
+inline double now()
+{
+#if defined(_WIN32)
+  LARGE_INTEGER frequency, counter;
+  ::QueryPerformanceFrequency(&frequency);
+  ::QueryPerformanceCounter(&counter);
+  return static_cast<double>(counter.QuadPart) / frequency.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1E9;
+#else
+  struct timeval tv;
+  ::gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1E6;
+#endif
+}
+
+// Counters may be updated from worker threads.
+inline void add(Counter counter, std::size_t n)
+{
+  if (!enabled())
+    return;
+
+  std::size_t& value = global().counters[counter];
+#ifdef _OPENMP
+  #pragma omp atomic
+#endif
+  value += n;
+}
+
+inline void record(Stage stage, double seconds)
+{
+  Stats& stats = global();
+  std::size_t& calls = stats.calls[stage];
+  double& total = stats.seconds[stage];
+
+#ifdef _OPENMP
+  #pragma omp atomic
+#endif
+  ++calls;
+
+#ifdef _OPENMP
+  #pragma omp atomic
+#endif
+  total += seconds;
+}
+
+// Times a stage, from construction until 'stop()' (or destruction).
+class Timer
+{
+public:
+
+  explicit Timer(Stage stage)
+    : stage_(stage),
+      start_(0),
+      running_(enabled())
+  {
+    if (running_)
+      start_ = now();
+  }
+
+  ~Timer()
+  {
+    stop();
+  }
+
+  void stop()
+  {
+    if (!running_)
+      return;
+
+    running_ = false;
+    record(stage_, now() - start_);
+  }
+
+private:
+  Stage stage_;
+  double start_;
+  bool running_;
+};
+
+} // namespace stats
+} // namespace sourcetools
+
+#ifndef SOURCETOOLS_NO_STATS
+# define SOURCETOOLS_STATS_ADD(counter, n) \
+  ::sourcetools::stats::add(::sourcetools::stats::counter, n)
+# define SOURCETOOLS_STATS_TIMER(name, stage) \
+  ::sourcetools::stats::Timer name(::sourcetools::stats::stage)
+# define SOURCETOOLS_STATS_STOP(name) name.stop()
+#else
+# define SOURCETOOLS_STATS_ADD(counter, n) do {} while (0)
+# define SOURCETOOLS_STATS_TIMER(name, stage) do {} while (0)
+# define SOURCETOOLS_STATS_STOP(name) do {} while (0)
+#endif
+
+#endif /* SOURCETOOLS_CORE_STATS_H */
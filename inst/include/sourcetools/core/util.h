@@ -27,10 +27,11 @@ template <typename T>
 class scoped_ptr : noncopyable
 {
 public:
-  explicit scoped_ptr(T* pData) : pData_(pData) {}
+  explicit scoped_ptr(T* pData = NULL) : pData_(pData) {}
   T& operator*() const { return *pData_; }
   T* operator->() const { return pData_; }
   operator T*() const { return pData_; }
+  void reset(T* pData = NULL) { delete pData_; pData_ = pData; }
   ~scoped_ptr() { delete pData_; }
 private:
   T* pData_;
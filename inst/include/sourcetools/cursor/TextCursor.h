@@ -1,7 +1,10 @@
 #ifndef SOURCETOOLS_CURSOR_TEXT_CURSOR_H
 #define SOURCETOOLS_CURSOR_TEXT_CURSOR_H
 
+#include <cstring>
+
 #include <string>
+#include <algorithm>
 
 #include <sourcetools/core/macros.h>
 #include <sourcetools/collection/Position.h>
@@ -21,6 +24,18 @@ public:
   {
   }
 
+  // Resume from 'offset', at the given row and column.
+  TextCursor(const char* text,
+             std::size_t n,
+             std::size_t offset,
+             const collections::Position& position)
+      : text_(text),
+        n_(n),
+        offset_(offset),
+        position_(position)
+  {
+  }
+
   char peek(std::size_t offset = 0)
   {
     std::size_t index = offset_ + offset;
@@ -31,15 +46,42 @@ public:
 
   void advance(std::size_t times = 1)
   {
-    for (std::size_t i = 0; i < times; ++i) {
-      if (peek() == '\n') {
-        ++position_.row;
-        position_.column = 0;
-      } else {
-        ++position_.column;
+    // Short spans are cheapest to handle a character at a time.
+    if (times < 16) {
+      for (std::size_t i = 0; i < times; ++i) {
+        if (peek() == '\n') {
+          ++position_.row;
+          position_.column = 0;
+        } else {
+          ++position_.column;
+        }
+        ++offset_;
       }
-      ++offset_;
+      return;
     }
+
+    // For longer spans, jump between newlines with 'std::memchr()',
+    // and compute the column from the start of the last line.
+    std::size_t available = 0;
+    if (offset_ < n_)
+      available = std::min(times, n_ - offset_);
+
+    const char* it = text_ + offset_;
+    const char* end = it + available;
+    const char* line = NULL;
+    while (const void* match = std::memchr(it, '\n', end - it)) {
+      ++position_.row;
+      it = line = static_cast<const char*>(match) + 1;
+    }
+
+    if (line == NULL)
+      position_.column += available;
+    else
+      position_.column = end - line;
+
+    // Advancing past the end of the text just bumps the column.
+    position_.column += times - available;
+    offset_ += times;
   }
 
   operator const char*() const { return text_ + offset_; }
@@ -6,28 +6,141 @@
 
 #include <sourcetools/collection/Position.h>
 #include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+#include <sourcetools/tokenization/BracketTable.h>
+#include <sourcetools/tokenization/LineTable.h>
+#include <sourcetools/tokenization/SkipTable.h>
 
 namespace sourcetools {
 namespace cursors {
 
-class TokenCursor {
+namespace detail {
+
+// Token storage backed by a vector of (full) tokens.
+class TokenVectorStorage
+{
+private:
+  typedef tokens::Token Token;
+
+public:
+  typedef const Token& reference;
+
+  TokenVectorStorage(const std::vector<Token>& tokens)
+    : tokens_(tokens)
+  {
+  }
+
+  std::size_t size() const { return tokens_.size(); }
+  reference at(std::size_t index) const { return tokens_[index]; }
+  tokens::TokenType type(std::size_t index) const { return tokens_[index].type(); }
+
+  const collections::Position& position(std::size_t index) const
+  {
+    return tokens_[index].position();
+  }
+
+private:
+  const std::vector<Token>& tokens_;
+};
+
+// Token storage backed by compact tokens. Tokens are
+// re-materialized on access, and so are returned by value.
+class TokenViewStorage
+{
+private:
+  typedef tokens::Token Token;
+
+public:
+  typedef Token reference;
+
+  TokenViewStorage(const tokens::TokenView& view)
+    : view_(view)
+  {
+  }
+
+  TokenViewStorage(const tokens::TokenBuffer& buffer)
+    : view_(buffer.view())
+  {
+  }
+
+  std::size_t size() const { return view_.size(); }
+  reference at(std::size_t index) const { return view_.token(index); }
+  tokens::TokenType type(std::size_t index) const { return view_.type(index); }
+
+  collections::Position position(std::size_t index) const
+  {
+    return view_.position(index);
+  }
+
+private:
+  tokens::TokenView view_;
+};
+
+} // namespace detail
+
+template <typename Storage>
+class BasicTokenCursor {
 
 private:
   typedef collections::Position Position;
   typedef tokens::Token Token;
+  typedef typename Storage::reference reference;
 
 public:
 
-  TokenCursor(const std::vector<Token>& tokens)
+  template <typename T>
+  BasicTokenCursor(const T& tokens)
     : tokens_(tokens),
       offset_(0),
-      n_(tokens.size()),
-      noSuchToken_(tokens::END)
+      n_(tokens_.size()),
+      noSuchToken_(tokens::END),
+      pBrackets_(NULL),
+      pLines_(NULL),
+      pSkips_(NULL)
   {}
 
+  template <typename T>
+  BasicTokenCursor(const T& tokens, const tokens::BracketTable& brackets)
+    : tokens_(tokens),
+      offset_(0),
+      n_(tokens_.size()),
+      noSuchToken_(tokens::END),
+      pBrackets_(NULL),
+      pLines_(NULL),
+      pSkips_(NULL)
+  {
+    use(brackets);
+  }
+
+  // Use a table, built over the same tokens (and which must outlive
+  // the cursor), to speed up navigation: with a bracket table,
+  // matching brackets are found in constant time; with a line
+  // table, positions are found by searching a single row; and with a
+  // skip table, whitespace and comments are skipped (and significant
+  // tokens counted off) in constant time. Returns
+  // false (and leaves the table unused) if the table was built over
+  // a different number of tokens.
+  bool use(const tokens::BracketTable& brackets)
+  {
+    pBrackets_ = brackets.size() == n_ ? &brackets : NULL;
+    return pBrackets_ != NULL;
+  }
+
+  bool use(const tokens::LineTable& lines)
+  {
+    pLines_ = lines.tokenCount() == n_ ? &lines : NULL;
+    return pLines_ != NULL;
+  }
+
+  bool use(const tokens::SkipTable& skips)
+  {
+    pSkips_ = skips.size() == n_ ? &skips : NULL;
+    return pSkips_ != NULL;
+  }
+
   bool moveToNextToken()
   {
-    if (UNLIKELY(offset_ >= n_ - 1))
+    if (UNLIKELY(offset_ + 1 >= n_))
       return false;
 
     ++offset_;
@@ -36,6 +149,9 @@ public:
 
   bool moveToNextSignificantToken()
   {
+    if (pSkips_ != NULL)
+      return skipFwd(offset_ + 1);
+
     if (!moveToNextToken())
       return false;
 
@@ -56,6 +172,9 @@ public:
 
   bool moveToPreviousSignificantToken()
   {
+    if (pSkips_ != NULL)
+      return offset_ > 0 && skipBwd(offset_ - 1);
+
     if (!moveToPreviousToken())
       return false;
 
@@ -65,32 +184,32 @@ public:
     return true;
   }
 
-  const Token& peekFwd(std::size_t offset = 1) const
+  reference peekFwd(std::size_t offset = 1) const
   {
     std::size_t index = offset_ + offset;
     if (UNLIKELY(index >= n_))
       return noSuchToken_;
 
-    return tokens_[index];
+    return tokens_.at(index);
   }
 
-  const Token& peekBwd(std::size_t offset = 1) const
+  reference peekBwd(std::size_t offset = 1) const
   {
     if (UNLIKELY(offset > offset_))
       return noSuchToken_;
 
     std::size_t index = offset_ - offset;
-    return tokens_[index];
+    return tokens_.at(index);
   }
 
-  const Token& currentToken() const
+  reference currentToken() const
   {
     if (UNLIKELY(offset_ >= n_))
       return noSuchToken_;
-    return tokens_[offset_];
+    return tokens_.at(offset_);
   }
 
-  operator const Token&() const { return currentToken(); }
+  operator reference() const { return currentToken(); }
 
   bool fwdOverWhitespace()
   {
@@ -126,6 +245,9 @@ public:
 
   bool fwdOverWhitespaceAndComments()
   {
+    if (pSkips_ != NULL && offset_ < n_)
+      return skipFwd(offset_);
+
     while (isType(tokens::COMMENT) || isType(tokens::WHITESPACE))
       if (!moveToNextToken())
         return false;
@@ -134,26 +256,45 @@ public:
 
   bool bwdOverWhitespaceAndComments()
   {
+    if (pSkips_ != NULL && offset_ < n_)
+      return skipBwd(offset_);
+
     while (isType(tokens::COMMENT) || isType(tokens::WHITESPACE))
       if (!moveToPreviousToken())
         return false;
     return true;
   }
 
-  const Token& nextSignificantToken(std::size_t times = 1) const
+  reference nextSignificantToken(std::size_t times = 1) const
   {
-    TokenCursor clone(*this);
+    if (pSkips_ != NULL && times > 0 && offset_ + 1 < n_)
+    {
+      std::size_t rank = pSkips_->rank(offset_ + 1) + times - 1;
+      return rank < pSkips_->count()
+        ? tokens_.at(pSkips_->significant(rank))
+        : tokens_.at(n_ - 1);
+    }
+
+    BasicTokenCursor clone(*this);
     for (std::size_t i = 0; i < times; ++i)
       clone.moveToNextSignificantToken();
-    return clone;
+    return clone.currentToken();
   }
 
-  const Token& previousSignificantToken(std::size_t times = 1) const
+  reference previousSignificantToken(std::size_t times = 1) const
   {
-    TokenCursor clone(*this);
+    if (pSkips_ != NULL && times > 0 && offset_ > 0 && offset_ < n_)
+    {
+      std::size_t rank = pSkips_->rank(offset_);
+      return times <= rank
+        ? tokens_.at(pSkips_->significant(rank - times))
+        : tokens_.at(0);
+    }
+
+    BasicTokenCursor clone(*this);
     for (std::size_t i = 0; i < times; ++i)
       clone.moveToPreviousSignificantToken();
-    return clone;
+    return clone.currentToken();
   }
 
   bool moveToPosition(std::size_t row, std::size_t column)
@@ -161,35 +302,40 @@ public:
     return moveToPosition(Position(row, column));
   }
 
+  // Move to the token at 'target', i.e. the last token starting at
+  // or before 'target' (or the first token, if none does).
   bool moveToPosition(const Position& target)
   {
     if (UNLIKELY(n_ == 0))
       return false;
 
-    if (UNLIKELY(tokens_[n_ - 1].position() <= target))
+    if (UNLIKELY(tokens_.position(n_ - 1) <= target))
     {
       offset_ = n_ - 1;
       return true;
     }
 
-    std::size_t start  = 0;
-    std::size_t end    = n_;
-
-    std::size_t offset = 0;
-    while (true)
+    // Only the tokens starting on the target row need be searched
+    // when their extent is known.
+    std::size_t start = 0;
+    std::size_t end   = n_;
+    if (pLines_ != NULL)
     {
-      offset = (start + end) / 2;
-      const Position& current = tokens_[offset].position();
+      start = pLines_->firstToken(target.row);
+      end   = pLines_->firstToken(target.row + 1);
+    }
 
-      if (current == target || start == end)
-        break;
-      else if (current < target)
+    // Find the first token starting after 'target'.
+    while (start < end)
+    {
+      std::size_t offset = start + (end - start) / 2;
+      if (tokens_.position(offset) <= target)
         start = offset + 1;
       else
-        end = offset - 1;
+        end = offset;
     }
 
-    offset_ = offset;
+    offset_ = start == 0 ? 0 : start - 1;
     return true;
   }
 
@@ -245,21 +391,27 @@ public:
     return false;
   }
 
+  // Move to the bracket matching the current (left) bracket. With a
+  // bracket table, this takes constant time, and the cursor is left
+  // in place when there is no match.
   bool fwdToMatchingBracket()
   {
     using namespace tokens;
+    if (pBrackets_ != NULL)
+      return jumpToPartner(true);
+
     if (!isLeftBracket(currentToken()))
       return false;
 
-    TokenType lhs = currentToken().type();
+    TokenType lhs = type();
     TokenType rhs = complement(lhs);
     std::size_t balance = 1;
 
     while (moveToNextSignificantToken())
     {
-      TokenType type = currentToken().type();
-      balance += type == lhs;
-      balance -= type == rhs;
+      TokenType current = type();
+      balance += current == lhs;
+      balance -= current == rhs;
       if (balance == 0) return true;
     }
 
@@ -269,31 +421,40 @@ public:
   bool bwdToMatchingBracket()
   {
     using namespace tokens;
+    if (pBrackets_ != NULL)
+      return jumpToPartner(false);
+
     if (!isRightBracket(currentToken()))
       return false;
 
-    TokenType lhs = currentToken().type();
+    TokenType lhs = type();
     TokenType rhs = complement(lhs);
     std::size_t balance = 1;
 
     while (moveToPreviousSignificantToken())
     {
-      TokenType type = currentToken().type();
-      balance += type == lhs;
-      balance -= type == rhs;
+      TokenType current = type();
+      balance += current == lhs;
+      balance -= current == rhs;
       if (balance == 0) return true;
     }
 
     return false;
   }
 
-  friend std::ostream& operator<<(std::ostream& os, const TokenCursor& cursor)
+  friend std::ostream& operator<<(std::ostream& os, const BasicTokenCursor& cursor)
   {
     return os << toString(cursor.currentToken());
   }
 
-  tokens::TokenType type() const { return currentToken().type(); }
-  bool isType(tokens::TokenType type) const { return currentToken().isType(type); }
+  tokens::TokenType type() const
+  {
+    if (UNLIKELY(offset_ >= n_))
+      return noSuchToken_.type();
+    return tokens_.type(offset_);
+  }
+
+  bool isType(tokens::TokenType type) const { return this->type() == type; }
   collections::Position position() const { return currentToken().position(); }
   std::size_t offset() const { return offset_; }
   std::size_t row() const { return currentToken().row(); }
@@ -302,16 +463,67 @@ public:
 
 private:
 
-  const std::vector<Token>& tokens_;
+  // Move to the first significant token at or after 'index', or
+  // (when there is none) to the last token, as when skipping one
+  // token at a time.
+  bool skipFwd(std::size_t index)
+  {
+    if (UNLIKELY(index >= n_))
+      return false;
+
+    std::size_t rank = pSkips_->rank(index);
+    if (rank == pSkips_->count())
+    {
+      offset_ = n_ - 1;
+      return false;
+    }
+
+    offset_ = pSkips_->significant(rank);
+    return true;
+  }
+
+  // Move to the last significant token at or before 'index', or
+  // (when there is none) to the first token.
+  bool skipBwd(std::size_t index)
+  {
+    std::size_t rank = pSkips_->rank(index + 1);
+    if (rank == 0)
+    {
+      offset_ = 0;
+      return false;
+    }
+
+    offset_ = pSkips_->significant(rank - 1);
+    return true;
+  }
+
+  bool jumpToPartner(bool forward)
+  {
+    std::size_t partner = pBrackets_->partner(offset_);
+    if (partner == tokens::NO_PARTNER || (partner > offset_) != forward)
+      return false;
+
+    offset_ = partner;
+    return true;
+  }
+
+  Storage tokens_;
   std::size_t offset_;
   std::size_t n_;
   Token noSuchToken_;
+  const tokens::BracketTable* pBrackets_;
+  const tokens::LineTable* pLines_;
+  const tokens::SkipTable* pSkips_;
 
 };
 
+typedef BasicTokenCursor<detail::TokenVectorStorage> TokenCursor;
+typedef BasicTokenCursor<detail::TokenViewStorage> CompactTokenCursor;
+
 } // namespace cursors
 
-inline std::string toString(const cursors::TokenCursor& cursor)
+template <typename Storage>
+inline std::string toString(const cursors::BasicTokenCursor<Storage>& cursor)
 {
   return toString(cursor.currentToken());
 }
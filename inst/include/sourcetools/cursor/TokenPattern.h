@@ -0,0 +1,141 @@
+#ifndef SOURCETOOLS_CURSOR_TOKEN_PATTERN_H
+#define SOURCETOOLS_CURSOR_TOKEN_PATTERN_H
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+#include <sourcetools/tokenization/Registration.h>
+#include <sourcetools/tokenization/Token.h>
+#include <sourcetools/cursor/TokenCursor.h>
+
+namespace sourcetools {
+namespace cursors {
+
+// A pattern over a short sequence of significant tokens (i.e. tokens
+// other than whitespace and comments), each matched by its type and,
+// optionally, its contents; e.g. the symbol 'library' followed by a
+// '(', or any symbol, then '::', then any symbol.
+class TokenPattern
+{
+public:
+
+  // Add an element matching a significant token whose type is in
+  // 'mask' (a set of token categories, as with 'tokens::matchesMask()'),
+  // and whose contents are one of 'values' (or anything, when 'values'
+  // is empty).
+  void push_back(tokens::TokenType mask,
+                 const std::vector<std::string>& values = std::vector<std::string>())
+  {
+    elements_.push_back(Element());
+    elements_.back().mask = mask;
+    elements_.back().values = values;
+  }
+
+  void push_back(tokens::TokenType mask, const std::string& value)
+  {
+    push_back(mask, std::vector<std::string>(1, value));
+  }
+
+  std::size_t size() const { return elements_.size(); }
+  bool empty() const { return elements_.empty(); }
+
+  // Does the pattern match the tokens starting at the cursor? On a
+  // match, 'pLast' is set to the offset of the last token matched.
+  template <typename Cursor>
+  bool matches(const Cursor& cursor, std::size_t* pLast = NULL) const
+  {
+    if (elements_.empty() || !matches(elements_[0], cursor))
+      return false;
+
+    Cursor clone(cursor);
+    for (std::size_t i = 1; i < elements_.size(); ++i)
+      if (!clone.moveToNextSignificantToken() || !matches(elements_[i], clone))
+        return false;
+
+    if (pLast != NULL)
+      *pLast = clone.offset();
+    return true;
+  }
+
+  // Invoke 'f(first, last)', with the offsets of the first and last
+  // tokens matched, for each match at or after the cursor, in order.
+  // Returns the number of matches.
+  template <typename Cursor, typename F>
+  std::size_t search(Cursor cursor, F& f) const
+  {
+    std::size_t count = 0;
+    std::size_t last = 0;
+    while (cursor.findFwd(Finder<Cursor>(*this, &last)))
+    {
+      f(cursor.offset(), last);
+      ++count;
+
+      if (!cursor.moveToNextToken())
+        break;
+    }
+
+    return count;
+  }
+
+private:
+
+  struct Element
+  {
+    tokens::TokenType mask;
+    std::vector<std::string> values;
+  };
+
+  // The predicate passed to 'findFwd()'.
+  template <typename Cursor>
+  class Finder
+  {
+  public:
+
+    Finder(const TokenPattern& pattern, std::size_t* pLast)
+      : pattern_(pattern),
+        pLast_(pLast)
+    {
+    }
+
+    bool operator()(const Cursor* pCursor) const
+    {
+      return pattern_.matches(*pCursor, pLast_);
+    }
+
+  private:
+    const TokenPattern& pattern_;
+    std::size_t* pLast_;
+  };
+
+  // Types are checked first, as they are cheaper to compare (and
+  // usually enough to rule a token out).
+  template <typename Cursor>
+  static bool matches(const Element& element, const Cursor& cursor)
+  {
+    tokens::TokenType type = cursor.type();
+    if (!tokens::matchesMask(type, element.mask) ||
+        tokens::matchesMask(type, tokens::WHITESPACE | tokens::COMMENT | tokens::END))
+    {
+      return false;
+    }
+
+    if (element.values.empty())
+      return true;
+
+    const tokens::Token& token = cursor.currentToken();
+    for (std::size_t i = 0; i < element.values.size(); ++i)
+      if (token.contentsEqual(element.values[i]))
+        return true;
+
+    return false;
+  }
+
+  std::vector<Element> elements_;
+};
+
+} // namespace cursors
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_CURSOR_TOKEN_PATTERN_H */
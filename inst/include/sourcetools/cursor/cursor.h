@@ -3,5 +3,6 @@
 
 #include <sourcetools/cursor/TextCursor.h>
 #include <sourcetools/cursor/TokenCursor.h>
+#include <sourcetools/cursor/TokenPattern.h>
 
 #endif /* SOURCETOOLS_CURSOR_CURSOR_H */
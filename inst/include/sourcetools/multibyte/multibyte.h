@@ -3,6 +3,7 @@
 
 #include <cstdlib>
 #include <cwchar>
+#include <cwctype>
 
 namespace sourcetools {
 namespace multibyte {
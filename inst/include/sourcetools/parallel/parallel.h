@@ -0,0 +1,82 @@
+#ifndef SOURCETOOLS_PARALLEL_PARALLEL_H
+#define SOURCETOOLS_PARALLEL_PARALLEL_H
+
+#include <cstddef>
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+namespace sourcetools {
+namespace parallel {
+
+// The number of worker threads available. When OpenMP is
+// unavailable, all work happens on the calling thread.
+inline std::size_t threadCount()
+{
+#ifdef _OPENMP
+  return static_cast<std::size_t>(omp_get_max_threads());
+#else
+  return 1;
+#endif
+}
+
+// Invoke 'f(i)' for each 'i' in '[0, n)', distributing iterations
+// over up to 'threads' worker threads ('0' implies all available
+// threads). The functor must not call into R, and must not let
+// exceptions escape; as an extra safety net, any exception thrown
+// is caught and reported by a 'false' return value.
+template <typename F>
+inline bool forEach(std::size_t n, std::size_t threads, F& f)
+{
+  bool success = true;
+
+#ifdef _OPENMP
+  if (threads == 0 || threads > threadCount())
+    threads = threadCount();
+
+  if (threads > n)
+    threads = n;
+
+  if (threads > 1)
+  {
+    // NOTE: OpenMP 2.0 requires a signed loop index.
+    long count = static_cast<long>(n);
+
+    #pragma omp parallel for schedule(dynamic) num_threads(static_cast<int>(threads))
+    for (long i = 0; i < count; ++i)
+    {
+      try
+      {
+        f(static_cast<std::size_t>(i));
+      }
+      catch (...)
+      {
+        #pragma omp critical
+        success = false;
+      }
+    }
+
+    return success;
+  }
+#else
+  (void) threads;
+#endif
+
+  try
+  {
+    for (std::size_t i = 0; i < n; ++i)
+      f(i);
+  }
+  catch (...)
+  {
+    success = false;
+  }
+
+  return success;
+}
+
+} // namespace parallel
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_PARALLEL_PARALLEL_H */
@@ -2,6 +2,7 @@
 #define SOURCETOOLS_R_R_CALL_RECURSER_H
 
 #include <vector>
+#include <algorithm>
 
 #include <sourcetools/core/core.h>
 
@@ -12,61 +13,190 @@
 namespace sourcetools {
 namespace r {
 
+// Walks the calls making up an R expression (or a function's body),
+// in depth-first order, applying a set of operations to each node.
+//
+// The walk is iterative, over an explicit stack that is re-used from
+// one run to the next, so that deeply nested code cannot overflow the
+// C stack. Operations share a single walk; each decides, at each node,
+// whether to continue into the node's children, skip them, or stop
+// altogether. The walk ends once every operation has stopped.
 class CallRecurser : noncopyable
 {
 public:
 
-  class Operation
+  enum Action
+  {
+    // Visit the node's children (and the rest of the expression).
+    CONTINUE,
+
+    // Skip the node's children, but visit the rest of the expression.
+    SKIP,
+
+    // Visit no further nodes (e.g. once the operation has its answer).
+    STOP
+  };
+
+  // An operation that decides, at each node visited, how the walk
+  // continues.
+  class Visitor
   {
   public:
+    virtual Action visit(SEXP dataSEXP) = 0;
+    virtual ~Visitor() {}
+  };
+
+  // An operation that sees every node.
+  class Operation : public Visitor
+  {
+  public:
+
+    virtual Action visit(SEXP dataSEXP)
+    {
+      apply(dataSEXP);
+      return CONTINUE;
+    }
+
     virtual void apply(SEXP dataSEXP) = 0;
-    virtual ~Operation() {}
   };
 
+  CallRecurser()
+    : dataSEXP_(R_NilValue)
+  {
+  }
+
   explicit CallRecurser(SEXP dataSEXP)
+    : dataSEXP_(target(dataSEXP))
   {
-    if (Rf_isPrimitive(dataSEXP))
-      dataSEXP_ = R_NilValue;
-    else if (Rf_isFunction(dataSEXP))
-      dataSEXP_ = r::util::functionBody(dataSEXP);
-    else if (TYPEOF(dataSEXP) == LANGSXP)
-      dataSEXP_ = dataSEXP;
-    else
-      dataSEXP_ = R_NilValue;
   }
 
-  void add(Operation* pOperation)
+  void add(Visitor* pOperation)
   {
     operations_.push_back(pOperation);
   }
 
+  // Remove all operations.
+  void clear()
+  {
+    operations_.clear();
+  }
+
   void run()
   {
-    runImpl(dataSEXP_);
+    walk(dataSEXP_);
+  }
+
+  void run(SEXP dataSEXP)
+  {
+    dataSEXP_ = target(dataSEXP);
+    walk(dataSEXP_);
   }
 
+  // Walk 'dataSEXP' itself, rather than (as 'run()' does) the body of
+  // a function.
   void runImpl(SEXP dataSEXP)
   {
-    for (std::vector<Operation*>::iterator it = operations_.begin();
-         it != operations_.end();
-         ++it)
+    walk(dataSEXP);
+  }
+
+private:
+
+  static const std::size_t ACTIVE = static_cast<std::size_t>(-1);
+  static const std::size_t STOPPED = 0;
+
+  struct Frame
+  {
+    Frame(SEXP dataSEXP, std::size_t depth)
+      : dataSEXP(dataSEXP), depth(depth)
     {
-      (*it)->apply(dataSEXP);
     }
 
-    if (TYPEOF(dataSEXP) == LANGSXP)
+    SEXP dataSEXP;
+    std::size_t depth;
+  };
+
+  static SEXP target(SEXP dataSEXP)
+  {
+    if (Rf_isPrimitive(dataSEXP))
+      return R_NilValue;
+    else if (Rf_isFunction(dataSEXP))
+      return r::util::functionBody(dataSEXP);
+    else if (TYPEOF(dataSEXP) == LANGSXP)
+      return dataSEXP;
+    else
+      return R_NilValue;
+  }
+
+  void walk(SEXP dataSEXP)
+  {
+    std::size_t n = operations_.size();
+    if (n == 0)
+      return;
+
+    // The state of each operation: 'ACTIVE'; skipping the children of
+    // a node, recorded as the (non-zero) depth of that node; or
+    // 'STOPPED'. Nodes are numbered from depth 1.
+    states_.assign(n, std::size_t(ACTIVE));
+    std::size_t stopped = 0;
+
+    stack_.clear();
+    stack_.push_back(Frame(dataSEXP, 1));
+
+    while (!stack_.empty())
     {
-      while (dataSEXP != R_NilValue)
+      Frame frame = stack_.back();
+      stack_.pop_back();
+
+      bool descend = false;
+      for (std::size_t i = 0; i < n; ++i)
       {
-        runImpl(CAR(dataSEXP));
-        dataSEXP = CDR(dataSEXP);
+        std::size_t& state = states_[i];
+        if (state == STOPPED)
+          continue;
+
+        // Past the end of the subtree this operation skipped?
+        if (state != ACTIVE)
+        {
+          if (frame.depth > state)
+            continue;
+          state = ACTIVE;
+        }
+
+        Action action = operations_[i]->visit(frame.dataSEXP);
+        if (action == CONTINUE)
+        {
+          descend = true;
+        }
+        else if (action == SKIP)
+        {
+          state = frame.depth;
+        }
+        else
+        {
+          state = STOPPED;
+          if (++stopped == n)
+            return;
+        }
+      }
+
+      // Operations still skipping an enclosing subtree don't see
+      // these children, but others might.
+      if (descend && TYPEOF(frame.dataSEXP) == LANGSXP)
+      {
+        // Children are pushed in reverse, so that they are visited
+        // in order.
+        std::size_t size = stack_.size();
+        for (SEXP nodeSEXP = frame.dataSEXP; nodeSEXP != R_NilValue; nodeSEXP = CDR(nodeSEXP))
+          stack_.push_back(Frame(CAR(nodeSEXP), frame.depth + 1));
+        std::reverse(stack_.begin() + size, stack_.end());
       }
     }
   }
 
-private:
   SEXP dataSEXP_;
-  std::vector<Operation*> operations_;
+  std::vector<Visitor*> operations_;
+  std::vector<Frame> stack_;
+  std::vector<std::size_t> states_;
 };
 
 } // namespace r
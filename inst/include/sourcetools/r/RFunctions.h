@@ -23,6 +23,9 @@ inline SEXP eval(const std::string& fn, SEXP envSEXP = NULL)
   return resultSEXP;
 }
 
+// NOTE: This lists (and copies) every name on the search path on each
+// call; see 'searchPath()' for a cached set of names that is only
+// updated as the search path changes.
 inline std::set<std::string> objectsOnSearchPath()
 {
   std::set<std::string> results;
@@ -4,5 +4,6 @@
 #define R_NO_REMAP
 #include <R.h>
 #include <Rinternals.h>
+#include <Rversion.h>
 
 #endif /* SOURCETOOLS_R_R_HEADERS_H */
@@ -1,8 +1,7 @@
 #ifndef SOURCETOOLS_R_R_NON_STANDARD_EVALUATION_H
 #define SOURCETOOLS_R_R_NON_STANDARD_EVALUATION_H
 
-#include <set>
-#include <map>
+#include <vector>
 
 #include <sourcetools/r/RHeaders.h>
 #include <sourcetools/r/RCallRecurser.h>
@@ -13,27 +12,49 @@ namespace nse {
 
 namespace detail {
 
-inline std::set<std::string> makeNsePrimitives()
+// Symbols consulted while checking calls, installed once.
+struct Symbols
 {
-  std::set<std::string> instance;
+  Symbols()
+    : quote(Rf_install("quote")),
+      substitute(Rf_install("substitute")),
+      eval(Rf_install("eval")),
+      evalq(Rf_install("evalq")),
+      lazyDots(Rf_install("lazy_dots")),
+      lazyeval(Rf_install("lazyeval")),
+      doubleColon(Rf_install("::")),
+      tripleColon(Rf_install(":::"))
+  {
+  }
 
-  instance.insert("quote");
-  instance.insert("substitute");
-  instance.insert("eval");
-  instance.insert("evalq");
-  instance.insert("lazy_dots");
+  SEXP quote;
+  SEXP substitute;
+  SEXP eval;
+  SEXP evalq;
+  SEXP lazyDots;
+  SEXP lazyeval;
+  SEXP doubleColon;
+  SEXP tripleColon;
+};
 
+inline const Symbols& symbols()
+{
+  static Symbols instance;
   return instance;
 }
 
-inline std::set<std::string>& nsePrimitives()
+inline bool isNsePrimitive(SEXP symSEXP)
 {
-  static std::set<std::string> instance = makeNsePrimitives();
-  return instance;
+  const Symbols& s = symbols();
+  return symSEXP == s.quote ||
+         symSEXP == s.substitute ||
+         symSEXP == s.eval ||
+         symSEXP == s.evalq ||
+         symSEXP == s.lazyDots;
 }
 
 class PerformsNonStandardEvaluationOperation
-  : public r::CallRecurser::Operation
+  : public r::CallRecurser::Visitor
 {
 public:
 
@@ -42,20 +63,21 @@ public:
   {
   }
 
-  virtual void apply(SEXP dataSEXP)
+  virtual r::CallRecurser::Action visit(SEXP dataSEXP)
   {
-    if (status_ || TYPEOF(dataSEXP) != LANGSXP)
-      return;
-
-    if ((status_ = checkCall(dataSEXP)))
-      return;
+    if (TYPEOF(dataSEXP) != LANGSXP)
+      return r::CallRecurser::CONTINUE;
 
     SEXP fnSEXP = CAR(dataSEXP);
-    if (TYPEOF(fnSEXP) == SYMSXP)
-      status_ = nsePrimitives().count(CHAR(PRINTNAME(fnSEXP)));
-    else if (TYPEOF(fnSEXP) == STRSXP)
-      status_ = nsePrimitives().count(CHAR(STRING_ELT(fnSEXP, 0)));
-
+    if (checkCall(dataSEXP))
+      status_ = true;
+    else if (TYPEOF(fnSEXP) == SYMSXP)
+      status_ = isNsePrimitive(fnSEXP);
+    else if (TYPEOF(fnSEXP) == STRSXP && Rf_length(fnSEXP) > 0)
+      status_ = isNsePrimitive(Rf_install(CHAR(STRING_ELT(fnSEXP, 0))));
+
+    // No need to look any further once we have our answer.
+    return status_ ? r::CallRecurser::STOP : r::CallRecurser::CONTINUE;
   }
 
   bool status() const { return status_; }
@@ -64,17 +86,15 @@ private:
 
   bool checkCall(SEXP callSEXP)
   {
-    std::size_t n = Rf_length(callSEXP);
-    if (n == 0)
-      return false;
+    const Symbols& s = symbols();
 
     SEXP fnSEXP = CAR(callSEXP);
-    if (fnSEXP == Rf_install("::") || fnSEXP == Rf_install(":::"))
+    if (fnSEXP == s.doubleColon || fnSEXP == s.tripleColon)
     {
       SEXP lhsSEXP = CADR(callSEXP);
       SEXP rhsSEXP = CADDR(callSEXP);
 
-      if (lhsSEXP == Rf_install("lazyeval") && rhsSEXP == Rf_install("lazy_dots"))
+      if (lhsSEXP == s.lazyeval && rhsSEXP == s.lazyDots)
         return true;
     }
 
@@ -87,48 +107,157 @@ private:
 
 } // namespace detail
 
-class Database
+// Caches, for closures, whether they perform non-standard evaluation.
+//
+// The cache is a fixed-size, direct-mapped table, indexed by the
+// closure's address. Each entry holds the closure itself, so that its
+// address cannot be re-used by a different object while the entry is
+// valid; at most 'capacity()' closures are retained, until they are
+// evicted by another closure mapping to the same slot, or cleared.
+//
+// NOTE: The table of entries is preserved until 'clear()' is called;
+// it is not released on destruction, as the process-wide database is
+// only destroyed once R itself has shut down.
+class Database : noncopyable
 {
 public:
+
+  static std::size_t defaultCapacity() { return 4096; }
+
+  explicit Database(std::size_t capacity = defaultCapacity())
+    : entriesSEXP_(R_NilValue),
+      capacity_(1),
+      hits_(0),
+      misses_(0)
+  {
+    // Capacities are rounded up to a power of two.
+    while (capacity_ < capacity)
+      capacity_ <<= 1;
+  }
+
   bool check(SEXP dataSEXP)
   {
-    if (contains(dataSEXP))
-      return get(dataSEXP);
+    // Only closures are cached; other functions never perform
+    // non-standard evaluation, and calls are checked as-is.
+    if (TYPEOF(dataSEXP) != CLOSXP)
+      return compute(dataSEXP);
+
+    std::size_t index = slot(dataSEXP);
+    if (VECTOR_ELT(entries(), index) == dataSEXP)
+    {
+      ++hits_;
+      return status_[index];
+    }
 
-    typedef detail::PerformsNonStandardEvaluationOperation Operation;
-    scoped_ptr<Operation> operation(new Operation);
+    ++misses_;
+    bool status = compute(dataSEXP);
 
-    r::CallRecurser recurser(dataSEXP);
-    recurser.add(operation);
-    recurser.run();
+    SET_VECTOR_ELT(entries(), index, dataSEXP);
+    status_[index] = status;
 
-    set(dataSEXP, operation->status());
-    return operation->status();
+    return status;
   }
 
-private:
+  // Check each function bound in the environment 'envSEXP', forcing
+  // any promises (e.g. the lazy-loaded objects of a namespace) along
+  // the way. Returns a logical vector, named with the names of the
+  // functions, in sorted order.
+  SEXP check(SEXP envSEXP, bool all)
+  {
+    Protect protect;
+    SEXP namesSEXP = protect(R_lsInternal(envSEXP, all ? TRUE : FALSE));
+    R_xlen_t n = Rf_xlength(namesSEXP);
+
+    std::vector<R_xlen_t> indices;
+    std::vector<int> status;
+    for (R_xlen_t i = 0; i < n; ++i)
+    {
+      SEXP symSEXP = Rf_install(CHAR(STRING_ELT(namesSEXP, i)));
+      SEXP valueSEXP = Rf_findVarInFrame(envSEXP, symSEXP);
+      if (TYPEOF(valueSEXP) == PROMSXP)
+        valueSEXP = Rf_eval(valueSEXP, envSEXP);
+
+      // Values stay reachable through the environment (forced
+      // promises retain their values), and so are not protected.
+      if (!Rf_isFunction(valueSEXP))
+        continue;
+
+      indices.push_back(i);
+      status.push_back(check(valueSEXP));
+    }
 
-  bool contains(SEXP dataSEXP)
+    SEXP resultSEXP = protect(Rf_allocVector(LGLSXP, status.size()));
+    SEXP resultNamesSEXP = protect(Rf_allocVector(STRSXP, status.size()));
+    for (std::size_t i = 0; i < status.size(); ++i)
+    {
+      LOGICAL(resultSEXP)[i] = status[i];
+      SET_STRING_ELT(resultNamesSEXP, i, STRING_ELT(namesSEXP, indices[i]));
+    }
+
+    Rf_setAttrib(resultSEXP, R_NamesSymbol, resultNamesSEXP);
+    return resultSEXP;
+  }
+
+  void clear()
   {
-    return map_.count(address(dataSEXP));
+    if (entriesSEXP_ != R_NilValue)
+    {
+      R_ReleaseObject(entriesSEXP_);
+      entriesSEXP_ = R_NilValue;
+    }
+
+    status_.clear();
+    hits_ = 0;
+    misses_ = 0;
   }
 
-  bool get(SEXP dataSEXP)
+  std::size_t capacity() const { return capacity_; }
+  std::size_t hits() const { return hits_; }
+  std::size_t misses() const { return misses_; }
+
+private:
+
+  bool compute(SEXP dataSEXP)
   {
-    return map_[address(dataSEXP)];
+    detail::PerformsNonStandardEvaluationOperation operation;
+
+    // The recurser (and its stack) is re-used from one check to the
+    // next.
+    recurser_.clear();
+    recurser_.add(&operation);
+    recurser_.run(dataSEXP);
+    recurser_.clear();
+
+    return operation.status();
   }
 
-  void set(SEXP dataSEXP, bool value)
+  // The table of entries is allocated on first use.
+  SEXP entries()
   {
-    map_[address(dataSEXP)] = value;
+    if (entriesSEXP_ == R_NilValue)
+    {
+      entriesSEXP_ = Rf_allocVector(VECSXP, capacity_);
+      R_PreserveObject(entriesSEXP_);
+      status_.assign(capacity_, false);
+    }
+
+    return entriesSEXP_;
   }
 
-  std::size_t address(SEXP dataSEXP)
+  std::size_t slot(SEXP dataSEXP) const
   {
-    return reinterpret_cast<std::size_t>(dataSEXP);
+    // Objects are at least 8-byte aligned, so the low bits of an
+    // address carry no information.
+    std::size_t address = reinterpret_cast<std::size_t>(dataSEXP) >> 3;
+    return (address * 2654435761u) & (capacity_ - 1);
   }
 
-  std::map<std::size_t, bool> map_;
+  r::CallRecurser recurser_;
+  SEXP entriesSEXP_;
+  std::vector<bool> status_;
+  std::size_t capacity_;
+  std::size_t hits_;
+  std::size_t misses_;
 };
 
 inline Database& database()
@@ -142,6 +271,12 @@ inline bool performsNonStandardEvaluation(SEXP fnSEXP)
   return database().check(fnSEXP);
 }
 
+// Check all functions in an environment (e.g. a package namespace).
+inline SEXP performsNonStandardEvaluation(SEXP envSEXP, bool all)
+{
+  return database().check(envSEXP, all);
+}
+
 } // namespace nse
 } // namespace r
 } // namespace sourcetools
@@ -0,0 +1,304 @@
+#ifndef SOURCETOOLS_R_R_SEARCH_PATH_H
+#define SOURCETOOLS_R_R_SEARCH_PATH_H
+
+#include <cstddef>
+
+#include <vector>
+#include <string>
+
+#include <sourcetools/core/core.h>
+
+#include <sourcetools/r/RHeaders.h>
+#include <sourcetools/r/RUtils.h>
+
+namespace sourcetools {
+namespace r {
+
+namespace detail {
+
+// A multiset of CHARSXPs, hashed by address. Counts fall to zero when
+// names are removed; such entries are only dropped on rehashing.
+class CharacterCounts
+{
+public:
+
+  CharacterCounts()
+    : slots_(1024),
+      used_(0),
+      size_(0)
+  {
+  }
+
+  void add(SEXP charSEXP)
+  {
+    Slot& slot = probe(charSEXP);
+    if (slot.charSEXP == NULL)
+    {
+      slot.charSEXP = charSEXP;
+      ++used_;
+    }
+
+    if (slot.count++ == 0)
+      ++size_;
+
+    // Keep the load factor at or below one half.
+    if (2 * used_ > slots_.size())
+      rehash(size_ > slots_.size() / 4 ? 2 * slots_.size() : slots_.size());
+  }
+
+  void remove(SEXP charSEXP)
+  {
+    Slot& slot = probe(charSEXP);
+    if (slot.charSEXP != NULL && slot.count > 0 && --slot.count == 0)
+      --size_;
+  }
+
+  bool contains(SEXP charSEXP) const
+  {
+    const Slot& slot = const_cast<CharacterCounts*>(this)->probe(charSEXP);
+    return slot.charSEXP != NULL && slot.count > 0;
+  }
+
+  // The number of distinct names.
+  std::size_t size() const { return size_; }
+
+private:
+
+  struct Slot
+  {
+    Slot() : charSEXP(NULL), count(0) {}
+
+    SEXP charSEXP;
+    std::size_t count;
+  };
+
+  std::size_t index(SEXP charSEXP) const
+  {
+    std::size_t address = reinterpret_cast<std::size_t>(charSEXP) >> 3;
+    return (address * 2654435761u) & (slots_.size() - 1);
+  }
+
+  Slot& probe(SEXP charSEXP)
+  {
+    std::size_t mask = slots_.size() - 1;
+    std::size_t i = index(charSEXP);
+    while (slots_[i].charSEXP != NULL && slots_[i].charSEXP != charSEXP)
+      i = (i + 1) & mask;
+    return slots_[i];
+  }
+
+  void rehash(std::size_t capacity)
+  {
+    std::vector<Slot> slots(capacity);
+    slots.swap(slots_);
+
+    used_ = 0;
+    for (std::size_t i = 0; i < slots.size(); ++i)
+    {
+      if (slots[i].count == 0)
+        continue;
+
+      Slot& slot = probe(slots[i].charSEXP);
+      slot = slots[i];
+      ++used_;
+    }
+  }
+
+  std::vector<Slot> slots_;
+  std::size_t used_;
+  std::size_t size_;
+};
+
+} // namespace detail
+
+// The set of names bound on the search path (in the global
+// environment, attached packages and so on, through to the base
+// environment), as a set of CHARSXPs, for constant-time lookups.
+//
+// The set is refreshed on demand with 'update()', which re-lists only
+// those environments that have changed, so that the set follows
+// 'attach()' and 'detach()', and any environment gaining or losing
+// bindings, without re-building it from scratch. Locked environments
+// (e.g. those of attached packages) cannot gain or lose bindings, and
+// so are only re-listed when attached anew. Other environments (e.g.
+// the global environment) are checked by listing them; but the names
+// listed are only compared, by address, with those already held.
+// The base environment is assumed never to change.
+//
+// Binding names are the print names of symbols, which R never
+// collects, and so the CHARSXPs held need not be protected. The
+// environments on the search path are preserved while listed, so
+// that their addresses are not re-used behind our back.
+class SearchPath : noncopyable
+{
+public:
+
+  SearchPath()
+    : updates_(0)
+  {
+  }
+
+  // Bring the set up to date with the search path. Returns the number
+  // of environments that were (re-)listed.
+  std::size_t update()
+  {
+    std::vector<Frame> frames;
+    std::vector<bool> reused(frames_.size(), false);
+    std::size_t listed = 0;
+
+    for (SEXP envSEXP = R_GlobalEnv; envSEXP != R_EmptyEnv; envSEXP = ENCLOS(envSEXP))
+    {
+      frames.push_back(Frame());
+      Frame& frame = frames.back();
+      frame.envSEXP = envSEXP;
+      frame.locked = envSEXP == R_BaseEnv || R_EnvironmentIsLocked(envSEXP);
+
+      // Re-use the names listed for environments already seen, and
+      // unchanged, wherever they now are on the search path.
+      std::size_t j = find(envSEXP, reused);
+      if (j != frames_.size() && frames_[j].locked == frame.locked)
+      {
+        if (frame.locked)
+        {
+          reuse(&frames_[j], &frame);
+          reused[j] = true;
+          continue;
+        }
+
+        Protect protect;
+        SEXP namesSEXP = protect(R_lsInternal(envSEXP, TRUE));
+        if (equal(namesSEXP, frames_[j].names))
+        {
+          reuse(&frames_[j], &frame);
+          reused[j] = true;
+          continue;
+        }
+
+        list(namesSEXP, &frame);
+        ++listed;
+        continue;
+      }
+
+      if (j == frames_.size())
+        R_PreserveObject(envSEXP);
+
+      Protect protect;
+      list(protect(R_lsInternal(envSEXP, TRUE)), &frame);
+      ++listed;
+    }
+
+    // Forget the names of environments since detached or changed.
+    // (Names are counted, so this can safely follow the listing of
+    // their replacements.)
+    for (std::size_t j = 0; j < frames_.size(); ++j)
+    {
+      if (reused[j])
+        continue;
+
+      const Frame& old = frames_[j];
+      for (std::size_t k = 0; k < old.names.size(); ++k)
+        counts_.remove(old.names[k]);
+
+      if (!contains(frames, old.envSEXP))
+        R_ReleaseObject(old.envSEXP);
+    }
+
+    frames_.swap(frames);
+    updates_ += listed;
+    return listed;
+  }
+
+  // Is 'nameSEXP' (a CHARSXP or symbol) bound on the search path?
+  bool contains(SEXP nameSEXP) const
+  {
+    if (TYPEOF(nameSEXP) == SYMSXP)
+      nameSEXP = PRINTNAME(nameSEXP);
+    return counts_.contains(nameSEXP);
+  }
+
+  bool contains(const std::string& name) const
+  {
+    return contains(Rf_mkCharLen(name.data(), name.size()));
+  }
+
+  // The number of distinct names on the search path.
+  std::size_t size() const { return counts_.size(); }
+
+  // The number of environments listed, over all updates.
+  std::size_t updates() const { return updates_; }
+
+private:
+
+  struct Frame
+  {
+    SEXP envSEXP;
+    bool locked;
+    std::vector<SEXP> names;
+  };
+
+  // Find the (not yet re-used) frame for 'envSEXP', or return the
+  // number of frames if there is none.
+  std::size_t find(SEXP envSEXP, const std::vector<bool>& reused) const
+  {
+    for (std::size_t j = 0; j < frames_.size(); ++j)
+      if (!reused[j] && frames_[j].envSEXP == envSEXP)
+        return j;
+    return frames_.size();
+  }
+
+  static bool contains(const std::vector<Frame>& frames, SEXP envSEXP)
+  {
+    for (std::size_t i = 0; i < frames.size(); ++i)
+      if (frames[i].envSEXP == envSEXP)
+        return true;
+    return false;
+  }
+
+  static void reuse(Frame* pOld, Frame* pFrame)
+  {
+    pFrame->names.swap(pOld->names);
+  }
+
+  static bool equal(SEXP namesSEXP, const std::vector<SEXP>& names)
+  {
+    R_xlen_t n = Rf_xlength(namesSEXP);
+    if (static_cast<std::size_t>(n) != names.size())
+      return false;
+
+    for (R_xlen_t i = 0; i < n; ++i)
+      if (STRING_ELT(namesSEXP, i) != names[i])
+        return false;
+
+    return true;
+  }
+
+  void list(SEXP namesSEXP, Frame* pFrame)
+  {
+    R_xlen_t n = Rf_xlength(namesSEXP);
+    pFrame->names.resize(n);
+    for (R_xlen_t i = 0; i < n; ++i)
+    {
+      SEXP charSEXP = STRING_ELT(namesSEXP, i);
+      pFrame->names[i] = charSEXP;
+      counts_.add(charSEXP);
+    }
+  }
+
+  std::vector<Frame> frames_;
+  detail::CharacterCounts counts_;
+  std::size_t updates_;
+};
+
+// The process-wide set of names on the search path, brought up to
+// date with the search path.
+inline const SearchPath& searchPath()
+{
+  static SearchPath instance;
+  instance.update();
+  return instance;
+}
+
+} // namespace r
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_R_R_SEARCH_PATH_H */
@@ -1,12 +1,22 @@
 #ifndef SOURCETOOLS_R_R_UTILS_H
 #define SOURCETOOLS_R_R_UTILS_H
 
+#include <csetjmp>
+#include <cstring>
+
 #include <vector>
+#include <exception>
 
 #include <sourcetools/core/core.h>
 
 #include <sourcetools/r/RHeaders.h>
 
+// R errors can be caught, and C++ objects cleaned up, through
+// 'R_UnwindProtect()' on R >= 3.5.
+#if defined(R_VERSION) && R_VERSION >= R_Version(3, 5, 0)
+# define SOURCETOOLS_UNWIND_PROTECT
+#endif
+
 namespace sourcetools {
 namespace r {
 
@@ -94,7 +104,200 @@ private:
   mutable Protect protect_;
 };
 
+// A direct-mapped cache of CHARSXPs, used to avoid re-hashing
+// (through 'Rf_mkCharLen()') short strings that recur often, e.g.
+// operators, brackets, keywords and whitespace runs.
+//
+// NOTE: The cache does not protect the CHARSXPs it holds, and so
+// each CHARSXP should be stored in a protected vector before the
+// next allocation.
+class CharacterCache : noncopyable
+{
+public:
+
+  // Strings longer than this are not cached.
+  static const std::size_t MAX_LENGTH = 16;
+
+  CharacterCache()
+  {
+    for (std::size_t i = 0; i < SIZE; ++i)
+      slots_[i] = NULL;
+  }
+
+  SEXP get(const char* data, std::size_t n)
+  {
+    if (n > MAX_LENGTH)
+    {
+      SOURCETOOLS_STATS_ADD(COUNTER_CHARSXPS, 1);
+      return Rf_mkCharLen(data, n);
+    }
+
+    // FNV-1a.
+    unsigned int code = 2166136261u;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      code ^= static_cast<unsigned char>(data[i]);
+      code *= 16777619u;
+    }
+
+    SEXP& slot = slots_[code & (SIZE - 1)];
+    if (slot != NULL &&
+        static_cast<std::size_t>(LENGTH(slot)) == n &&
+        std::memcmp(CHAR(slot), data, n) == 0)
+    {
+      return slot;
+    }
+
+    SOURCETOOLS_STATS_ADD(COUNTER_CHARSXPS, 1);
+    slot = Rf_mkCharLen(data, n);
+    return slot;
+  }
+
+private:
+  static const std::size_t SIZE = 1024;
+  SEXP slots_[SIZE];
+};
+
+// Thrown by 'unwindProtect()' in place of an R error (or interrupt),
+// so that the C++ frames the error would have jumped over are
+// unwound. The entry point catches it, and then resumes the unwind
+// with 'continueUnwind()'.
+class UnwindException : public std::exception
+{
+public:
+
+  explicit UnwindException(SEXP tokenSEXP)
+    : tokenSEXP_(tokenSEXP)
+  {
+  }
+
+  SEXP token() const { return tokenSEXP_; }
+
+  virtual const char* what() const throw() { return "R error"; }
+
+private:
+  SEXP tokenSEXP_;
+};
+
+namespace detail {
+
+#ifdef SOURCETOOLS_UNWIND_PROTECT
+
+template <typename F>
+SEXP unwindCall(void* data)
+{
+  return (*static_cast<F*>(data))();
+}
+
+inline void unwindCleanup(void* data, Rboolean jump)
+{
+  if (jump)
+    std::longjmp(*static_cast<std::jmp_buf*>(data), 1);
+}
+
+// The continuation token, created (and preserved) once.
+inline SEXP unwindToken()
+{
+  static SEXP tokenSEXP = NULL;
+  if (tokenSEXP == NULL)
+  {
+    tokenSEXP = R_MakeUnwindCont();
+    R_PreserveObject(tokenSEXP);
+  }
+
+  SETCAR(tokenSEXP, R_NilValue);
+  return tokenSEXP;
+}
+
+#endif
+
+} // namespace detail
+
+// Invoke 'f()', which calls into R and returns a SEXP. Should R
+// raise an error, an 'UnwindException' is thrown in its place, so
+// that the C++ objects between the entry point and the call (e.g. a
+// mapped file) are destroyed. Objects within 'f()' itself are not,
+// and so it should only hold plain data, and (protected) R objects.
+template <typename F>
+SEXP unwindProtect(F& f)
+{
+#ifdef SOURCETOOLS_UNWIND_PROTECT
+  SEXP tokenSEXP = detail::unwindToken();
+
+  std::jmp_buf jumpBuffer;
+  if (setjmp(jumpBuffer))
+    throw UnwindException(tokenSEXP);
+
+  return R_UnwindProtect(detail::unwindCall<F>, &f,
+                         detail::unwindCleanup, &jumpBuffer,
+                         tokenSEXP);
+#else
+  return f();
+#endif
+}
+
+// Resume an unwind interrupted by 'unwindProtect()', once the C++
+// objects it would have skipped have been destroyed. Does nothing
+// when given 'R_NilValue'.
+inline void continueUnwind(SEXP tokenSEXP)
+{
+#ifdef SOURCETOOLS_UNWIND_PROTECT
+  if (tokenSEXP != R_NilValue)
+    R_ContinueUnwind(tokenSEXP);
+#else
+  (void) tokenSEXP;
+#endif
+}
+
+namespace detail {
+
+class Warning
+{
+public:
+
+  Warning(const char* format, const char* arg)
+    : format_(format),
+      arg_(arg)
+  {
+  }
+
+  SEXP operator()() const
+  {
+    Rf_warning(format_, arg_);
+    return R_NilValue;
+  }
+
+private:
+  const char* format_;
+  const char* arg_;
+};
+
+} // namespace detail
+
+// Raise an R warning through 'unwindProtect()', as a warning is an
+// error under 'options(warn = 2)'. 'format' may refer to 'arg' with
+// a single '%s'.
+inline void warning(const char* format, const char* arg = "")
+{
+  detail::Warning warning(format, arg);
+  unwindProtect(warning);
+}
+
 } // namespace r
 } // namespace sourcetools
 
+// Wrap the body of an entry point that uses 'unwindProtect()', so
+// that an R error raised within is resumed once the C++ objects in
+// the body have been destroyed.
+#define SOURCETOOLS_BEGIN_UNWIND                                    \
+  SEXP sourcetoolsUnwindSEXP = R_NilValue;                          \
+  try {
+
+#define SOURCETOOLS_END_UNWIND                                      \
+  } catch (const sourcetools::r::UnwindException& e) {              \
+    sourcetoolsUnwindSEXP = e.token();                              \
+  }                                                                 \
+  sourcetools::r::continueUnwind(sourcetoolsUnwindSEXP);            \
+  return R_NilValue;
+
 #endif /* SOURCETOOLS_R_R_UTILS_H */
@@ -5,6 +5,7 @@
 #include <sourcetools/r/RUtils.h>
 #include <sourcetools/r/RConverter.h>
 #include <sourcetools/r/RFunctions.h>
+#include <sourcetools/r/RSearchPath.h>
 #include <sourcetools/r/RCallRecurser.h>
 #include <sourcetools/r/RNonStandardEvaluation.h>
 
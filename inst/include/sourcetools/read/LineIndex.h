@@ -0,0 +1,147 @@
+#ifndef SOURCETOOLS_READ_LINE_INDEX_H
+#define SOURCETOOLS_READ_LINE_INDEX_H
+
+#include <vector>
+#include <algorithm>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/collection/Position.h>
+#include <sourcetools/read/MemoryMappedReader.h>
+
+namespace sourcetools {
+
+// An index of the lines in a file, for random access to ranges of
+// lines. The file is mapped into memory, and indexed, once; the
+// mapping is held for the lifetime of the index, so later changes
+// to the file are not reflected in the index. Lines are split as by
+// 'read_lines()', and rows and columns are zero-based.
+class LineIndex : noncopyable
+{
+private:
+  typedef detail::FileConnection FileConnection;
+  typedef detail::MemoryMappedConnection MemoryMappedConnection;
+  typedef detail::MemoryMappedReader MemoryMappedReader;
+
+public:
+
+  // Line start offsets are stored in 32 bits.
+  static std::size_t maxSize() { return 0xFFFFFFFFu; }
+
+  LineIndex()
+    : begin_(""),
+      size_(0)
+  {
+  }
+
+  // Map and index the file at 'path'. Returns false if the file
+  // could not be read, or was too large to index.
+  bool open(const char* path)
+  {
+    FileConnection conn(path);
+    if (!conn.open())
+      return false;
+
+    std::size_t size;
+    if (!conn.size(&size) || size > maxSize())
+      return false;
+
+    // Empty files cannot be mapped, but have no lines anyhow.
+    if (size > 0)
+    {
+      pMap_.reset(new MemoryMappedConnection(conn, size));
+      if (!pMap_->open())
+      {
+        pMap_.reset();
+        return false;
+      }
+
+      begin_ = *pMap_;
+    }
+
+    size_ = size;
+
+    LineRecorder recorder(begin_, &starts_);
+    MemoryMappedReader::forEachLine(begin_, begin_ + size_, recorder);
+    return true;
+  }
+
+  const char* data() const { return begin_; }
+  std::size_t size() const { return size_; }
+  std::size_t lineCount() const { return starts_.size(); }
+
+  // The offset of the start of line 'row'.
+  std::size_t offset(std::size_t row) const
+  {
+    return starts_[row];
+  }
+
+  // The offset following the lines '[0, row)', including the line
+  // terminator of the last such line.
+  std::size_t endOffset(std::size_t row) const
+  {
+    return row < starts_.size() ? starts_[row] : size_;
+  }
+
+  const char* lineBegin(std::size_t row) const
+  {
+    return begin_ + starts_[row];
+  }
+
+  // The end of line 'row', excluding its terminator.
+  const char* lineEnd(std::size_t row) const
+  {
+    const char* begin = lineBegin(row);
+    const char* end = begin_ + endOffset(row + 1);
+    if (end > begin && end[-1] == '\n')
+    {
+      --end;
+      if (end > begin && end[-1] == '\r')
+        --end;
+    }
+    return end;
+  }
+
+  // The row and column of the byte at 'offset' (which should be less
+  // than 'size()'). A line's terminator belongs to that line.
+  collections::Position position(std::size_t offset) const
+  {
+    std::vector<unsigned int>::const_iterator it =
+      std::upper_bound(starts_.begin(), starts_.end(), offset);
+
+    std::size_t row = it == starts_.begin() ? 0 : (it - starts_.begin()) - 1;
+    std::size_t start = starts_.empty() ? 0 : starts_[row];
+    return collections::Position(row, offset - start);
+  }
+
+private:
+
+  class LineRecorder
+  {
+  public:
+
+    LineRecorder(const char* begin, std::vector<unsigned int>* pStarts)
+      : begin_(begin),
+        pStarts_(pStarts)
+    {
+    }
+
+    void operator()(const char* lower, const char*)
+    {
+      pStarts_->push_back(static_cast<unsigned int>(lower - begin_));
+    }
+
+  private:
+    const char* begin_;
+    std::vector<unsigned int>* pStarts_;
+  };
+
+private:
+  scoped_ptr<MemoryMappedConnection> pMap_;
+  const char* begin_;
+  std::size_t size_;
+  std::vector<unsigned int> starts_;
+};
+
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_READ_LINE_INDEX_H */
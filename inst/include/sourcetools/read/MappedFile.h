@@ -0,0 +1,101 @@
+#ifndef SOURCETOOLS_READ_MAPPED_FILE_H
+#define SOURCETOOLS_READ_MAPPED_FILE_H
+
+#include <string>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/read/MemoryMappedReader.h>
+
+namespace sourcetools {
+
+// The contents of a file, held for the lifetime of the object. As
+// with 'MemoryMappedReader::map()', small files are read into a
+// buffer, and other files are memory-mapped; as with 'LineIndex', a
+// mapped file should not be truncated while it is held.
+class MappedFile : noncopyable
+{
+private:
+  typedef detail::FileConnection FileConnection;
+  typedef detail::MemoryMappedConnection MemoryMappedConnection;
+  typedef detail::MemoryMappedReader MemoryMappedReader;
+
+public:
+
+  MappedFile()
+    : begin_(""),
+      size_(0)
+  {
+  }
+
+  // Read or map the file at 'path'. Returns false if the file could
+  // not be read.
+  bool open(const char* path)
+  {
+    SOURCETOOLS_STATS_TIMER(timer, STAGE_OPEN);
+    SOURCETOOLS_STATS_ADD(COUNTER_FILES, 1);
+
+    FileConnection conn(path);
+    if (!conn.open())
+      return false;
+
+    std::size_t size;
+    if (!conn.size(&size))
+      return false;
+
+    // Empty files cannot be mapped, but have no contents anyhow.
+    if (size == 0)
+      return true;
+
+    const detail::ReadOptions& options = MemoryMappedReader::options();
+    if (size <= options.smallFileSize)
+    {
+      MemoryMappedReader::count(&MemoryMappedReader::stats().reads);
+
+      std::size_t n;
+      buffer_.resize(size);
+      if (!conn.read(&buffer_[0], size, &n))
+        return false;
+
+      SOURCETOOLS_STATS_ADD(COUNTER_BYTES_READ, n);
+      begin_ = buffer_.data();
+      size_ = n;
+      return true;
+    }
+
+    int flags = MemoryMappedConnection::POPULATE;
+    if (size >= options.largeFileSize)
+    {
+      MemoryMappedReader::count(&MemoryMappedReader::stats().streams);
+      flags = options.hugePages ? MemoryMappedConnection::HUGE_PAGES : 0;
+    }
+    else
+    {
+      MemoryMappedReader::count(&MemoryMappedReader::stats().maps);
+    }
+
+    pMap_.reset(new MemoryMappedConnection(conn, size, flags));
+    if (!pMap_->open())
+    {
+      pMap_.reset();
+      return false;
+    }
+
+    SOURCETOOLS_STATS_ADD(COUNTER_BYTES_MAPPED, size);
+    begin_ = *pMap_;
+    size_ = size;
+    return true;
+  }
+
+  const char* data() const { return begin_; }
+  std::size_t size() const { return size_; }
+
+private:
+  scoped_ptr<MemoryMappedConnection> pMap_;
+  std::string buffer_;
+  const char* begin_;
+  std::size_t size_;
+};
+
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_READ_MAPPED_FILE_H */
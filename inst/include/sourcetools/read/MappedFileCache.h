@@ -0,0 +1,249 @@
+#ifndef SOURCETOOLS_READ_MAPPED_FILE_CACHE_H
+#define SOURCETOOLS_READ_MAPPED_FILE_CACHE_H
+
+#include <ctime>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/read/MemoryMappedReader.h>
+
+namespace sourcetools {
+namespace detail {
+
+// Identifies a version of a file: a cached mapping is only reused
+// while the file's device, inode, size and modification time are
+// unchanged.
+struct FileStamp
+{
+  FileStamp()
+    : device(0), inode(0), size(0), mtime(0), mtimeNanoseconds(0)
+  {
+  }
+
+  bool read(const char* path)
+  {
+    struct stat info;
+    if (::stat(path, &info) == -1)
+      return false;
+
+    device = info.st_dev;
+    inode = info.st_ino;
+    size = info.st_size;
+    mtime = info.st_mtime;
+#if defined(__APPLE__)
+    mtimeNanoseconds = info.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    mtimeNanoseconds = info.st_mtim.tv_nsec;
+#endif
+    return true;
+  }
+
+  bool operator==(const FileStamp& other) const
+  {
+    return
+      device == other.device &&
+      inode == other.inode &&
+      size == other.size &&
+      mtime == other.mtime &&
+      mtimeNanoseconds == other.mtimeNanoseconds;
+  }
+
+  dev_t device;
+  ino_t inode;
+  std::size_t size;
+  std::time_t mtime;
+  long mtimeNanoseconds;
+};
+
+} // namespace detail
+
+// A cache of memory-mapped files, keyed by path. Files are kept
+// mapped, up to a budget of 'capacity()' bytes, so that repeated
+// reads of the same (unchanged) file are served without re-opening
+// and re-mapping it; before each reuse, the file is checked with a
+// single 'stat()'. The least recently used mappings are evicted once
+// the budget is exceeded. A budget of zero disables the cache.
+//
+// On Windows, the cache is always disabled: a file cannot be
+// truncated or replaced while it is mapped, and 'stat()' reports no
+// inode, so a file replaced by another could not be told apart.
+//
+// NOTE: The cache is not thread-safe, and the functor passed to
+// 'map()' must not itself use the cache.
+class MappedFileCache : noncopyable
+{
+private:
+  typedef detail::FileConnection FileConnection;
+  typedef detail::MemoryMappedConnection MemoryMappedConnection;
+  typedef detail::MemoryMappedReader MemoryMappedReader;
+
+  struct Entry
+  {
+    std::string path;
+    detail::FileStamp stamp;
+    MemoryMappedConnection* pMap;
+  };
+
+  typedef std::list<Entry> Entries;
+
+public:
+
+  // The process-wide cache.
+  static MappedFileCache& instance()
+  {
+    static MappedFileCache cache;
+    return cache;
+  }
+
+  MappedFileCache()
+    : capacity_(0),
+      size_(0),
+      hits_(0),
+      misses_(0),
+      evictions_(0)
+  {
+  }
+
+  ~MappedFileCache()
+  {
+    clear();
+  }
+
+  // As 'MemoryMappedReader::map()': invoke 'f(begin, end)' over the
+  // contents of a file, while it is mapped into memory.
+  template <typename F>
+  bool map(const char* path, F f)
+  {
+    if (capacity_ == 0)
+      return MemoryMappedReader::map(path, f);
+
+    detail::FileStamp stamp;
+    if (!stamp.read(path))
+      return false;
+
+    std::map<std::string, Entries::iterator>::iterator it = index_.find(path);
+    if (it != index_.end())
+    {
+      Entries::iterator entry = it->second;
+      if (entry->stamp == stamp)
+      {
+        ++hits_;
+        entries_.splice(entries_.begin(), entries_, entry);
+        const char* begin = *entry->pMap;
+        f(begin, begin + stamp.size);
+        return true;
+      }
+
+      // The file has changed since it was mapped.
+      erase(entry);
+    }
+
+    ++misses_;
+
+    // Empty files cannot be mapped, and files larger than the
+    // budget are not worth caching.
+    if (stamp.size == 0 || stamp.size > capacity_)
+      return MemoryMappedReader::map(path, f);
+
+    FileConnection conn(path);
+    if (!conn.open())
+      return false;
+
+    MemoryMappedConnection* pMap = new MemoryMappedConnection(conn, stamp.size);
+    if (!pMap->open())
+    {
+      delete pMap;
+      return false;
+    }
+
+    Entry entry;
+    entry.path = path;
+    entry.stamp = stamp;
+    entry.pMap = pMap;
+    entries_.push_front(entry);
+    index_[entry.path] = entries_.begin();
+    size_ += stamp.size;
+    evict(capacity_);
+
+    const char* begin = *pMap;
+    f(begin, begin + stamp.size);
+    return true;
+  }
+
+  // Set the budget, in bytes, evicting mappings to stay within it.
+  void setCapacity(std::size_t capacity)
+  {
+#ifdef _WIN32
+    capacity = 0;
+#endif
+    capacity_ = capacity;
+    evict(capacity_);
+  }
+
+  // Unmap all cached files.
+  void clear()
+  {
+    evict(0);
+  }
+
+  std::size_t capacity() const { return capacity_; }
+  std::size_t size() const { return size_; }
+  std::size_t count() const { return entries_.size(); }
+
+  std::size_t hits() const { return hits_; }
+  std::size_t misses() const { return misses_; }
+  std::size_t evictions() const { return evictions_; }
+
+  // Invoke 'f(path, size)' for each cached file, from the most to the
+  // least recently used.
+  template <typename F>
+  void list(F& f) const
+  {
+    for (Entries::const_iterator it = entries_.begin(); it != entries_.end(); ++it)
+      f(it->path, it->stamp.size);
+  }
+
+private:
+
+  // Evict the least recently used mappings (other than the most
+  // recently used) until at most 'capacity' bytes are mapped.
+  void evict(std::size_t capacity)
+  {
+    while (size_ > capacity && !entries_.empty())
+    {
+      if (capacity > 0 && entries_.size() == 1)
+        break;
+
+      Entries::iterator last = entries_.end();
+      erase(--last);
+      ++evictions_;
+    }
+  }
+
+  void erase(Entries::iterator entry)
+  {
+    size_ -= entry->stamp.size;
+    delete entry->pMap;
+    index_.erase(entry->path);
+    entries_.erase(entry);
+  }
+
+private:
+  Entries entries_;
+  std::map<std::string, Entries::iterator> index_;
+  std::size_t capacity_;
+  std::size_t size_;
+  std::size_t hits_;
+  std::size_t misses_;
+  std::size_t evictions_;
+};
+
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_READ_MAPPED_FILE_CACHE_H */
@@ -1,11 +1,15 @@
 #ifndef SOURCETOOLS_READ_MEMORY_MAPPED_READER_H
 #define SOURCETOOLS_READ_MEMORY_MAPPED_READER_H
 
+#include <cstdlib>
+#include <cstring>
+
 #include <vector>
 #include <string>
 #include <algorithm>
 
 #include <sourcetools/core/macros.h>
+#include <sourcetools/core/stats.h>
 
 #include <sourcetools/r/RHeaders.h>
 #include <sourcetools/r/RUtils.h>
@@ -21,10 +25,59 @@
 namespace sourcetools {
 namespace detail {
 
+// How files are read, by size. Small files are read with 'pread()'
+// into a buffer, which is cheaper than mapping (and unmapping)
+// them. Other files are memory-mapped; files of at least
+// 'largeFileSize' bytes are mapped without faulting in every page up
+// front, so that the caller can start on the file while the rest is
+// read ahead, and (with 'hugePages') are advised to use huge pages.
+struct ReadOptions
+{
+  ReadOptions()
+    : smallFileSize(64 * 1024),
+      largeFileSize(64 * 1024 * 1024),
+      hugePages(false)
+  {
+  }
+
+  std::size_t smallFileSize;
+  std::size_t largeFileSize;
+  bool hugePages;
+};
+
+// The number of files read with each strategy.
+struct ReadStats
+{
+  ReadStats()
+    : reads(0),
+      maps(0),
+      streams(0)
+  {
+  }
+
+  std::size_t reads;
+  std::size_t maps;
+  std::size_t streams;
+};
+
 class MemoryMappedReader
 {
 public:
 
+  // The options used by all readers. These should only be changed
+  // while no files are being read.
+  static ReadOptions& options()
+  {
+    static ReadOptions options;
+    return options;
+  }
+
+  static ReadStats& stats()
+  {
+    static ReadStats stats;
+    return stats;
+  }
+
   class VectorReader
   {
   public:
@@ -44,8 +97,38 @@ public:
     std::vector<std::string>* pData_;
   };
 
-  static bool read(const char* path, std::string* pContent)
+  class StringReader
   {
+  public:
+
+    explicit StringReader(std::string* pData)
+      : pData_(pData)
+    {
+    }
+
+    template <typename T>
+    void operator()(const T& lhs, const T& rhs)
+    {
+      SOURCETOOLS_STATS_TIMER(timer, STAGE_COPY);
+      SOURCETOOLS_STATS_ADD(COUNTER_BYTES_COPIED, rhs - lhs);
+      pData_->assign(lhs, rhs);
+    }
+
+  private:
+    std::string* pData_;
+  };
+
+  // Invoke 'f(begin, end)' over the contents of a file, while
+  // the file is mapped into memory (or, for small files, read into
+  // a buffer). This allows callers to work with the file contents
+  // directly, without taking a copy.
+  template <typename F>
+  static bool map(const char* path, F f)
+  {
+    // Time opening and reading the file, but not 'f()'.
+    SOURCETOOLS_STATS_TIMER(timer, STAGE_OPEN);
+    SOURCETOOLS_STATS_ADD(COUNTER_FILES, 1);
+
     // Open file connection
     FileConnection conn(path);
     if (!conn.open())
@@ -58,55 +141,111 @@ public:
 
     // Early return for empty files
     if (UNLIKELY(size == 0))
+    {
+      SOURCETOOLS_STATS_STOP(timer);
+      const char* empty = "";
+      f(empty, empty);
+      return true;
+    }
+
+    const ReadOptions& options = MemoryMappedReader::options();
+    if (size <= options.smallFileSize)
+    {
+      count(&stats().reads);
+
+      // Most files fit in a buffer on the stack.
+      char stack[8192];
+      ReadBuffer heap;
+      char* buffer = stack;
+      if (size > sizeof(stack))
+      {
+        buffer = heap.reserve(size);
+        if (buffer == NULL)
+          return false;
+      }
+
+      std::size_t n;
+      if (!conn.read(buffer, size, &n))
+        return false;
+
+      SOURCETOOLS_STATS_ADD(COUNTER_BYTES_READ, n);
+      SOURCETOOLS_STATS_STOP(timer);
+
+      const char* begin = buffer;
+      f(begin, begin + n);
       return true;
+    }
+
+    int flags = MemoryMappedConnection::POPULATE;
+    if (size >= options.largeFileSize)
+    {
+      count(&stats().streams);
+      flags = options.hugePages ? MemoryMappedConnection::HUGE_PAGES : 0;
+    }
+    else
+    {
+      count(&stats().maps);
+    }
 
     // mmap the file
-    MemoryMappedConnection map(conn, size);
+    MemoryMappedConnection map(conn, size, flags);
     if (!map.open())
       return false;
 
-    pContent->assign(map, size);
+    SOURCETOOLS_STATS_ADD(COUNTER_BYTES_MAPPED, size);
+    SOURCETOOLS_STATS_STOP(timer);
+
+    const char* begin = map;
+    f(begin, begin + size);
     return true;
   }
 
-  template <typename F>
-  static bool read_lines(const char* path, F f)
+  static bool read(const char* path, std::string* pContent)
   {
-    FileConnection conn(path);
-    if (!conn.open())
-      return false;
+    StringReader reader(pContent);
+    return map(path, reader);
+  }
 
-    // Get size of file
-    std::size_t size;
-    if (!conn.size(&size))
-      return false;
+  // Count the lines in '[begin, end)', as split by 'forEachLine()'.
+  static std::size_t countLines(const char* begin, const char* end)
+  {
+    std::size_t size = end - begin;
+    if (size == 0)
+      return 0;
 
-    // Early return for empty files
-    if (UNLIKELY(size == 0))
-      return true;
+    // special case: just a '\n'
+    bool endsWithNewline = end[-1] == '\n';
+    if (size == 1 && endsWithNewline)
+      return 0;
 
-    // mmap the file
-    MemoryMappedConnection map(conn, size);
-    if (!map.open())
-      return false;
+    return countNewlines(begin, end) + !endsWithNewline;
+  }
+
+  // Invoke 'f(lower, upper)' for each line in '[begin, end)', with
+  // the line terminators ('\n' or '\r\n') excluded.
+  template <typename F>
+  static void forEachLine(const char* begin, const char* end, F& f)
+  {
+    std::size_t size = end - begin;
+    if (UNLIKELY(size == 0))
+      return;
 
     // special case: just a '\n'
-    bool endsWithNewline = map[size - 1] == '\n';
+    bool endsWithNewline = end[-1] == '\n';
     if (size == 1 && endsWithNewline)
-      return true;
+      return;
 
     // Search for newlines
-    const char* lower = map;
-    const char* upper = map;
-    const char* end = map + size;
+    const char* lower = begin;
+    const char* upper = begin;
     while (true)
     {
-      upper = std::find(lower, end, '\n');
-      if (upper == end)
+      upper = static_cast<const char*>(std::memchr(lower, '\n', end - lower));
+      if (upper == NULL)
         break;
 
       // Handle '\r\n'
-      int CR = *(upper - 1) == '\r';
+      int CR = upper > lower && *(upper - 1) == '\r';
       upper -= CR;
 
       // Pass to functor
@@ -118,11 +257,36 @@ public:
 
     // If this file ended with a newline, we're done
     if (endsWithNewline)
-      return true;
+      return;
 
     // Otherwise, consume one more string, then we're done
     f(lower, end);
-    return true;
+  }
+
+  template <typename F>
+  class LineReader
+  {
+  public:
+
+    explicit LineReader(F f)
+      : f_(f)
+    {
+    }
+
+    void operator()(const char* begin, const char* end)
+    {
+      forEachLine(begin, end, f_);
+    }
+
+  private:
+    F f_;
+  };
+
+  template <typename F>
+  static bool read_lines(const char* path, F f)
+  {
+    LineReader<F> reader(f);
+    return map(path, reader);
   }
 
   static bool read_lines(const char* path, std::vector<std::string>* pContent)
@@ -131,6 +295,139 @@ public:
     return read_lines(path, reader);
   }
 
+  // Count a file read with one of the strategies in 'stats()'. Files
+  // may be read from worker threads.
+  static void count(std::size_t* pCounter)
+  {
+#ifdef _OPENMP
+    #pragma omp atomic
+#endif
+    ++*pCounter;
+  }
+
+private:
+
+  // The buffer that small files too large for the stack are read
+  // into. Each thread keeps its buffer between reads, growing it as
+  // needed (so it is bounded by 'smallFileSize'), rather than
+  // allocating one per file. A buffer is taken from the thread while
+  // in use, so that a nested read gets a buffer of its own.
+  class ReadBuffer
+  {
+  public:
+
+#ifdef SOURCE_TOOLS_THREAD_LOCAL
+
+    ReadBuffer()
+      : data_(cachedData()),
+        capacity_(cachedCapacity())
+    {
+      cachedData() = NULL;
+      cachedCapacity() = 0;
+    }
+
+    ~ReadBuffer()
+    {
+      std::free(cachedData());
+      cachedData() = data_;
+      cachedCapacity() = capacity_;
+    }
+
+#else
+
+    // Without thread-local storage, each read allocates its own.
+    ReadBuffer()
+      : data_(NULL),
+        capacity_(0)
+    {
+    }
+
+    ~ReadBuffer()
+    {
+      std::free(data_);
+    }
+
+#endif
+
+    char* reserve(std::size_t size)
+    {
+      if (size > capacity_)
+      {
+        char* data = static_cast<char*>(std::realloc(data_, size));
+        if (data == NULL)
+          return NULL;
+
+        data_ = data;
+        capacity_ = size;
+      }
+
+      return data_;
+    }
+
+  private:
+
+#ifdef SOURCE_TOOLS_THREAD_LOCAL
+
+    static char*& cachedData()
+    {
+      static SOURCE_TOOLS_THREAD_LOCAL char* data = NULL;
+      return data;
+    }
+
+    static std::size_t& cachedCapacity()
+    {
+      static SOURCE_TOOLS_THREAD_LOCAL std::size_t capacity = 0;
+      return capacity;
+    }
+
+#endif
+
+    char* data_;
+    std::size_t capacity_;
+  };
+
+  // Count the newlines in '[begin, end)' a word at a time, rather
+  // than a character at a time: each byte of 'x' below is zero if
+  // and only if the corresponding byte of the word is a newline.
+  static std::size_t countNewlines(const char* begin, const char* end)
+  {
+    typedef std::size_t word_t;
+    static const word_t ones = ~word_t(0) / 255;
+    static const word_t low  = ones * 0x7F;
+    static const word_t high = ones * 0x80;
+    static const word_t nl   = ones * '\n';
+
+    std::size_t count = 0;
+    const char* it = begin;
+    for (; static_cast<std::size_t>(end - it) >= sizeof(word_t); it += sizeof(word_t))
+    {
+      word_t word;
+      std::memcpy(&word, it, sizeof(word_t));
+
+      // Set the high bit of each byte that is zero in 'x'.
+      word_t x = word ^ nl;
+      word_t zeros = ~(((x & low) + low) | x | low);
+      count += popcount(zeros & high);
+    }
+
+    for (; it < end; ++it)
+      count += *it == '\n';
+
+    return count;
+  }
+
+  static std::size_t popcount(std::size_t x)
+  {
+#ifdef __GNUC__
+    return __builtin_popcountll(x);
+#else
+    std::size_t count = 0;
+    for (; x; x &= x - 1)
+      ++count;
+    return count;
+#endif
+  }
+
 };
 
 } // namespace detail
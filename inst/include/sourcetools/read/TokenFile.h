@@ -0,0 +1,418 @@
+#ifndef SOURCETOOLS_READ_TOKEN_FILE_H
+#define SOURCETOOLS_READ_TOKEN_FILE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/read/MemoryMappedReader.h>
+#include <sourcetools/tokenization/Registration.h>
+#include <sourcetools/tokenization/SymbolTable.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+#include <sourcetools/tokenization/TokenCache.h>
+#include <sourcetools/cursor/TokenCursor.h>
+
+namespace sourcetools {
+
+// A file of serialized tokens, for tokenized code that should be
+// written once and read many times (e.g. a pre-tokenized corpus).
+//
+// The file holds a header, identifying the code by its size and hash
+// (as with a 'TokenCache' key), followed by the packed compact
+// tokens, the line table and, optionally, the symbol id of each token
+// with the names of the interned symbols, and the code itself. Files
+// are written in native byte order, and only read back by a reader
+// with the same token layout and byte order.
+//
+// Reading a file maps it into memory, and checks that its tokens and
+// lines lie within the code; the tokens are then used in place (e.g.
+// through 'view()' or 'cursor()'), without being copied. The mapping
+// is held for the lifetime of the reader.
+class TokenFile : noncopyable
+{
+private:
+  typedef detail::FileConnection FileConnection;
+  typedef detail::MemoryMappedConnection MemoryMappedConnection;
+  typedef tokens::TokenType TokenType;
+  typedef tokens::SymbolId SymbolId;
+  typedef tokens::CompactToken CompactToken;
+
+public:
+
+  enum Flags
+  {
+    HAS_SOURCE  = 1,
+    HAS_SYMBOLS = 2
+  };
+
+  // The header of a token file. The sections that follow it are, in
+  // order: 'tokenCount' compact tokens; 'lineCount' line offsets; with
+  // 'HAS_SYMBOLS', 'tokenCount' symbol ids, 'symbolCount + 1' offsets
+  // into the symbol names, and 'symbolBytes' bytes of names; and, with
+  // 'HAS_SOURCE', 'sourceSize' bytes of code.
+  struct Header
+  {
+    char magic[8];
+    unsigned int version;
+    unsigned int byteOrder;
+    unsigned int tokenSize;
+    unsigned int flags;
+    unsigned int hash[2];
+    unsigned int sourceSize;
+    unsigned int mask;
+    unsigned int tokenCount;
+    unsigned int lineCount;
+    unsigned int symbolCount;
+    unsigned int symbolBytes;
+  };
+
+  static const char* magic() { return "SRCTOKFL"; }
+
+  // Bump the version whenever the layout of the file changes.
+  static unsigned int version() { return 1; }
+
+  static unsigned int byteOrder() { return 0x01020304u; }
+
+  TokenFile()
+    : pHeader_(NULL),
+      tokens_(NULL),
+      lines_(NULL),
+      symbols_(NULL),
+      symbolOffsets_(NULL),
+      symbolNames_(NULL),
+      source_(NULL)
+  {
+  }
+
+  // Write the tokens in 'buffer' to 'path', along with the symbol ids
+  // and names in 'pSymbols' (when supplied; the symbols should have
+  // been interned into the buffer), and the code itself (with
+  // 'includeSource'). 'mask' records the token types kept. The file is
+  // written to a temporary file and then moved into place, so that
+  // readers never see a partially written file.
+  static bool write(const char* path,
+                    const tokens::TokenBuffer& buffer,
+                    const tokens::SymbolTable* pSymbols = NULL,
+                    bool includeSource = true,
+                    TokenType mask = tokens::ALL_TOKENS_MASK)
+  {
+    const std::vector<CompactToken>& tokens = buffer.tokens();
+    const std::vector<unsigned int>& lines = buffer.lines();
+    if (lines.empty())
+      return false;
+
+    TokenCache::Key key = TokenCache::key(buffer.code(), buffer.codeSize(), mask);
+
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(header.magic, magic(), sizeof(header.magic));
+    header.version = version();
+    header.byteOrder = byteOrder();
+    header.tokenSize = sizeof(CompactToken);
+    header.hash[0] = key.hash[0];
+    header.hash[1] = key.hash[1];
+    header.sourceSize = static_cast<unsigned int>(buffer.codeSize());
+    header.mask = static_cast<unsigned int>(mask);
+    header.tokenCount = static_cast<unsigned int>(tokens.size());
+    header.lineCount = static_cast<unsigned int>(lines.size());
+
+    // Symbol ids (when not interned, every token has none), and the
+    // offsets of the symbol names.
+    std::vector<SymbolId> ids;
+    std::vector<unsigned int> offsets;
+    std::string names;
+    if (pSymbols != NULL)
+    {
+      header.flags |= HAS_SYMBOLS;
+
+      const std::vector<SymbolId>& symbols = buffer.symbols();
+      ids.assign(tokens.size(), tokens::NO_SYMBOL);
+      std::copy(symbols.begin(), symbols.end(), ids.begin());
+
+      offsets.push_back(0);
+      for (SymbolId id = 0; id < pSymbols->size(); ++id)
+      {
+        names.append(pSymbols->data(id), pSymbols->length(id));
+        offsets.push_back(static_cast<unsigned int>(names.size()));
+      }
+
+      header.symbolCount = static_cast<unsigned int>(pSymbols->size());
+      header.symbolBytes = static_cast<unsigned int>(names.size());
+    }
+
+    if (includeSource)
+      header.flags |= HAS_SOURCE;
+
+    std::string temporary = utils::temporaryPath(path);
+    std::FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (file == NULL)
+      return false;
+
+    bool success =
+      std::fwrite(&header, sizeof(Header), 1, file) == 1 &&
+      writeAll(tokens, file) &&
+      writeAll(lines, file) &&
+      writeAll(ids, file) &&
+      writeAll(offsets, file) &&
+      writeAll(names.data(), names.size(), file) &&
+      (!includeSource || writeAll(buffer.code(), buffer.codeSize(), file));
+
+    success = std::fclose(file) == 0 && success;
+
+    if (!success || !utils::replaceFile(temporary.c_str(), path))
+    {
+      std::remove(temporary.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+  // Map and check the file at 'path'. Returns false if the file could
+  // not be read, or is not a valid token file.
+  bool open(const char* path)
+  {
+    close();
+
+    FileConnection conn(path);
+    if (!conn.open())
+      return false;
+
+    std::size_t size;
+    if (!conn.size(&size) || size < sizeof(Header))
+      return false;
+
+    // Pages are faulted in as the tokens are used.
+    pMap_.reset(new MemoryMappedConnection(conn, size, 0));
+    if (!pMap_->open() || !parse(*pMap_, size))
+    {
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  void close()
+  {
+    pMap_.reset();
+    pHeader_ = NULL;
+    tokens_ = NULL;
+    lines_ = NULL;
+    symbols_ = NULL;
+    symbolOffsets_ = NULL;
+    symbolNames_ = NULL;
+    source_ = NULL;
+  }
+
+  bool isOpen() const { return pHeader_ != NULL; }
+
+  std::size_t size() const { return pHeader_->tokenCount; }
+  std::size_t lineCount() const { return pHeader_->lineCount; }
+  TokenType mask() const { return static_cast<TokenType>(pHeader_->mask); }
+
+  // The code the tokens were drawn from, when included in the file.
+  bool hasSource() const { return source_ != NULL; }
+  const char* source() const { return source_; }
+  std::size_t sourceSize() const { return pHeader_->sourceSize; }
+
+  // Were the tokens drawn from 'code'? (As judged by its size and hash.)
+  bool matches(const char* code, std::size_t n) const
+  {
+    if (n != pHeader_->sourceSize)
+      return false;
+
+    TokenCache::Key key = TokenCache::key(code, n, mask());
+    return key.hash[0] == pHeader_->hash[0] && key.hash[1] == pHeader_->hash[1];
+  }
+
+  // The interned symbols, when included in the file.
+  bool hasSymbols() const { return symbols_ != NULL; }
+  std::size_t symbolCount() const { return pHeader_->symbolCount; }
+
+  const char* symbolData(SymbolId id) const
+  {
+    return symbolNames_ + symbolOffsets_[id];
+  }
+
+  std::size_t symbolLength(SymbolId id) const
+  {
+    return symbolOffsets_[id + 1] - symbolOffsets_[id];
+  }
+
+  // Intern the file's symbols into a fresh symbol table, so that the
+  // ids in the file are those of the table. Returns false if the file
+  // has no symbols, or if its keywords differ from the table's.
+  bool symbols(tokens::SymbolTable* pSymbols) const
+  {
+    if (!hasSymbols() || pSymbols->size() > symbolCount())
+      return false;
+
+    for (SymbolId id = 0; id < symbolCount(); ++id)
+    {
+      bool keyword = id < pSymbols->size();
+      SymbolId interned = keyword
+        ? pSymbols->find(symbolData(id), symbolLength(id))
+        : pSymbols->intern(symbolData(id), symbolLength(id));
+
+      if (interned != id)
+        return false;
+    }
+
+    return true;
+  }
+
+  // A view over the tokens of the file, which refer to the code
+  // included in the file, or else to 'code' (which should match).
+  // NOTE: views are invalidated when the file is closed.
+  tokens::TokenView view() const
+  {
+    return view(source_);
+  }
+
+  tokens::TokenView view(const char* code) const
+  {
+    return tokens::TokenView(
+      code,
+      tokens_,
+      pHeader_->tokenCount,
+      lines_,
+      pHeader_->lineCount,
+      symbols_
+    );
+  }
+
+  cursors::CompactTokenCursor cursor() const
+  {
+    return cursors::CompactTokenCursor(view());
+  }
+
+private:
+
+  template <typename T>
+  static bool writeAll(const T* data, std::size_t n, std::FILE* file)
+  {
+    return n == 0 || std::fwrite(data, sizeof(T), n, file) == n;
+  }
+
+  template <typename T>
+  static bool writeAll(const std::vector<T>& data, std::FILE* file)
+  {
+    return data.empty() || writeAll(&data[0], data.size(), file);
+  }
+
+  // Take the next 'count' elements of type 'T' from '*pOffset', if
+  // they lie within the file.
+  template <typename T>
+  static const T* section(const char* data,
+                          std::size_t size,
+                          std::size_t count,
+                          std::size_t* pOffset)
+  {
+    std::size_t offset = *pOffset;
+    if (count > (size - offset) / sizeof(T))
+      return NULL;
+
+    *pOffset = offset + count * sizeof(T);
+    return reinterpret_cast<const T*>(data + offset);
+  }
+
+  bool parse(const char* data, std::size_t size)
+  {
+    const Header* pHeader = reinterpret_cast<const Header*>(data);
+    if (std::memcmp(pHeader->magic, magic(), sizeof(pHeader->magic)) != 0 ||
+        pHeader->version != version() ||
+        pHeader->byteOrder != byteOrder() ||
+        pHeader->tokenSize != sizeof(CompactToken) ||
+        pHeader->lineCount == 0)
+    {
+      return false;
+    }
+
+    std::size_t offset = sizeof(Header);
+    const CompactToken* tokens = section<CompactToken>(data, size, pHeader->tokenCount, &offset);
+    const unsigned int* lines = section<unsigned int>(data, size, pHeader->lineCount, &offset);
+    if (tokens == NULL || lines == NULL)
+      return false;
+
+    const SymbolId* symbols = NULL;
+    const unsigned int* symbolOffsets = NULL;
+    const char* symbolNames = NULL;
+    if (pHeader->flags & HAS_SYMBOLS)
+    {
+      symbols = section<SymbolId>(data, size, pHeader->tokenCount, &offset);
+      symbolOffsets = section<unsigned int>(data, size, pHeader->symbolCount + std::size_t(1), &offset);
+      symbolNames = section<char>(data, size, pHeader->symbolBytes, &offset);
+      if (symbols == NULL || symbolOffsets == NULL || symbolNames == NULL)
+        return false;
+    }
+
+    const char* source = NULL;
+    if (pHeader->flags & HAS_SOURCE)
+    {
+      source = section<char>(data, size, pHeader->sourceSize, &offset);
+      if (source == NULL)
+        return false;
+    }
+
+    if (offset != size)
+      return false;
+
+    pHeader_ = pHeader;
+    tokens_ = tokens;
+    lines_ = lines;
+    symbols_ = symbols;
+    symbolOffsets_ = symbolOffsets;
+    symbolNames_ = symbolNames;
+    source_ = source;
+    return valid();
+  }
+
+  // A corrupt file must not lead its reader out of bounds: check
+  // the tokens and lines against the code, and the symbols against
+  // their names.
+  bool valid() const
+  {
+    if (!tokens::withinCode(tokens_, pHeader_->tokenCount,
+                            lines_, pHeader_->lineCount,
+                            pHeader_->sourceSize))
+    {
+      return false;
+    }
+
+    if (symbols_ == NULL)
+      return true;
+
+    for (std::size_t i = 0; i < pHeader_->tokenCount; ++i)
+      if (symbols_[i] != tokens::NO_SYMBOL && symbols_[i] >= pHeader_->symbolCount)
+        return false;
+
+    if (symbolOffsets_[0] != 0 || symbolOffsets_[pHeader_->symbolCount] != pHeader_->symbolBytes)
+      return false;
+
+    for (std::size_t i = 0; i < pHeader_->symbolCount; ++i)
+      if (symbolOffsets_[i] > symbolOffsets_[i + 1])
+        return false;
+
+    return true;
+  }
+
+private:
+  scoped_ptr<MemoryMappedConnection> pMap_;
+  const Header* pHeader_;
+  const CompactToken* tokens_;
+  const unsigned int* lines_;
+  const SymbolId* symbols_;
+  const unsigned int* symbolOffsets_;
+  const char* symbolNames_;
+  const char* source_;
+};
+
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_READ_TOKEN_FILE_H */
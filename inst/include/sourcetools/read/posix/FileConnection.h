@@ -1,6 +1,7 @@
 #ifndef SOURCETOOLS_READ_POSIX_FILE_CONNECTION_H
 #define SOURCETOOLS_READ_POSIX_FILE_CONNECTION_H
 
+#include <cerrno>
 #include <cstddef>
 
 #include <sys/stat.h>
@@ -42,6 +43,31 @@ public:
     return true;
   }
 
+  // Read up to 'size' bytes from the start of the file into
+  // 'buffer', setting 'pRead' to the number of bytes read.
+  bool read(char* buffer, std::size_t size, std::size_t* pRead)
+  {
+    std::size_t total = 0;
+    while (total < size)
+    {
+      ssize_t n = ::pread(fd_, buffer + total, size - total, total);
+      if (n == -1)
+      {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+
+      if (n == 0)
+        break;
+
+      total += n;
+    }
+
+    *pRead = total;
+    return true;
+  }
+
   operator FileDescriptor() const
   {
     return fd_;
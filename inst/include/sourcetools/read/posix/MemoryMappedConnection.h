@@ -14,17 +14,38 @@ class MemoryMappedConnection
 {
 public:
 
-  MemoryMappedConnection(int fd, std::size_t size)
+  // Options for how the file is mapped.
+  enum Options
+  {
+    // Fault in every page of the file up front.
+    POPULATE = 1,
+
+    // Advise the kernel to back the mapping with huge pages.
+    HUGE_PAGES = 2
+  };
+
+  MemoryMappedConnection(int fd, std::size_t size, int options = POPULATE)
     : size_(size)
   {
+    int flags = MAP_SHARED;
 #ifdef MAP_POPULATE
-    map_ = (char*) ::mmap(0, size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
-#else
-    map_ = (char*) ::mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (options & POPULATE)
+      flags |= MAP_POPULATE;
 #endif
 
+    map_ = (char*) ::mmap(0, size, PROT_READ, flags, fd, 0);
+    if (map_ == MAP_FAILED)
+      return;
+
+    // NOTE: advice values cannot be combined, and so are given in turn.
 #if defined(POSIX_MADV_SEQUENTIAL) && defined(POSIX_MADV_WILLNEED)
-    ::posix_madvise((void*) map_, size, POSIX_MADV_SEQUENTIAL | POSIX_MADV_WILLNEED);
+    ::posix_madvise((void*) map_, size, POSIX_MADV_SEQUENTIAL);
+    ::posix_madvise((void*) map_, size, POSIX_MADV_WILLNEED);
+#endif
+
+#ifdef MADV_HUGEPAGE
+    if (options & HUGE_PAGES)
+      ::madvise((void*) map_, size, MADV_HUGEPAGE);
 #endif
   }
 
@@ -5,6 +5,10 @@
 #include <string>
 
 #include <sourcetools/read/MemoryMappedReader.h>
+#include <sourcetools/read/MappedFile.h>
+#include <sourcetools/read/LineIndex.h>
+#include <sourcetools/read/MappedFileCache.h>
+#include <sourcetools/read/TokenFile.h>
 
 namespace sourcetools {
 
@@ -35,6 +35,28 @@ public:
     return true;
   }
 
+  // Read up to 'size' bytes from the start of the file into
+  // 'buffer', setting 'pRead' to the number of bytes read.
+  bool read(char* buffer, std::size_t size, std::size_t* pRead)
+  {
+    std::size_t total = 0;
+    while (total < size)
+    {
+      DWORD chunk = size - total > 0x40000000 ? 0x40000000 : (DWORD) (size - total);
+      DWORD n = 0;
+      if (!::ReadFile(handle_, buffer + total, chunk, &n, NULL))
+        return false;
+
+      if (n == 0)
+        break;
+
+      total += n;
+    }
+
+    *pRead = total;
+    return true;
+  }
+
   operator FileDescriptor() const
   {
     return handle_;
@@ -12,9 +12,20 @@ class MemoryMappedConnection
 {
 public:
 
-  MemoryMappedConnection(HANDLE handle, std::size_t size)
+  // Options for how the file is mapped. These are only hints, and
+  // have no effect on Windows: views are always faulted in on
+  // demand, with the system's default page size.
+  enum Options
+  {
+    POPULATE = 1,
+    HUGE_PAGES = 2
+  };
+
+  MemoryMappedConnection(HANDLE handle, std::size_t size, int options = POPULATE)
     : map_(NULL), size_(size)
   {
+    (void) options;
+
     handle_ = ::CreateFileMapping(handle, NULL, PAGE_READONLY, 0, 0, NULL);
     if (handle_ == NULL)
       return;
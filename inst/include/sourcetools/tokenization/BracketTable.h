@@ -0,0 +1,144 @@
+#ifndef SOURCETOOLS_TOKENIZATION_BRACKET_TABLE_H
+#define SOURCETOOLS_TOKENIZATION_BRACKET_TABLE_H
+
+#include <cstddef>
+
+#include <vector>
+#include <algorithm>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/tokenization/Registration.h>
+#include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+
+namespace sourcetools {
+namespace tokens {
+
+// The partner of a token that is not a matched bracket.
+static const std::size_t NO_PARTNER = 0xFFFFFFFFu;
+
+// Records, for each bracket in a sequence of tokens, the index of
+// its matching bracket, so that cursors can jump between brackets in
+// constant time. Each kind of bracket is matched independently (as
+// with a cursor's 'fwdToMatchingBracket()'), so that e.g. the parens
+// in '( ] )' still match one another.
+//
+// Tokens are added in order with 'add()', e.g. as they are produced by
+// a tokenizer, or all at once with 'build()'.
+class BracketTable
+{
+public:
+
+  BracketTable()
+  {
+  }
+
+  explicit BracketTable(const TokenView& tokens)
+  {
+    build(tokens);
+  }
+
+  explicit BracketTable(const std::vector<Token>& tokens)
+  {
+    build(tokens);
+  }
+
+  void clear()
+  {
+    partners_.clear();
+    unmatched_.clear();
+    for (std::size_t i = 0; i < KINDS; ++i)
+      open_[i].clear();
+  }
+
+  void build(const TokenView& tokens)
+  {
+    clear();
+    partners_.reserve(tokens.size());
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+      add(tokens.type(i));
+  }
+
+  void build(const std::vector<Token>& tokens)
+  {
+    clear();
+    partners_.reserve(tokens.size());
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+      add(tokens[i].type());
+  }
+
+  // Add the next token, of type 'type'.
+  void add(TokenType type)
+  {
+    unsigned int index = static_cast<unsigned int>(partners_.size());
+    partners_.push_back(static_cast<unsigned int>(NO_PARTNER));
+
+    if (LIKELY(!SOURCE_TOOLS_CHECK_MASK(type, SOURCE_TOOLS_BRACKET_MASK)))
+      return;
+
+    std::vector<unsigned int>& open = open_[kind(type)];
+    if (SOURCE_TOOLS_CHECK_MASK(type, SOURCE_TOOLS_BRACKET_LEFT_MASK))
+    {
+      open.push_back(index);
+    }
+    else if (open.empty())
+    {
+      unmatched_.push_back(index);
+    }
+    else
+    {
+      unsigned int partner = open.back();
+      open.pop_back();
+      partners_[partner] = index;
+      partners_[index] = partner;
+    }
+  }
+
+  std::size_t size() const { return partners_.size(); }
+
+  // The index of the bracket matching the token at 'index', or
+  // 'NO_PARTNER' when the token is not a matched bracket.
+  std::size_t partner(std::size_t index) const
+  {
+    return index < partners_.size() ? partners_[index] : NO_PARTNER;
+  }
+
+  bool hasPartner(std::size_t index) const
+  {
+    return partner(index) != NO_PARTNER;
+  }
+
+  // The indices of the brackets (so far) without a match, in order.
+  std::vector<std::size_t> unmatched() const
+  {
+    std::vector<std::size_t> result(unmatched_.begin(), unmatched_.end());
+    for (std::size_t i = 0; i < KINDS; ++i)
+      result.insert(result.end(), open_[i].begin(), open_[i].end());
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+private:
+
+  static const std::size_t KINDS = 4;
+
+  // Brackets of each kind are registered with an index bit, from
+  // '(1 << 0)' for parens through '(1 << 3)' for '[['.
+  static std::size_t kind(TokenType type)
+  {
+    std::size_t bits = type & 0xF;
+    std::size_t kind = 0;
+    while (bits >>= 1)
+      ++kind;
+    return kind;
+  }
+
+  std::vector<unsigned int> partners_;
+  std::vector<unsigned int> unmatched_;
+  std::vector<unsigned int> open_[KINDS];
+};
+
+} // namespace tokens
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_BRACKET_TABLE_H */
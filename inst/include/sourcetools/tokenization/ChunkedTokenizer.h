@@ -0,0 +1,203 @@
+#ifndef SOURCETOOLS_TOKENIZATION_CHUNKED_TOKENIZER_H
+#define SOURCETOOLS_TOKENIZATION_CHUNKED_TOKENIZER_H
+
+#include <cstdio>
+
+#include <vector>
+#include <string>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/SymbolTable.h>
+#include <sourcetools/tokenization/Tokenizer.h>
+#include <sourcetools/collection/Position.h>
+
+namespace sourcetools {
+namespace tokenizer {
+
+// A resumable tokenizer, for code that arrives in chunks (e.g. when
+// reading a large file piece by piece). Tokens are delivered in
+// batches of at most 'batchSize' tokens to a callback invoked as
+//
+//    f(const Token* tokens, std::size_t n)
+//
+// Token offsets and positions are relative to the start of the whole
+// stream, but the token contents only remain valid for the duration
+// of the callback.
+//
+// Between chunks, only the unfinished tail of the code is retained:
+// the bracket stack and position are carried over, and a token that
+// may continue into the next chunk (e.g. a string, comment or number
+// running up to the end of the chunk) is re-scanned once more code
+// is available. Memory use is hence bounded by the chunk size and
+// the length of the longest token, rather than by the input.
+//
+// The tokens produced are exactly those of the 'tokenize()' loop run
+// over the concatenated chunks.
+class ChunkedTokenizer
+{
+private:
+  typedef tokens::Token Token;
+  typedef tokens::TokenType TokenType;
+  typedef collections::Position Position;
+
+public:
+
+  explicit ChunkedTokenizer(tokens::SymbolTable* pSymbols = NULL,
+                            std::size_t batchSize = 1024)
+    : offset_(0),
+      unfinished_(0),
+      pSymbols_(pSymbols),
+      batchSize_(batchSize == 0 ? 1 : batchSize)
+  {
+    batch_.reserve(batchSize_);
+  }
+
+  // Tokenize the next chunk of code.
+  template <typename F>
+  void feed(const char* data, std::size_t n, F& f)
+  {
+    pending_.append(data, n);
+
+    // Re-scanning an unfinished token is deferred until the pending
+    // code has doubled, so that a long token spanning many chunks is
+    // scanned a logarithmic, rather than linear, number of times.
+    if (pending_.size() >= 2 * unfinished_)
+      scan(false, f);
+  }
+
+  // Tokenize whatever remains once the code has been exhausted.
+  template <typename F>
+  void finish(F& f)
+  {
+    scan(true, f);
+  }
+
+  // The offset of the first byte not yet tokenized.
+  std::size_t offset() const { return offset_; }
+
+private:
+
+  template <typename F>
+  void scan(bool final, F& f)
+  {
+    std::size_t n = pending_.size();
+    Tokenizer tokenizer(pending_.data(), n, 0, position_, brackets_);
+
+    // The tokenizer state prior to the current token, so that an
+    // unfinished token can be re-scanned with the next chunk.
+    std::size_t start = 0;
+    Position position = position_;
+    std::vector<TokenType>& brackets = saved_;
+
+    Token token;
+    while (true)
+    {
+      start = tokenizer.offset();
+      position = tokenizer.position();
+      brackets = tokenizer.brackets();
+
+      if (!tokenizer.tokenize(&token))
+        break;
+
+      // The token (and the characters the tokenizer peeked at past
+      // its end) must lie within the code seen so far.
+      if (!final && tokenizer.offset() + detail::LOOKAHEAD > n)
+        break;
+
+      // Symbols are interned only once their token is known to be
+      // complete, so that partial names are never interned.
+      tokens::SymbolId symbol = tokens::NO_SYMBOL;
+      if (pSymbols_ != NULL &&
+          (token.isType(tokens::SYMBOL) || tokens::isKeyword(token)))
+      {
+        symbol = pSymbols_->internSymbol(token.begin(), token.size());
+      }
+
+      batch_.push_back(Token(
+        token.begin(),
+        token.end(),
+        offset_ + token.offset(),
+        token.position(),
+        token.type(),
+        symbol
+      ));
+
+      if (batch_.size() == batchSize_)
+        flush(f);
+    }
+
+    flush(f);
+
+    pending_.erase(0, start);
+    unfinished_ = pending_.size();
+    offset_ += start;
+    position_ = position;
+    brackets_.swap(brackets);
+  }
+
+  template <typename F>
+  void flush(F& f)
+  {
+    if (batch_.empty())
+      return;
+
+    f(&batch_[0], batch_.size());
+    batch_.clear();
+  }
+
+private:
+  std::string pending_;
+  std::size_t offset_;
+  std::size_t unfinished_;
+  Position position_;
+  std::vector<TokenType> brackets_;
+  std::vector<TokenType> saved_;
+  tokens::SymbolTable* pSymbols_;
+  std::size_t batchSize_;
+  std::vector<Token> batch_;
+};
+
+} // namespace tokenizer
+
+// Tokenize a file, reading it 'chunkSize' bytes at a time, and
+// passing tokens in batches to 'f' (see 'tokenizer::ChunkedTokenizer').
+// Returns false if the file could not be read.
+template <typename F>
+inline bool tokenizeChunked(const std::string& path,
+                            F& f,
+                            std::size_t chunkSize = 1 << 20,
+                            tokens::SymbolTable* pSymbols = NULL)
+{
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if (file == NULL)
+    return false;
+
+  tokenizer::ChunkedTokenizer tokenizer(pSymbols);
+  std::vector<char> chunk(chunkSize == 0 ? 1 : chunkSize);
+
+  bool success = true;
+  while (true)
+  {
+    std::size_t n = std::fread(&chunk[0], 1, chunk.size(), file);
+    if (n > 0)
+      tokenizer.feed(&chunk[0], n, f);
+
+    if (n < chunk.size())
+    {
+      success = std::ferror(file) == 0;
+      break;
+    }
+  }
+
+  std::fclose(file);
+
+  if (success)
+    tokenizer.finish(f);
+
+  return success;
+}
+
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_CHUNKED_TOKENIZER_H */
@@ -0,0 +1,180 @@
+#ifndef SOURCETOOLS_TOKENIZATION_COLUMN_TABLE_H
+#define SOURCETOOLS_TOKENIZATION_COLUMN_TABLE_H
+
+#include <cstddef>
+
+#include <vector>
+#include <algorithm>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/utf8/utf8.h>
+#include <sourcetools/tokenization/Registration.h>
+#include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+
+namespace sourcetools {
+namespace tokens {
+
+// The units in which columns are counted. Token columns are always
+// byte offsets into their line; a 'ColumnTable' re-counts them in
+// code points, or in UTF-16 code units (as used by e.g. the language
+// server protocol).
+enum ColumnUnit
+{
+  COLUMN_BYTES,
+  COLUMN_CHARACTERS,
+  COLUMN_UTF16
+};
+
+namespace detail {
+
+// Count the units in '[begin, end)', assumed to be UTF-8. Each byte
+// of an ill-formed sequence counts as one unit; 'pValid' is cleared
+// when one is seen.
+inline std::size_t countColumns(const char* begin,
+                                const char* end,
+                                ColumnUnit unit,
+                                bool* pValid)
+{
+  std::size_t count = 0;
+  const char* it = begin;
+  while (true)
+  {
+    const char* ascii = utf8::skipAscii(it, end);
+    count += ascii - it;
+    it = ascii;
+    if (it == end)
+      return count;
+
+    std::size_t n = utf8::sequenceLength(it, end);
+    if (n == 0)
+    {
+      *pValid = false;
+      ++count;
+      ++it;
+      continue;
+    }
+
+    if (unit == COLUMN_BYTES)
+      count += n;
+    else if (unit == COLUMN_UTF16 && n == 4)
+      count += 2;
+    else
+      ++count;
+
+    it += n;
+  }
+}
+
+} // namespace detail
+
+// The columns of a sequence of tokens, in the given units, and the
+// tokens containing ill-formed UTF-8 (which are reported as 'INVALID',
+// rather than as what their bytes would be taken for).
+//
+// The UTF-8 is validated, and the columns counted, in a single pass
+// over the code; runs of ASCII are skipped a word at a time. Columns
+// are counted from the start of each token's line, and so a table
+// can be built for any sub-range of a token buffer independently.
+class ColumnTable
+{
+public:
+
+  ColumnTable()
+    : unit_(COLUMN_BYTES),
+      invalidCount_(0)
+  {
+  }
+
+  ColumnTable(const TokenView& tokens, ColumnUnit unit)
+  {
+    build(tokens, unit);
+  }
+
+  void build(const TokenView& tokens, ColumnUnit unit)
+  {
+    std::size_t n = tokens.size();
+    unit_ = unit;
+    columns_.resize(n);
+    invalid_.assign(n, false);
+    invalidCount_ = 0;
+
+    const char* code = tokens.code();
+    const unsigned int* lines = tokens.lines();
+
+    std::size_t row = 0;
+    std::size_t column = 0;
+    const char* it = NULL;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      const char* begin = tokens.begin(i);
+      const char* end = tokens.end(i);
+
+      // Restart from the beginning of the line on each new line
+      // (including after a token spanning several lines).
+      if (it == NULL || tokens.row(i) != row || begin < it)
+      {
+        row = tokens.row(i);
+        it = code + lines[row];
+        column = 0;
+      }
+
+      bool valid = true;
+      column += detail::countColumns(it, begin, unit, &valid);
+      columns_[i] = static_cast<unsigned int>(column);
+
+      valid = true;
+      column += detail::countColumns(begin, end, unit, &valid);
+      it = end;
+
+      if (!valid)
+      {
+        invalid_[i] = true;
+        ++invalidCount_;
+      }
+    }
+  }
+
+  void swap(ColumnTable& other)
+  {
+    std::swap(unit_, other.unit_);
+    columns_.swap(other.columns_);
+    invalid_.swap(other.invalid_);
+    std::swap(invalidCount_, other.invalidCount_);
+  }
+
+  ColumnUnit unit() const { return unit_; }
+  std::size_t size() const { return columns_.size(); }
+
+  // The (zero-based) column of the token at 'index'.
+  std::size_t column(std::size_t index) const
+  {
+    return columns_[index];
+  }
+
+  // Does the token at 'index' contain well-formed UTF-8?
+  bool valid(std::size_t index) const
+  {
+    return !invalid_[index];
+  }
+
+  // The token's type, or 'INVALID' when it is not well-formed.
+  TokenType type(const TokenView& tokens, std::size_t index) const
+  {
+    return invalid_[index] ? INVALID : tokens.type(index);
+  }
+
+  // The number of tokens containing ill-formed UTF-8.
+  std::size_t invalidCount() const { return invalidCount_; }
+
+private:
+  ColumnUnit unit_;
+  std::vector<unsigned int> columns_;
+  std::vector<bool> invalid_;
+  std::size_t invalidCount_;
+};
+
+} // namespace tokens
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_COLUMN_TABLE_H */
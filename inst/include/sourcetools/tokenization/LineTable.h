@@ -0,0 +1,101 @@
+#ifndef SOURCETOOLS_TOKENIZATION_LINE_TABLE_H
+#define SOURCETOOLS_TOKENIZATION_LINE_TABLE_H
+
+#include <cstddef>
+
+#include <vector>
+#include <algorithm>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/collection/Position.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+
+namespace sourcetools {
+namespace tokens {
+
+// Records, for each line of some tokenized code, the offset at which
+// the line starts and the index of the first token starting on it.
+// This maps a row to its tokens in constant time, and converts
+// between offsets and (row, column) positions without retokenizing.
+// Rows and columns are zero-based, as with tokens.
+class LineTable
+{
+private:
+  typedef collections::Position Position;
+
+public:
+
+  LineTable()
+    : tokenCount_(0)
+  {
+  }
+
+  explicit LineTable(const TokenView& tokens)
+  {
+    build(tokens);
+  }
+
+  void build(const TokenView& tokens)
+  {
+    std::size_t lineCount = tokens.lineCount();
+    offsets_.assign(tokens.lines(), tokens.lines() + lineCount);
+    tokenCount_ = tokens.size();
+
+    // Rows never decrease from one token to the next, so each line's
+    // first token is found in one pass. (Lines on which no token
+    // starts share the first token of the next line.)
+    firstTokens_.resize(lineCount + 1);
+    std::size_t row = 0;
+    for (std::size_t i = 0; i < tokenCount_; ++i)
+      for (; row <= tokens.row(i) && row < lineCount; ++row)
+        firstTokens_[row] = static_cast<unsigned int>(i);
+
+    for (; row <= lineCount; ++row)
+      firstTokens_[row] = static_cast<unsigned int>(tokenCount_);
+  }
+
+  std::size_t lineCount() const { return offsets_.size(); }
+  std::size_t tokenCount() const { return tokenCount_; }
+
+  // The offset at which line 'row' starts.
+  std::size_t offset(std::size_t row) const
+  {
+    return offsets_[row];
+  }
+
+  // The offset of 'position', which should lie within the code.
+  std::size_t offset(const Position& position) const
+  {
+    return offsets_[position.row] + position.column;
+  }
+
+  // The row and column of the byte at 'offset'.
+  Position position(std::size_t offset) const
+  {
+    if (UNLIKELY(offsets_.empty()))
+      return Position(0, offset);
+
+    std::vector<unsigned int>::const_iterator it =
+      std::upper_bound(offsets_.begin(), offsets_.end(), offset);
+    std::size_t row = it == offsets_.begin() ? 0 : it - offsets_.begin() - 1;
+    return Position(row, offset - offsets_[row]);
+  }
+
+  // The index of the first token starting on or after line 'row'
+  // (or 'tokenCount()', when there is none). The tokens starting on
+  // line 'row' are those in '[firstToken(row), firstToken(row + 1))'.
+  std::size_t firstToken(std::size_t row) const
+  {
+    return row < firstTokens_.size() ? firstTokens_[row] : tokenCount_;
+  }
+
+private:
+  std::vector<unsigned int> offsets_;
+  std::vector<unsigned int> firstTokens_;
+  std::size_t tokenCount_;
+};
+
+} // namespace tokens
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_LINE_TABLE_H */
@@ -0,0 +1,240 @@
+#ifndef SOURCETOOLS_TOKENIZATION_PARALLEL_TOKENIZER_H
+#define SOURCETOOLS_TOKENIZATION_PARALLEL_TOKENIZER_H
+
+#include <cstring>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/collection/Position.h>
+#include <sourcetools/parallel/parallel.h>
+#include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+#include <sourcetools/tokenization/SymbolTable.h>
+#include <sourcetools/tokenization/Tokenizer.h>
+
+namespace sourcetools {
+namespace tokenizer {
+namespace detail {
+
+// A range of code, '[begin, end)', and the tokens starting within it,
+// along with the tokenizer's state once past the range.
+struct Chunk
+{
+  std::size_t begin;
+  std::size_t end;
+  std::size_t row;
+
+  std::vector<tokens::CompactToken> tokens;
+  std::size_t offset;
+  collections::Position position;
+  std::vector<tokens::TokenType> brackets;
+};
+
+// Tokenize the code in a chunk, from the given state, until the
+// tokenizer reaches (or passes) the end of the chunk.
+inline void scanChunk(const char* code,
+                      std::size_t n,
+                      std::size_t offset,
+                      const collections::Position& position,
+                      const std::vector<tokens::TokenType>& brackets,
+                      Chunk* pChunk)
+{
+  Tokenizer tokenizer(code, n, offset, position, brackets);
+
+  pChunk->tokens.clear();
+  tokens::Token token;
+  while (tokenizer.offset() < pChunk->end && tokenizer.tokenize(&token))
+  {
+    tokens::CompactToken compact;
+    compact.offset = static_cast<unsigned int>(token.offset());
+    compact.length = static_cast<unsigned int>(token.size());
+    compact.row    = static_cast<unsigned int>(token.row());
+    compact.type   = token.type();
+    pChunk->tokens.push_back(compact);
+  }
+
+  pChunk->offset = tokenizer.offset();
+  pChunk->position = tokenizer.position();
+  pChunk->brackets = tokenizer.brackets();
+}
+
+// Tokenizes each chunk on the assumption that it starts a token at
+// the start of a line, with no brackets open.
+class ChunkScanner
+{
+public:
+
+  ChunkScanner(const char* code, std::size_t n, std::vector<Chunk>* pChunks)
+    : code_(code),
+      n_(n),
+      pChunks_(pChunks)
+  {
+  }
+
+  void operator()(std::size_t i)
+  {
+    Chunk& chunk = (*pChunks_)[i];
+    collections::Position position(chunk.row, 0);
+    scanChunk(code_, n_, chunk.begin, position, brackets_, &chunk);
+  }
+
+private:
+  const char* code_;
+  std::size_t n_;
+  std::vector<Chunk>* pChunks_;
+  std::vector<tokens::TokenType> brackets_;
+};
+
+// Whether a chunk may usefully start with 'ch': not whitespace (as a
+// whitespace token would otherwise run on from the previous line),
+// and not a closing bracket (as a bracket is then almost certainly
+// open, and the chunk would only be tokenized again).
+inline bool isSplitStart(char ch)
+{
+  return !utils::isWhitespace(ch) && ch != '}' && ch != ')' && ch != ']';
+}
+
+// Find a place to split code, at or after 'offset': the start of a
+// line that starts as 'isSplitStart()' allows. Returns 'n' when
+// there is none.
+inline std::size_t findSplit(const char* code, std::size_t n, std::size_t offset)
+{
+  while (offset < n)
+  {
+    const void* match = std::memchr(code + offset, '\n', n - offset);
+    if (match == NULL)
+      return n;
+
+    offset = static_cast<const char*>(match) - code + 1;
+    if (offset < n && isSplitStart(code[offset]))
+      return offset;
+  }
+
+  return n;
+}
+
+} // namespace detail
+} // namespace tokenizer
+
+// Tokenize R code into a token buffer, as with 'tokenize()', using up
+// to 'threads' threads ('0' implies all available threads).
+//
+// The code is split at line starts into chunks of at least
+// 'chunkSize' bytes, which are tokenized concurrently, each as if
+// it started a token with no brackets open. The chunks are then
+// stitched together in order: a chunk is only kept when tokenizing
+// the code before it really did stop at the start of the chunk with
+// no brackets open -- i.e. the chunk did not start within a string,
+// a quoted symbol, a '%op%', or an open '[' -- and is tokenized again
+// from the actual state otherwise. The result is thus identical to
+// that of 'tokenize()'.
+inline bool tokenizeParallel(const char* code,
+                             std::size_t n,
+                             tokens::TokenBuffer* pBuffer,
+                             std::size_t threads,
+                             tokens::SymbolTable* pSymbols = NULL,
+                             tokens::TokenType mask = tokens::ALL_TOKENS_MASK,
+                             std::size_t chunkSize = 1024 * 1024)
+{
+  typedef tokenizer::detail::Chunk Chunk;
+  typedef tokens::CompactToken CompactToken;
+
+  if (threads == 0)
+    threads = parallel::threadCount();
+
+  if (chunkSize == 0)
+    chunkSize = 1;
+
+  std::size_t count = std::min(threads, n / chunkSize);
+  if (count < 2)
+    return tokenize(code, n, pBuffer, pSymbols, mask);
+
+  if (!pBuffer->reset(code, n))
+    return false;
+
+  SOURCETOOLS_STATS_TIMER(timer, STAGE_TOKENIZE);
+
+  // Split the code into chunks of roughly equal size.
+  const std::vector<unsigned int>& lines = pBuffer->lines();
+  std::vector<Chunk> chunks;
+  std::size_t begin = 0;
+  for (std::size_t i = 1; i <= count && begin < n; ++i)
+  {
+    std::size_t target = std::max(begin + chunkSize, n / count * i);
+    std::size_t end = i == count ? n : tokenizer::detail::findSplit(code, n, target);
+
+    chunks.push_back(Chunk());
+    Chunk& chunk = chunks.back();
+    chunk.begin = begin;
+    chunk.end = end;
+    chunk.row = std::upper_bound(lines.begin(), lines.end(), begin) - lines.begin() - 1;
+
+    begin = end;
+  }
+
+  tokenizer::detail::ChunkScanner scanner(code, n, &chunks);
+  if (!parallel::forEach(chunks.size(), threads, scanner))
+    return tokenize(code, n, pBuffer, pSymbols, mask);
+
+  // Stitch the chunks together, re-tokenizing those that started
+  // from the wrong state.
+  std::size_t offset = 0;
+  collections::Position position(0, 0);
+  std::vector<tokens::TokenType> brackets;
+  for (std::size_t i = 0; i < chunks.size(); ++i)
+  {
+    Chunk& chunk = chunks[i];
+    if (chunk.begin != offset || !brackets.empty())
+      tokenizer::detail::scanChunk(code, n, offset, position, brackets, &chunk);
+
+    for (std::size_t j = 0; j < chunk.tokens.size(); ++j)
+    {
+      const CompactToken& compact = chunk.tokens[j];
+
+      // Symbols are interned in order, as 'tokenize()' would.
+      tokens::SymbolId symbol = tokens::NO_SYMBOL;
+      if (pSymbols != NULL &&
+          (compact.type == tokens::SYMBOL ||
+           SOURCE_TOOLS_CHECK_MASK(compact.type, SOURCE_TOOLS_KEYWORD_MASK)))
+      {
+        symbol = pSymbols->internSymbol(code + compact.offset, compact.length);
+      }
+
+      if (!tokens::matchesMask(compact.type, mask))
+        continue;
+
+      collections::Position start(compact.row, compact.offset - lines[compact.row]);
+      tokens::Token token(code + compact.offset,
+                          code + compact.offset + compact.length,
+                          compact.offset,
+                          start,
+                          compact.type,
+                          symbol);
+      pBuffer->push_back(token);
+    }
+
+    offset = chunk.offset;
+    position = chunk.position;
+    brackets.swap(chunk.brackets);
+    std::vector<CompactToken>().swap(chunk.tokens);
+  }
+
+  SOURCETOOLS_STATS_ADD(COUNTER_TOKENS, pBuffer->size());
+  return true;
+}
+
+inline bool tokenizeParallel(const std::string& code,
+                             tokens::TokenBuffer* pBuffer,
+                             std::size_t threads,
+                             tokens::SymbolTable* pSymbols = NULL,
+                             tokens::TokenType mask = tokens::ALL_TOKENS_MASK)
+{
+  return tokenizeParallel(code.data(), code.size(), pBuffer, threads, pSymbols, mask);
+}
+
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_PARALLEL_TOKENIZER_H */
@@ -74,38 +74,51 @@ SOURCE_TOOLS_REGISTER_BRACKET(RDBRACKET, SOURCE_TOOLS_BRACKET_RIGHT_BIT, (1 << 3
 //
 // Note that although brackets are operators we tokenize them separately,
 // since we need to later check for their paired complement.
-SOURCE_TOOLS_REGISTER_UNARY_OPERATOR(PLUS,          "+",    0);
-SOURCE_TOOLS_REGISTER_UNARY_OPERATOR(MINUS,         "-",    1);
-SOURCE_TOOLS_REGISTER_UNARY_OPERATOR(HELP,          "?",    2);
-SOURCE_TOOLS_REGISTER_UNARY_OPERATOR(NEGATION,      "!",    3);
-SOURCE_TOOLS_REGISTER_UNARY_OPERATOR(FORMULA,       "~",    4);
-
-SOURCE_TOOLS_REGISTER_OPERATOR(NAMESPACE_EXPORTS,   "::",   5);
-SOURCE_TOOLS_REGISTER_OPERATOR(NAMESPACE_ALL,       ":::",  6);
-SOURCE_TOOLS_REGISTER_OPERATOR(DOLLAR,              "$",    7);
-SOURCE_TOOLS_REGISTER_OPERATOR(AT,                  "@",    8);
-SOURCE_TOOLS_REGISTER_OPERATOR(HAT,                 "^",    9);
-SOURCE_TOOLS_REGISTER_OPERATOR(EXPONENTATION_STARS, "**",  10);
-SOURCE_TOOLS_REGISTER_OPERATOR(SEQUENCE,            ":",   11);
-SOURCE_TOOLS_REGISTER_OPERATOR(MULTIPLY,            "*",   12);
-SOURCE_TOOLS_REGISTER_OPERATOR(DIVIDE,              "/",   13);
-SOURCE_TOOLS_REGISTER_OPERATOR(LESS,                "<",   14);
-SOURCE_TOOLS_REGISTER_OPERATOR(LESS_OR_EQUAL,       "<=",  15);
-SOURCE_TOOLS_REGISTER_OPERATOR(GREATER,             ">",   16);
-SOURCE_TOOLS_REGISTER_OPERATOR(GREATER_OR_EQUAL,    ">=",  17);
-SOURCE_TOOLS_REGISTER_OPERATOR(EQUAL,               "==",  18);
-SOURCE_TOOLS_REGISTER_OPERATOR(NOT_EQUAL,           "!=",  19);
-SOURCE_TOOLS_REGISTER_OPERATOR(AND_VECTOR,          "&",   20);
-SOURCE_TOOLS_REGISTER_OPERATOR(AND_SCALAR,          "&&",  21);
-SOURCE_TOOLS_REGISTER_OPERATOR(OR_VECTOR,           "|",   22);
-SOURCE_TOOLS_REGISTER_OPERATOR(OR_SCALAR,           "||",  23);
-SOURCE_TOOLS_REGISTER_OPERATOR(ASSIGN_LEFT,         "<-",  24);
-SOURCE_TOOLS_REGISTER_OPERATOR(ASSIGN_LEFT_PARENT,  "<<-", 25);
-SOURCE_TOOLS_REGISTER_OPERATOR(ASSIGN_RIGHT,        "->",  26);
-SOURCE_TOOLS_REGISTER_OPERATOR(ASSIGN_RIGHT_PARENT, "->>", 27);
-SOURCE_TOOLS_REGISTER_OPERATOR(ASSIGN_LEFT_EQUALS,  "=",   28);
-SOURCE_TOOLS_REGISTER_OPERATOR(ASSIGN_LEFT_COLON,   ":=",  29);
-SOURCE_TOOLS_REGISTER_OPERATOR(USER,                "%%",  30);
+//
+// Operators are registered through an X-macro list, so that other
+// tables (e.g. those used by the table-driven tokenizer) can be
+// generated from the same set of registrations.
+#define SOURCE_TOOLS_OPERATORS(__OPERATOR__, __UNARY_OPERATOR__)       \
+  __UNARY_OPERATOR__(PLUS,          "+",    0)                         \
+  __UNARY_OPERATOR__(MINUS,         "-",    1)                         \
+  __UNARY_OPERATOR__(HELP,          "?",    2)                         \
+  __UNARY_OPERATOR__(NEGATION,      "!",    3)                         \
+  __UNARY_OPERATOR__(FORMULA,       "~",    4)                         \
+  __OPERATOR__(NAMESPACE_EXPORTS,   "::",   5)                         \
+  __OPERATOR__(NAMESPACE_ALL,       ":::",  6)                         \
+  __OPERATOR__(DOLLAR,              "$",    7)                         \
+  __OPERATOR__(AT,                  "@",    8)                         \
+  __OPERATOR__(HAT,                 "^",    9)                         \
+  __OPERATOR__(EXPONENTATION_STARS, "**",  10)                         \
+  __OPERATOR__(SEQUENCE,            ":",   11)                         \
+  __OPERATOR__(MULTIPLY,            "*",   12)                         \
+  __OPERATOR__(DIVIDE,              "/",   13)                         \
+  __OPERATOR__(LESS,                "<",   14)                         \
+  __OPERATOR__(LESS_OR_EQUAL,       "<=",  15)                         \
+  __OPERATOR__(GREATER,             ">",   16)                         \
+  __OPERATOR__(GREATER_OR_EQUAL,    ">=",  17)                         \
+  __OPERATOR__(EQUAL,               "==",  18)                         \
+  __OPERATOR__(NOT_EQUAL,           "!=",  19)                         \
+  __OPERATOR__(AND_VECTOR,          "&",   20)                         \
+  __OPERATOR__(AND_SCALAR,          "&&",  21)                         \
+  __OPERATOR__(OR_VECTOR,           "|",   22)                         \
+  __OPERATOR__(OR_SCALAR,           "||",  23)                         \
+  __OPERATOR__(ASSIGN_LEFT,         "<-",  24)                         \
+  __OPERATOR__(ASSIGN_LEFT_PARENT,  "<<-", 25)                         \
+  __OPERATOR__(ASSIGN_RIGHT,        "->",  26)                         \
+  __OPERATOR__(ASSIGN_RIGHT_PARENT, "->>", 27)                         \
+  __OPERATOR__(ASSIGN_LEFT_EQUALS,  "=",   28)                         \
+  __OPERATOR__(ASSIGN_LEFT_COLON,   ":=",  29)                         \
+  __OPERATOR__(USER,                "%%",  30)
+
+#define SOURCE_TOOLS_REGISTER_OPERATOR_ENTRY(__NAME__, __STRING__, __INDEX__) \
+  SOURCE_TOOLS_REGISTER_OPERATOR(__NAME__, __STRING__, __INDEX__);
+
+#define SOURCE_TOOLS_REGISTER_UNARY_OPERATOR_ENTRY(__NAME__, __STRING__, __INDEX__) \
+  SOURCE_TOOLS_REGISTER_UNARY_OPERATOR(__NAME__, __STRING__, __INDEX__);
+
+SOURCE_TOOLS_OPERATORS(SOURCE_TOOLS_REGISTER_OPERATOR_ENTRY,
+                       SOURCE_TOOLS_REGISTER_UNARY_OPERATOR_ENTRY)
 
 /* Keywords and symbols */
 #define SOURCE_TOOLS_KEYWORD_BIT               (1 << 17)
@@ -121,26 +134,58 @@ SOURCE_TOOLS_REGISTER_OPERATOR(USER,                "%%",  30);
   SOURCE_TOOLS_REGISTER_KEYWORD(__NAME__, __MASKS__ | SOURCE_TOOLS_KEYWORD_CONTROL_FLOW_MASK)
 
 // See '?Reserved' for a list of reversed R symbols.
-SOURCE_TOOLS_REGISTER_CONTROL_FLOW_KEYWORD(IF,       1);
-SOURCE_TOOLS_REGISTER_CONTROL_FLOW_KEYWORD(FOR,      2);
-SOURCE_TOOLS_REGISTER_CONTROL_FLOW_KEYWORD(WHILE,    3);
-SOURCE_TOOLS_REGISTER_CONTROL_FLOW_KEYWORD(REPEAT,   4);
-SOURCE_TOOLS_REGISTER_CONTROL_FLOW_KEYWORD(FUNCTION, 5);
-
-SOURCE_TOOLS_REGISTER_KEYWORD(ELSE,                  6);
-SOURCE_TOOLS_REGISTER_KEYWORD(IN,                    7);
-SOURCE_TOOLS_REGISTER_KEYWORD(NEXT,                  8);
-SOURCE_TOOLS_REGISTER_KEYWORD(BREAK,                 9);
-SOURCE_TOOLS_REGISTER_KEYWORD(TRUE,                 10);
-SOURCE_TOOLS_REGISTER_KEYWORD(FALSE,                11);
-SOURCE_TOOLS_REGISTER_KEYWORD(NULL,                 12);
-SOURCE_TOOLS_REGISTER_KEYWORD(Inf,                  13);
-SOURCE_TOOLS_REGISTER_KEYWORD(NaN,                  14);
-SOURCE_TOOLS_REGISTER_KEYWORD(NA,                   15);
-SOURCE_TOOLS_REGISTER_KEYWORD(NA_integer_,          16);
-SOURCE_TOOLS_REGISTER_KEYWORD(NA_real_,             17);
-SOURCE_TOOLS_REGISTER_KEYWORD(NA_complex_,          18);
-SOURCE_TOOLS_REGISTER_KEYWORD(NA_character_,        19);
+//
+// As with operators, keywords are registered through an X-macro
+// list, so that other tables (e.g. the symbol table) can be seeded
+// from the same set of registrations.
+#define SOURCE_TOOLS_KEYWORDS(__KEYWORD__, __CONTROL_FLOW_KEYWORD__)   \
+  __CONTROL_FLOW_KEYWORD__(IF,            "if",             1)         \
+  __CONTROL_FLOW_KEYWORD__(FOR,           "for",            2)         \
+  __CONTROL_FLOW_KEYWORD__(WHILE,         "while",          3)         \
+  __CONTROL_FLOW_KEYWORD__(REPEAT,        "repeat",         4)         \
+  __CONTROL_FLOW_KEYWORD__(FUNCTION,      "function",       5)         \
+  __KEYWORD__(ELSE,          "else",           6)                      \
+  __KEYWORD__(IN,            "in",             7)                      \
+  __KEYWORD__(NEXT,          "next",           8)                      \
+  __KEYWORD__(BREAK,         "break",          9)                      \
+  __KEYWORD__(TRUE,          "TRUE",          10)                      \
+  __KEYWORD__(FALSE,         "FALSE",         11)                      \
+  __KEYWORD__(NULL,          "NULL",          12)                      \
+  __KEYWORD__(Inf,           "Inf",           13)                      \
+  __KEYWORD__(NaN,           "NaN",           14)                      \
+  __KEYWORD__(NA,            "NA",            15)                      \
+  __KEYWORD__(NA_integer_,   "NA_integer_",   16)                      \
+  __KEYWORD__(NA_real_,      "NA_real_",      17)                      \
+  __KEYWORD__(NA_complex_,   "NA_complex_",   18)                      \
+  __KEYWORD__(NA_character_, "NA_character_", 19)
+
+// NOTE: The entries paste the keyword name directly, rather than
+// forwarding it through 'SOURCE_TOOLS_REGISTER_KEYWORD()', as names
+// like 'NULL' would otherwise be macro-expanded along the way.
+#define SOURCE_TOOLS_REGISTER_KEYWORD_ENTRY(__NAME__, __STRING__, __INDEX__) \
+  static const TokenType KEYWORD_ ## __NAME__ =                            \
+    __INDEX__ | SOURCE_TOOLS_KEYWORD_MASK;
+
+#define SOURCE_TOOLS_REGISTER_CONTROL_FLOW_KEYWORD_ENTRY(__NAME__, __STRING__, __INDEX__) \
+  static const TokenType KEYWORD_ ## __NAME__ =                                         \
+    __INDEX__ | SOURCE_TOOLS_KEYWORD_CONTROL_FLOW_MASK | SOURCE_TOOLS_KEYWORD_MASK;
+
+SOURCE_TOOLS_KEYWORDS(SOURCE_TOOLS_REGISTER_KEYWORD_ENTRY,
+                      SOURCE_TOOLS_REGISTER_CONTROL_FLOW_KEYWORD_ENTRY)
+
+/* Masks */
+// Each category of token (the simple types, alongside brackets,
+// operators and keywords) is identified by a single bit in the upper
+// bits of its type, so a mask of those bits selects a set of token
+// categories; e.g. 'SYMBOL | SOURCE_TOOLS_KEYWORD_MASK'.
+#define SOURCE_TOOLS_CATEGORY_MASK 0xFFFE0000u
+
+static const TokenType ALL_TOKENS_MASK = SOURCE_TOOLS_CATEGORY_MASK;
+
+inline bool matchesMask(TokenType type, TokenType mask)
+{
+  return (type & mask & SOURCE_TOOLS_CATEGORY_MASK) != 0;
+}
 
 inline TokenType symbolType(const char* string, std::size_t n)
 {
@@ -0,0 +1,98 @@
+#ifndef SOURCETOOLS_TOKENIZATION_SKIP_TABLE_H
+#define SOURCETOOLS_TOKENIZATION_SKIP_TABLE_H
+
+#include <cstddef>
+
+#include <vector>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/tokenization/Registration.h>
+#include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+
+namespace sourcetools {
+namespace tokens {
+
+// Links the significant tokens (those other than whitespace and
+// comments) in a sequence of tokens, so that cursors can skip over
+// whitespace and comments in constant time -- however many tokens
+// are skipped, and however many significant tokens are stepped over.
+//
+// Tokens are added in order with 'add()', or all at once with
+// 'build()'.
+class SkipTable
+{
+public:
+
+  SkipTable()
+  {
+    ranks_.push_back(0);
+  }
+
+  explicit SkipTable(const TokenView& tokens)
+  {
+    build(tokens);
+  }
+
+  explicit SkipTable(const std::vector<Token>& tokens)
+  {
+    build(tokens);
+  }
+
+  void clear()
+  {
+    significant_.clear();
+    ranks_.assign(1, 0);
+  }
+
+  void build(const TokenView& tokens)
+  {
+    clear();
+    ranks_.reserve(tokens.size() + 1);
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+      add(tokens.type(i));
+  }
+
+  void build(const std::vector<Token>& tokens)
+  {
+    clear();
+    ranks_.reserve(tokens.size() + 1);
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+      add(tokens[i].type());
+  }
+
+  // Add the next token, of type 'type'.
+  void add(TokenType type)
+  {
+    if (type != WHITESPACE && type != COMMENT)
+      significant_.push_back(static_cast<unsigned int>(ranks_.size() - 1));
+    ranks_.push_back(static_cast<unsigned int>(significant_.size()));
+  }
+
+  // The number of tokens, and of significant tokens, added.
+  std::size_t size() const { return ranks_.size() - 1; }
+  std::size_t count() const { return significant_.size(); }
+
+  // The number of significant tokens before the token at 'index'.
+  // (The significant tokens at or after 'index' thus start from
+  // 'significant(rank(index))'.)
+  std::size_t rank(std::size_t index) const
+  {
+    return ranks_[index];
+  }
+
+  // The index of the significant token of rank 'rank'.
+  std::size_t significant(std::size_t rank) const
+  {
+    return significant_[rank];
+  }
+
+private:
+  std::vector<unsigned int> significant_;
+  std::vector<unsigned int> ranks_;
+};
+
+} // namespace tokens
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_SKIP_TABLE_H */
@@ -0,0 +1,160 @@
+#ifndef SOURCETOOLS_TOKENIZATION_STRING_DECODER_H
+#define SOURCETOOLS_TOKENIZATION_STRING_DECODER_H
+
+#include <cstddef>
+#include <cstring>
+
+#include <vector>
+#include <algorithm>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/tokenization/Registration.h>
+#include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+
+namespace sourcetools {
+namespace tokens {
+
+// The decoded values of the strings and symbols in a sequence of
+// tokens: the contents of strings, and the names of symbols, with
+// quotes removed and escape sequences processed. Other tokens have
+// no value.
+//
+// Values without escape sequences (nearly all of them, in practice)
+// are not copied; they refer back into the source code, which must
+// hence outlive the decoded strings. Other values are decoded into a
+// single arena. No R APIs are touched, and so strings can be decoded
+// on worker threads.
+class DecodedStrings
+{
+public:
+
+  DecodedStrings()
+    : code_(NULL)
+  {
+  }
+
+  explicit DecodedStrings(const TokenView& tokens)
+    : code_(NULL)
+  {
+    decode(tokens);
+  }
+
+  void decode(const TokenView& tokens)
+  {
+    std::size_t n = tokens.size();
+    code_ = tokens.code();
+    values_.assign(n, Value());
+    arena_.clear();
+
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      TokenType type = tokens.type(i);
+      if (type != STRING && type != SYMBOL)
+        continue;
+
+      const char* begin = tokens.begin(i);
+      const char* end = tokens.end(i);
+      if (type == STRING || (begin != end && *begin == '`'))
+      {
+        // Strip the quotes (when the string is terminated).
+        ++begin;
+        if (end > begin && end[-1] == *tokens.begin(i))
+          --end;
+      }
+
+      decode(begin, end, &values_[i]);
+    }
+  }
+
+  void swap(DecodedStrings& other)
+  {
+    std::swap(code_, other.code_);
+    values_.swap(other.values_);
+    arena_.swap(other.arena_);
+  }
+
+  std::size_t size() const { return values_.size(); }
+
+  // Does the token at 'index' have a value?
+  bool hasValue(std::size_t index) const
+  {
+    return values_[index].flags & HAS_VALUE;
+  }
+
+  // The decoded value's data, and length. The data is not
+  // nul-terminated (and may itself contain nul bytes).
+  const char* data(std::size_t index) const
+  {
+    const Value& value = values_[index];
+    return value.flags & IN_ARENA
+      ? &arena_[0] + value.offset
+      : code_ + value.offset;
+  }
+
+  std::size_t length(std::size_t index) const
+  {
+    return values_[index].length;
+  }
+
+  // A combination of 'StringFlags', for the token at 'index'.
+  int flags(std::size_t index) const
+  {
+    return values_[index].flags & STRING_FLAGS_MASK;
+  }
+
+  // The number of bytes decoded into the arena.
+  std::size_t arenaSize() const { return arena_.size(); }
+
+private:
+
+  enum
+  {
+    STRING_FLAGS_MASK = STRING_ESCAPES | STRING_UNICODE | STRING_NUL,
+    HAS_VALUE         = 1 << 6,
+    IN_ARENA          = 1 << 7
+  };
+
+  struct Value
+  {
+    Value() : offset(0), length(0), flags(0) {}
+
+    unsigned int offset;
+    unsigned int length;
+    int flags;
+  };
+
+  void decode(const char* begin, const char* end, Value* pValue)
+  {
+    std::size_t n = end - begin;
+
+    // Fast path: refer to values without escapes in place.
+    if (std::memchr(begin, '\\', n) == NULL)
+    {
+      pValue->offset = static_cast<unsigned int>(begin - code_);
+      pValue->length = static_cast<unsigned int>(n);
+      pValue->flags = HAS_VALUE;
+      return;
+    }
+
+    std::size_t offset = arena_.size();
+    arena_.resize(offset + n);
+
+    int flags = 0;
+    std::size_t length = decodeString(begin, end, &arena_[offset], &flags);
+    arena_.resize(offset + length);
+
+    pValue->offset = static_cast<unsigned int>(offset);
+    pValue->length = static_cast<unsigned int>(length);
+    pValue->flags = flags | HAS_VALUE | IN_ARENA;
+  }
+
+  const char* code_;
+  std::vector<Value> values_;
+  std::vector<char> arena_;
+};
+
+} // namespace tokens
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_STRING_DECODER_H */
@@ -0,0 +1,189 @@
+#ifndef SOURCETOOLS_TOKENIZATION_SYMBOL_TABLE_H
+#define SOURCETOOLS_TOKENIZATION_SYMBOL_TABLE_H
+
+#include <cstring>
+
+#include <vector>
+#include <string>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/tokenization/Registration.h>
+
+namespace sourcetools {
+namespace tokens {
+
+typedef unsigned int SymbolId;
+static const SymbolId NO_SYMBOL = 0xFFFFFFFFu;
+
+// Interns the names of symbols, assigning each distinct name a
+// stable 32-bit id. Each name is stored once, so that consumers
+// can compare symbols by id rather than by their contents.
+//
+// The R keywords are registered up front, with ids assigned in
+// registration order; looking up a name hence also determines
+// whether or not that name is a keyword.
+//
+// NOTE: Symbol tables are not thread-safe.
+class SymbolTable
+{
+public:
+
+  SymbolTable()
+    : slots_(64, NO_SYMBOL)
+  {
+    offsets_.push_back(0);
+
+#define SOURCE_TOOLS_SYMBOL_TABLE_KEYWORD(__NAME__, __STRING__, __INDEX__) \
+    insert(__STRING__, sizeof(__STRING__) - 1, KEYWORD_ ## __NAME__);
+
+    SOURCE_TOOLS_KEYWORDS(SOURCE_TOOLS_SYMBOL_TABLE_KEYWORD,
+                          SOURCE_TOOLS_SYMBOL_TABLE_KEYWORD)
+
+#undef SOURCE_TOOLS_SYMBOL_TABLE_KEYWORD
+
+    keywords_ = types_.size();
+  }
+
+  // Intern a name, returning its id.
+  SymbolId intern(const char* data, std::size_t n)
+  {
+    unsigned int code = hash(data, n);
+    std::size_t slot = probe(data, n, code);
+    if (slots_[slot] != NO_SYMBOL)
+      return slots_[slot];
+
+    return insert(data, n, SYMBOL, code);
+  }
+
+  SymbolId intern(const std::string& name)
+  {
+    return intern(name.data(), name.size());
+  }
+
+  // Intern the name of a symbol token, as written in code. The
+  // backquotes surrounding a quoted symbol are not part of its name.
+  SymbolId internSymbol(const char* begin, std::size_t n)
+  {
+    if (n >= 2 && begin[0] == '`' && begin[n - 1] == '`')
+      return intern(begin + 1, n - 2);
+    return intern(begin, n);
+  }
+
+  // Find the id associated with a name, returning 'NO_SYMBOL'
+  // if that name has not been interned.
+  SymbolId find(const char* data, std::size_t n) const
+  {
+    return slots_[probe(data, n, hash(data, n))];
+  }
+
+  SymbolId find(const std::string& name) const
+  {
+    return find(name.data(), name.size());
+  }
+
+  std::size_t size() const { return types_.size(); }
+  std::size_t keywordCount() const { return keywords_; }
+
+  const char* data(SymbolId id) const { return &names_[0] + offsets_[id]; }
+  std::size_t length(SymbolId id) const { return offsets_[id + 1] - offsets_[id]; }
+
+  std::string name(SymbolId id) const
+  {
+    return std::string(data(id), length(id));
+  }
+
+  // The token type for a symbol: one of the 'KEYWORD_' types for
+  // keywords, and 'SYMBOL' otherwise.
+  TokenType type(SymbolId id) const { return types_[id]; }
+  bool isKeyword(SymbolId id) const { return id < keywords_; }
+
+private:
+
+  // FNV-1a.
+  static unsigned int hash(const char* data, std::size_t n)
+  {
+    unsigned int code = 2166136261u;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      code ^= static_cast<unsigned char>(data[i]);
+      code *= 16777619u;
+    }
+    return code;
+  }
+
+  // Find the slot holding 'data', or the empty slot where it
+  // would be inserted. The table size is a power of two.
+  std::size_t probe(const char* data,
+                    std::size_t n,
+                    unsigned int code) const
+  {
+    std::size_t mask = slots_.size() - 1;
+    std::size_t slot = code & mask;
+    while (true)
+    {
+      SymbolId id = slots_[slot];
+      if (id == NO_SYMBOL)
+        return slot;
+
+      if (hashes_[id] == code &&
+          length(id) == n &&
+          std::memcmp(this->data(id), data, n) == 0)
+        return slot;
+
+      slot = (slot + 1) & mask;
+    }
+  }
+
+  SymbolId insert(const char* data, std::size_t n, TokenType type)
+  {
+    return insert(data, n, type, hash(data, n));
+  }
+
+  SymbolId insert(const char* data,
+                  std::size_t n,
+                  TokenType type,
+                  unsigned int code)
+  {
+    SymbolId id = static_cast<SymbolId>(types_.size());
+
+    names_.insert(names_.end(), data, data + n);
+    offsets_.push_back(static_cast<unsigned int>(names_.size()));
+    hashes_.push_back(code);
+    types_.push_back(type);
+
+    // Keep the load factor at or below one half.
+    if (2 * types_.size() > slots_.size())
+      rehash(2 * slots_.size());
+    else
+      slots_[probe(data, n, code)] = id;
+
+    return id;
+  }
+
+  void rehash(std::size_t capacity)
+  {
+    slots_.assign(capacity, NO_SYMBOL);
+
+    std::size_t mask = capacity - 1;
+    for (SymbolId id = 0; id < types_.size(); ++id)
+    {
+      std::size_t slot = hashes_[id] & mask;
+      while (slots_[slot] != NO_SYMBOL)
+        slot = (slot + 1) & mask;
+      slots_[slot] = id;
+    }
+  }
+
+private:
+  std::vector<char> names_;
+  std::vector<unsigned int> offsets_;
+  std::vector<unsigned int> hashes_;
+  std::vector<TokenType> types_;
+  std::vector<SymbolId> slots_;
+  std::size_t keywords_;
+};
+
+} // namespace tokens
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_SYMBOL_TABLE_H */
@@ -7,10 +7,13 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <algorithm>
 #include <sstream>
 
 #include <sourcetools/core/core.h>
+#include <sourcetools/utf8/utf8.h>
 #include <sourcetools/tokenization/Registration.h>
+#include <sourcetools/tokenization/SymbolTable.h>
 #include <sourcetools/collection/Position.h>
 #include <sourcetools/cursor/TextCursor.h>
 
@@ -29,7 +32,8 @@ public:
     : begin_(NULL),
       end_(NULL),
       offset_(0),
-      type_(INVALID)
+      type_(INVALID),
+      symbol_(NO_SYMBOL)
   {
   }
 
@@ -37,7 +41,8 @@ public:
     : begin_(NULL),
       end_(NULL),
       offset_(0),
-      type_(type)
+      type_(type),
+      symbol_(NO_SYMBOL)
   {
   }
 
@@ -46,7 +51,8 @@ public:
       end_(NULL),
       offset_(0),
       position_(position),
-      type_(INVALID)
+      type_(INVALID),
+      symbol_(NO_SYMBOL)
   {
   }
 
@@ -55,7 +61,23 @@ public:
       end_(cursor.begin() + cursor.offset() + length),
       offset_(cursor.offset()),
       position_(cursor.position()),
-      type_(type)
+      type_(type),
+      symbol_(NO_SYMBOL)
+  {
+  }
+
+  Token(const char* begin,
+        const char* end,
+        std::size_t offset,
+        const Position& position,
+        TokenType type,
+        SymbolId symbol = NO_SYMBOL)
+    : begin_(begin),
+      end_(end),
+      offset_(offset),
+      position_(position),
+      type_(type),
+      symbol_(symbol)
   {
   }
 
@@ -89,6 +111,11 @@ public:
   TokenType type() const { return type_; }
   bool isType(TokenType type) const { return type_ == type; }
 
+  // The id of this token's name within a symbol table, or
+  // 'NO_SYMBOL' if the token's name was not interned.
+  SymbolId symbol() const { return symbol_; }
+  void setSymbol(SymbolId symbol) { symbol_ = symbol; }
+
 private:
   const char* begin_;
   const char* end_;
@@ -96,6 +123,7 @@ private:
 
   Position position_;
   TokenType type_;
+  SymbolId symbol_;
 };
 
 inline bool isBracket(const Token& token)
@@ -261,120 +289,90 @@ inline int hexValue(char c)
   return 0;
 }
 
+// The escape sequence parsers below are given an iterator pointing
+// at a backslash, and the end of the string; on success, they write
+// the decoded bytes to 'output', and advance both.
+
 // Parses an octal escape sequence, e.g. '\012'.
-inline bool parseOctal(const char*& it, char*& output)
+inline bool parseOctal(const char*& it, const char* end, char*& output)
 {
-  // Check for opening escape
-  if (*it != '\\')
+  // Check for a number following the escape.
+  if (end - it < 2 || it[1] < '0' || it[1] > '7')
     return false;
 
-  // Check for number following
-  char lookahead = *(it + 1);
-  if (lookahead < '0' || lookahead > '7')
-    return false;
-  ++it;
-
-  // Begin parsing. Consume up to three numbers.
+  // Consume up to three numbers.
+  const char* clone = it + 1;
+  const char* last = std::min(clone + 3, end);
   unsigned char result = 0;
-  const char* end = it + 3;
-  for (; it != end; ++it)
-  {
-    char ch = *it;
-    if ('0' <= ch && ch <= '7')
-      result = 8 * result + ch - '0';
-    else
-      break;
-  }
+  for (; clone != last && *clone >= '0' && *clone <= '7'; ++clone)
+    result = 8 * result + *clone - '0';
 
-  // Assign result, and return.
   *output++ = result;
+  it = clone;
   return true;
 }
 
 // Parse a hex escape sequence, e.g. '\xFF'.
-inline bool parseHex(const char*& it, char*& output)
+inline bool parseHex(const char*& it, const char* end, char*& output)
 {
-  // Check for opening escape.
-  if (*it != '\\')
+  if (end - it < 3 || it[1] != 'x' || !isHexDigit(it[2]))
     return false;
 
-  if (*(it + 1) != 'x')
-    return false;
-
-  if (!isHexDigit(*(it + 2)))
-    return false;
-
-  // Begin parsing.
-  it += 2;
+  // Consume up to two hex digits.
+  const char* clone = it + 2;
+  const char* last = std::min(clone + 2, end);
   unsigned char value = 0;
-  const char* end = it + 2;
-  for (; it != end; ++it)
-  {
-    int result = hexValue(*it);
-    if (result == 0)
-      break;
-    value = 16 * value + result;
-  }
+  for (; clone != last && isHexDigit(*clone); ++clone)
+    value = 16 * value + hexValue(*clone);
 
   *output++ = value;
+  it = clone;
   return true;
 }
 
-// Parse a unicode escape sequence.
-inline bool parseUnicode(const char*& it, char*& output)
+// Parse a unicode escape sequence, e.g. '\u00e9', '\U0001F600' or
+// '\u{e9}', writing the code point as UTF-8.
+inline bool parseUnicode(const char*& it, const char* end, char*& output)
 {
-  if (*it != '\\')
+  if (end - it < 3)
     return false;
 
-  char lookahead = *(it + 1);
   int size;
-  if (lookahead == 'u')
+  if (it[1] == 'u')
     size = 4;
-  else if (lookahead == 'U')
+  else if (it[1] == 'U')
     size = 8;
   else
     return false;
 
-  // Clone the input iterator (only set it on success)
-  const char* clone = it;
-  clone += 2;
-
   // Check for e.g. '\u{...}'
   //                   ^
+  const char* clone = it + 2;
   bool delimited = *clone == '{';
   clone += delimited;
 
   // Check for a hex digit.
-  if (!isHexDigit(*clone))
+  if (clone == end || !isHexDigit(*clone))
     return false;
 
-  // Begin parsing hex digits
-  wchar_t value = 0;
-  const char* end = clone + size;
-  for (; clone != end; ++clone)
-  {
-    if (!isHexDigit(*clone))
-      break;
-
-    int hex = hexValue(*clone);
-    value = 16 * value + hex;
-  }
+  // Consume up to 'size' hex digits.
+  const char* last = end - clone > size ? clone + size : end;
+  unsigned int value = 0;
+  for (; clone != last && isHexDigit(*clone); ++clone)
+    value = 16 * value + hexValue(*clone);
 
   // Eat a closing '}' if we had a starting '{'.
   if (delimited)
   {
-    if (*clone != '}')
+    if (clone == end || *clone != '}')
       return false;
     ++clone;
   }
 
-  std::mbstate_t state;
-  std::memset(&state, 0, sizeof(state));
-  std::size_t bytes = std::wcrtomb(output, value, &state);
-  if (bytes == static_cast<std::size_t>(-1))
+  std::size_t bytes = utf8::encode(value, output);
+  if (bytes == 0)
     return false;
 
-  // Update iterator state
   it = clone;
   output += bytes;
   return true;
@@ -382,55 +380,106 @@ inline bool parseUnicode(const char*& it, char*& output)
 
 } // namespace detail
 
-inline std::string stringValue(const char* begin, const char* end)
+// Flags describing a decoded string.
+enum StringFlags
 {
-  if (begin == end)
-    return std::string();
+  // The string contained escape sequences.
+  STRING_ESCAPES = 1 << 0,
+
+  // The string contained unicode escapes (and so its decoded value
+  // is encoded as UTF-8).
+  STRING_UNICODE = 1 << 1,
 
-  std::size_t n = end - begin;
-  scoped_array<char> buffer(new char[n + 1]);
+  // The decoded value contains a nul byte.
+  STRING_NUL     = 1 << 2
+};
 
+// Decode the contents of a string (excluding its quotes), processing
+// escape sequences, into 'output'; the decoded value is never longer
+// than the contents, and so 'output' must have room for 'end - begin'
+// bytes. Returns the length of the decoded value, and sets 'pFlags'
+// (when supplied) to a combination of 'StringFlags'.
+//
+// Decoding is locale-independent, and touches no global state, and so
+// is safe to invoke from worker threads.
+inline std::size_t decodeString(const char* begin,
+                                const char* end,
+                                char* output,
+                                int* pFlags = NULL)
+{
   const char* it = begin;
-  char* output = buffer;
+  char* start = output;
+  int flags = 0;
 
   while (it < end)
   {
-    if (*it == '\\')
+    // Copy everything up to the next escape as-is.
+    const char* escape = static_cast<const char*>(std::memchr(it, '\\', end - it));
+    if (escape == NULL)
+      escape = end;
+
+    std::memcpy(output, it, escape - it);
+    output += escape - it;
+    it = escape;
+    if (it == end)
+      break;
+
+    flags |= STRING_ESCAPES;
+    char* before = output;
+    if (detail::parseOctal(it, end, output) ||
+        detail::parseHex(it, end, output))
+    {
+      if (output[-1] == '\0')
+        flags |= STRING_NUL;
+      continue;
+    }
+
+    if (detail::parseUnicode(it, end, output))
     {
-      if (detail::parseOctal(it, output) ||
-          detail::parseHex(it, output) ||
-          detail::parseUnicode(it, output))
-      {
-        continue;
-      }
-
-      // Handle the rest
-      ++it;
-      switch (*it)
-      {
-      case 'a':  *output++ = '\a'; break;
-      case 'b':  *output++ = '\b'; break;
-      case 'f':  *output++ = '\f'; break;
-      case 'n':  *output++ = '\n'; break;
-      case 'r':  *output++ = '\r'; break;
-      case 't':  *output++ = '\t'; break;
-      case 'v':  *output++ = '\v'; break;
-      case '\\': *output++ = '\\'; break;
-      default:   *output++ = *it;  break;
-      }
-      ++it;
+      if (output - before > 1)
+        flags |= STRING_UNICODE;
+      else if (output[-1] == '\0')
+        flags |= STRING_NUL;
+      continue;
     }
-    else
+
+    // A trailing backslash is kept as-is.
+    if (it + 1 == end)
     {
       *output++ = *it++;
+      break;
+    }
+
+    // Handle the rest
+    ++it;
+    switch (*it)
+    {
+    case 'a':  *output++ = '\a'; break;
+    case 'b':  *output++ = '\b'; break;
+    case 'f':  *output++ = '\f'; break;
+    case 'n':  *output++ = '\n'; break;
+    case 'r':  *output++ = '\r'; break;
+    case 't':  *output++ = '\t'; break;
+    case 'v':  *output++ = '\v'; break;
+    case '\\': *output++ = '\\'; break;
+    default:   *output++ = *it;  break;
     }
+    ++it;
   }
 
-  // Ensure null termination, just in case
-  *output++ = '\0';
+  if (pFlags != NULL)
+    *pFlags = flags;
+
+  return output - start;
+}
+
+inline std::string stringValue(const char* begin, const char* end)
+{
+  if (begin == end)
+    return std::string();
 
-  // Construct the result string and return
-  std::string result(buffer, output - buffer);
+  std::string result(end - begin, '\0');
+  result.resize(decodeString(begin, end, &result[0]));
   return result;
 }
 
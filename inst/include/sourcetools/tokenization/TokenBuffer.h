@@ -0,0 +1,398 @@
+#ifndef SOURCETOOLS_TOKENIZATION_TOKEN_BUFFER_H
+#define SOURCETOOLS_TOKENIZATION_TOKEN_BUFFER_H
+
+#include <cstddef>
+#include <cstring>
+
+#include <vector>
+#include <algorithm>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/tokenization/Registration.h>
+#include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/SymbolTable.h>
+#include <sourcetools/collection/Position.h>
+
+namespace sourcetools {
+namespace tokens {
+
+// A packed, 16-byte representation of a token. The token's
+// contents are not stored; rather, tokens refer back into the
+// source buffer they were produced from by offset and length.
+// Columns are recovered from the row and the line table.
+struct CompactToken
+{
+  unsigned int offset;
+  unsigned int length;
+  unsigned int row;
+  TokenType type;
+};
+
+namespace detail {
+
+// Compile-time check that a 'CompactToken' really is 16 bytes.
+typedef char compact_token_size_check[sizeof(CompactToken) == 16 ? 1 : -1];
+
+} // namespace detail
+
+// Whether 'tokenCount' compact tokens, and 'lineCount' line offsets,
+// refer only to code of 'size' bytes: every line starts within it, and
+// every token lies within it, on a line starting no later than the
+// token does.
+inline bool withinCode(const CompactToken* tokens,
+                       std::size_t tokenCount,
+                       const unsigned int* lines,
+                       std::size_t lineCount,
+                       std::size_t size)
+{
+  for (std::size_t i = 0; i < lineCount; ++i)
+    if (lines[i] > size)
+      return false;
+
+  for (std::size_t i = 0; i < tokenCount; ++i)
+  {
+    const CompactToken& token = tokens[i];
+    if (token.offset > size ||
+        token.length > size - token.offset ||
+        token.row >= lineCount ||
+        token.offset < lines[token.row])
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// A non-owning view over a set of compact tokens, alongside
+// the source code and line table they refer to.
+class TokenView
+{
+private:
+  typedef collections::Position Position;
+
+public:
+
+  TokenView()
+    : code_(NULL),
+      tokens_(NULL),
+      n_(0),
+      lines_(NULL),
+      nLines_(0),
+      symbols_(NULL)
+  {
+  }
+
+  TokenView(const char* code,
+            const CompactToken* tokens,
+            std::size_t n,
+            const unsigned int* lines,
+            std::size_t nLines,
+            const SymbolId* symbols = NULL)
+    : code_(code),
+      tokens_(tokens),
+      n_(n),
+      lines_(lines),
+      nLines_(nLines),
+      symbols_(symbols)
+  {
+  }
+
+  const char* code() const { return code_; }
+  std::size_t size() const { return n_; }
+  bool empty() const { return n_ == 0; }
+
+  const CompactToken* tokens() const { return tokens_; }
+  const unsigned int* lines() const { return lines_; }
+  std::size_t lineCount() const { return nLines_; }
+
+  // Symbol ids, when available, are stored alongside the tokens.
+  const SymbolId* symbols() const { return symbols_; }
+
+  const CompactToken& operator[](std::size_t index) const
+  {
+    return tokens_[index];
+  }
+
+  TokenType type(std::size_t index) const { return tokens_[index].type; }
+  std::size_t offset(std::size_t index) const { return tokens_[index].offset; }
+  std::size_t length(std::size_t index) const { return tokens_[index].length; }
+  std::size_t row(std::size_t index) const { return tokens_[index].row; }
+
+  SymbolId symbol(std::size_t index) const
+  {
+    return symbols_ == NULL ? NO_SYMBOL : symbols_[index];
+  }
+
+  std::size_t column(std::size_t index) const
+  {
+    const CompactToken& token = tokens_[index];
+    return token.offset - lines_[token.row];
+  }
+
+  const char* begin(std::size_t index) const
+  {
+    return code_ + tokens_[index].offset;
+  }
+
+  const char* end(std::size_t index) const
+  {
+    return code_ + tokens_[index].offset + tokens_[index].length;
+  }
+
+  Position position(std::size_t index) const
+  {
+    return Position(row(index), column(index));
+  }
+
+  // Re-materialize a full token. The resulting token refers to
+  // the same source buffer as this view.
+  Token token(std::size_t index) const
+  {
+    return Token(begin(index), end(index), offset(index), position(index), type(index), symbol(index));
+  }
+
+private:
+  const char* code_;
+  const CompactToken* tokens_;
+  std::size_t n_;
+  const unsigned int* lines_;
+  std::size_t nLines_;
+  const SymbolId* symbols_;
+};
+
+// Owns a vector of compact tokens, and the table of line start
+// offsets used to map them back to row / column positions. The
+// source code itself is not owned; it must outlive the buffer.
+class TokenBuffer
+{
+public:
+
+  // Offsets and lengths are stored in 32 bits.
+  static std::size_t maxSize() { return 0xFFFFFFFFu; }
+
+  TokenBuffer()
+    : code_(NULL),
+      n_(0)
+  {
+  }
+
+  // Prepare the buffer for tokens drawn from 'code', discarding
+  // any previously stored tokens, and index the line starts.
+  bool reset(const char* code, std::size_t n)
+  {
+    code_ = code;
+    n_ = n;
+    tokens_.clear();
+    lines_.clear();
+    symbols_.clear();
+
+    if (UNLIKELY(n > maxSize()))
+      return false;
+
+    lines_.push_back(0);
+    const char* it = code;
+    const char* end = code + n;
+    while (it < end)
+    {
+      const void* match = std::memchr(it, '\n', end - it);
+      if (match == NULL)
+        break;
+
+      it = static_cast<const char*>(match) + 1;
+      lines_.push_back(static_cast<unsigned int>(it - code));
+    }
+
+    return true;
+  }
+
+  // Fill the buffer with tokens (and the line table) previously
+  // produced from identical code, e.g. as retained in a cache.
+  void assign(const char* code,
+              std::size_t n,
+              const std::vector<CompactToken>& tokens,
+              const std::vector<unsigned int>& lines)
+  {
+    code_ = code;
+    n_ = n;
+    tokens_ = tokens;
+    lines_ = lines;
+    symbols_.clear();
+  }
+
+  // Fill the buffer with the tokens (and line table, and any symbol
+  // ids) of a view over 'n' bytes of code, e.g. as read from a file.
+  void assign(const TokenView& view, std::size_t n)
+  {
+    code_ = view.code();
+    n_ = n;
+    tokens_.assign(view.tokens(), view.tokens() + view.size());
+    lines_.assign(view.lines(), view.lines() + view.lineCount());
+    symbols_.clear();
+    if (view.symbols() != NULL)
+      symbols_.assign(view.symbols(), view.symbols() + view.size());
+  }
+
+  void push_back(const Token& token)
+  {
+    CompactToken compact;
+    compact.offset = static_cast<unsigned int>(token.offset());
+    compact.length = static_cast<unsigned int>(token.size());
+    compact.row    = static_cast<unsigned int>(token.row());
+    compact.type   = token.type();
+    tokens_.push_back(compact);
+
+    // Symbol ids are only stored once a token with an id is seen;
+    // earlier tokens are back-filled with 'NO_SYMBOL'.
+    if (token.symbol() != NO_SYMBOL || !symbols_.empty())
+    {
+      symbols_.resize(tokens_.size() - 1, NO_SYMBOL);
+      symbols_.push_back(token.symbol());
+    }
+  }
+
+  // Intern the name of each symbol and keyword in the buffer,
+  // replacing any previously assigned symbol ids.
+  void intern(SymbolTable* pSymbols)
+  {
+    symbols_.assign(tokens_.size(), NO_SYMBOL);
+    for (std::size_t i = 0; i < tokens_.size(); ++i)
+    {
+      const CompactToken& token = tokens_[i];
+      if (token.type == SYMBOL ||
+          SOURCE_TOOLS_CHECK_MASK(token.type, SOURCE_TOOLS_KEYWORD_MASK))
+      {
+        symbols_[i] = pSymbols->internSymbol(code_ + token.offset, token.length);
+      }
+    }
+  }
+
+  // Re-point the buffer at 'code', after 'removed' bytes at 'offset'
+  // were replaced with 'inserted' bytes, and update the line table
+  // to match. The tokens themselves are left as-is; they are
+  // updated separately with 'splice()'. Returns the change in the
+  // number of lines.
+  std::ptrdiff_t edit(const char* code,
+                      std::size_t n,
+                      std::size_t offset,
+                      std::size_t removed,
+                      std::size_t inserted)
+  {
+    std::ptrdiff_t delta =
+      static_cast<std::ptrdiff_t>(inserted) -
+      static_cast<std::ptrdiff_t>(removed);
+
+    // Lines starting within the removed text are dropped, and
+    // lines starting after it are shifted.
+    std::vector<unsigned int>::iterator first =
+      std::upper_bound(lines_.begin(), lines_.end(), offset);
+    std::vector<unsigned int>::iterator last =
+      std::upper_bound(first, lines_.end(), offset + removed);
+
+    for (std::vector<unsigned int>::iterator it = last; it != lines_.end(); ++it)
+      *it = static_cast<unsigned int>(*it + delta);
+
+    // Index the lines starting within the inserted text.
+    std::vector<unsigned int> starts;
+    const char* begin = code + offset;
+    for (const char* it = begin; it < begin + inserted; ++it)
+      if (*it == '\n')
+        starts.push_back(static_cast<unsigned int>(it - code + 1));
+
+    std::ptrdiff_t rowDelta =
+      static_cast<std::ptrdiff_t>(starts.size()) - (last - first);
+
+    first = lines_.erase(first, last);
+    lines_.insert(first, starts.begin(), starts.end());
+
+    code_ = code;
+    n_ = n;
+    return rowDelta;
+  }
+
+  // Replace the tokens in '[begin, end)' with 'tokens', and shift
+  // the tokens following them by 'offsetDelta' bytes and 'rowDelta'
+  // rows.
+  void splice(std::size_t begin,
+              std::size_t end,
+              const std::vector<Token>& tokens,
+              std::ptrdiff_t offsetDelta,
+              std::ptrdiff_t rowDelta)
+  {
+    for (std::size_t i = end; i < tokens_.size(); ++i)
+    {
+      CompactToken& token = tokens_[i];
+      token.offset = static_cast<unsigned int>(token.offset + offsetDelta);
+      token.row    = static_cast<unsigned int>(token.row + rowDelta);
+    }
+
+    std::vector<CompactToken> compact(tokens.size());
+    std::vector<SymbolId> symbols(tokens.size(), NO_SYMBOL);
+    bool interned = !symbols_.empty();
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+    {
+      const Token& token = tokens[i];
+      compact[i].offset = static_cast<unsigned int>(token.offset());
+      compact[i].length = static_cast<unsigned int>(token.size());
+      compact[i].row    = static_cast<unsigned int>(token.row());
+      compact[i].type   = token.type();
+      symbols[i] = token.symbol();
+      interned = interned || token.symbol() != NO_SYMBOL;
+    }
+
+    if (interned)
+    {
+      symbols_.resize(tokens_.size(), NO_SYMBOL);
+      symbols_.erase(symbols_.begin() + begin, symbols_.begin() + end);
+      symbols_.insert(symbols_.begin() + begin, symbols.begin(), symbols.end());
+    }
+
+    tokens_.erase(tokens_.begin() + begin, tokens_.begin() + end);
+    tokens_.insert(tokens_.begin() + begin, compact.begin(), compact.end());
+  }
+
+  const char* code() const { return code_; }
+  std::size_t codeSize() const { return n_; }
+  std::size_t size() const { return tokens_.size(); }
+  bool empty() const { return tokens_.empty(); }
+
+  const std::vector<CompactToken>& tokens() const { return tokens_; }
+  const std::vector<unsigned int>& lines() const { return lines_; }
+
+  // Empty when no symbols have been interned.
+  const std::vector<SymbolId>& symbols() const { return symbols_; }
+
+  const CompactToken& operator[](std::size_t index) const
+  {
+    return tokens_[index];
+  }
+
+  // NOTE: views are invalidated when the buffer is modified.
+  TokenView view() const
+  {
+    return TokenView(
+      code_,
+      tokens_.empty() ? NULL : &tokens_[0],
+      tokens_.size(),
+      lines_.empty() ? NULL : &lines_[0],
+      lines_.size(),
+      symbols_.empty() ? NULL : &symbols_[0]
+    );
+  }
+
+  operator TokenView() const { return view(); }
+
+  Token token(std::size_t index) const { return view().token(index); }
+
+private:
+  const char* code_;
+  std::size_t n_;
+  std::vector<CompactToken> tokens_;
+  std::vector<unsigned int> lines_;
+  std::vector<SymbolId> symbols_;
+};
+
+} // namespace tokens
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_TOKEN_BUFFER_H */
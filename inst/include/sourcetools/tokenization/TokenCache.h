@@ -0,0 +1,351 @@
+#ifndef SOURCETOOLS_TOKENIZATION_TOKEN_CACHE_H
+#define SOURCETOOLS_TOKENIZATION_TOKEN_CACHE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/tokenization/Registration.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+#include <sourcetools/tokenization/Tokenizer.h>
+
+namespace sourcetools {
+
+// A cache of tokenized code, keyed by a hash of the code itself (and
+// the mask of token types kept), so that code seen before -- e.g. an
+// unchanged file -- need not be tokenized again. Compact tokens and
+// line tables are retained in memory, up to a budget of 'capacity()'
+// bytes with the least recently used entries evicted beyond it, and
+// (when a directory is given) on disk, so that they can be shared
+// between processes.
+//
+// Symbol ids are not cached; they should be interned afterwards, as
+// with 'TokenBuffer::intern()'.
+//
+// NOTE: The cache is not thread-safe.
+class TokenCache : noncopyable
+{
+private:
+  typedef tokens::TokenType TokenType;
+  typedef tokens::TokenBuffer TokenBuffer;
+  typedef tokens::CompactToken CompactToken;
+
+public:
+
+  // Identifies tokenized code by a 64-bit hash of its contents, its
+  // size, and the mask of token types kept.
+  struct Key
+  {
+    unsigned int hash[2];
+    std::size_t size;
+    TokenType mask;
+
+    bool operator<(const Key& other) const
+    {
+      if (hash[0] != other.hash[0]) return hash[0] < other.hash[0];
+      if (hash[1] != other.hash[1]) return hash[1] < other.hash[1];
+      if (size != other.size) return size < other.size;
+      return mask < other.mask;
+    }
+  };
+
+  static Key key(const char* code,
+                 std::size_t n,
+                 TokenType mask = tokens::ALL_TOKENS_MASK)
+  {
+    Key key;
+    key.hash[0] = xxhash32(code, n, 0);
+    key.hash[1] = xxhash32(code, n, 0x9E3779B9u);
+    key.size = n;
+    key.mask = mask;
+    return key;
+  }
+
+  TokenCache()
+    : capacity_(0),
+      size_(0),
+      hits_(0),
+      diskHits_(0),
+      misses_(0),
+      evictions_(0)
+  {
+  }
+
+  // Set the in-memory budget, in bytes, evicting entries to stay
+  // within it.
+  void setCapacity(std::size_t capacity)
+  {
+    capacity_ = capacity;
+    evict(capacity_);
+  }
+
+  // Set the directory in which tokens are also cached on disk; an
+  // empty directory disables the on-disk cache.
+  void setDirectory(const std::string& directory)
+  {
+    directory_ = directory;
+  }
+
+  bool enabled() const
+  {
+    return capacity_ > 0 || !directory_.empty();
+  }
+
+  // Look up the tokens for 'code', whose key is 'key', filling
+  // 'pBuffer' with them on success.
+  bool find(const Key& key, const char* code, TokenBuffer* pBuffer)
+  {
+    if (UNLIKELY(key.size > TokenBuffer::maxSize()))
+      return false;
+
+    std::map<Key, Entries::iterator>::iterator it = index_.find(key);
+    if (it != index_.end())
+    {
+      ++hits_;
+      Entries::iterator entry = it->second;
+      entries_.splice(entries_.begin(), entries_, entry);
+      pBuffer->assign(code, key.size, entry->tokens, entry->lines);
+      return true;
+    }
+
+    Entry entry;
+    if (!directory_.empty() && load(key, &entry))
+    {
+      ++diskHits_;
+      pBuffer->assign(code, key.size, entry.tokens, entry.lines);
+      remember(key, &entry);
+      return true;
+    }
+
+    ++misses_;
+    return false;
+  }
+
+  // Retain the tokens in 'buffer' (produced from code with key 'key').
+  void insert(const Key& key, const TokenBuffer& buffer)
+  {
+    if (!directory_.empty())
+      store(key, buffer);
+
+    Entry entry;
+    entry.tokens = buffer.tokens();
+    entry.lines = buffer.lines();
+    remember(key, &entry);
+  }
+
+  // Tokenize, as with 'tokenize()', through the cache.
+  bool tokenize(const char* code,
+                std::size_t n,
+                TokenBuffer* pBuffer,
+                TokenType mask = tokens::ALL_TOKENS_MASK)
+  {
+    Key key = TokenCache::key(code, n, mask);
+    if (find(key, code, pBuffer))
+      return true;
+
+    if (!sourcetools::tokenize(code, n, pBuffer, NULL, mask))
+      return false;
+
+    insert(key, *pBuffer);
+    return true;
+  }
+
+  // Discard the tokens cached in memory. (Those on disk are kept.)
+  void clear()
+  {
+    evict(0);
+  }
+
+  const std::string& directory() const { return directory_; }
+  std::size_t capacity() const { return capacity_; }
+  std::size_t size() const { return size_; }
+  std::size_t count() const { return entries_.size(); }
+
+  std::size_t hits() const { return hits_; }
+  std::size_t diskHits() const { return diskHits_; }
+  std::size_t misses() const { return misses_; }
+  std::size_t evictions() const { return evictions_; }
+
+private:
+
+  struct Entry
+  {
+    Key key;
+    std::vector<CompactToken> tokens;
+    std::vector<unsigned int> lines;
+
+    std::size_t bytes() const
+    {
+      return
+        tokens.size() * sizeof(CompactToken) +
+        lines.size() * sizeof(unsigned int);
+    }
+  };
+
+  typedef std::list<Entry> Entries;
+
+  // The header of an on-disk cache entry. Entries are written in
+  // native byte order, and are only read back when the header
+  // matches exactly.
+  struct Header
+  {
+    char magic[8];
+    unsigned int tokenSize;
+    unsigned int hash[2];
+    unsigned int size;
+    unsigned int mask;
+    unsigned int tokenCount;
+    unsigned int lineCount;
+  };
+
+  // Bump the version whenever the token representation changes.
+  static const char* magic() { return "SRCTOK01"; }
+
+  // Add an entry to the in-memory cache, taking its contents.
+  void remember(const Key& key, Entry* pEntry)
+  {
+    if (pEntry->bytes() > capacity_ || index_.count(key))
+      return;
+
+    entries_.push_front(Entry());
+    Entry& entry = entries_.front();
+    entry.key = key;
+    entry.tokens.swap(pEntry->tokens);
+    entry.lines.swap(pEntry->lines);
+
+    index_[key] = entries_.begin();
+    size_ += entry.bytes();
+    evict(capacity_);
+  }
+
+  void evict(std::size_t capacity)
+  {
+    while (size_ > capacity && !entries_.empty())
+    {
+      Entries::iterator last = entries_.end();
+      --last;
+      size_ -= last->bytes();
+      index_.erase(last->key);
+      entries_.erase(last);
+      ++evictions_;
+    }
+  }
+
+  std::string path(const Key& key) const
+  {
+    char name[64];
+    std::snprintf(name, sizeof(name), "%08x%08x-%lx-%x.tokens",
+                  key.hash[0],
+                  key.hash[1],
+                  static_cast<unsigned long>(key.size),
+                  static_cast<unsigned int>(key.mask));
+    return directory_ + "/" + name;
+  }
+
+  void header(const Key& key, Header* pHeader) const
+  {
+    std::memset(pHeader, 0, sizeof(Header));
+    std::memcpy(pHeader->magic, magic(), sizeof(pHeader->magic));
+    pHeader->tokenSize = sizeof(CompactToken);
+    pHeader->hash[0] = key.hash[0];
+    pHeader->hash[1] = key.hash[1];
+    pHeader->size = static_cast<unsigned int>(key.size);
+    pHeader->mask = static_cast<unsigned int>(key.mask);
+  }
+
+  bool load(const Key& key, Entry* pEntry) const
+  {
+    std::FILE* file = std::fopen(path(key).c_str(), "rb");
+    if (file == NULL)
+      return false;
+
+    Header expected;
+    header(key, &expected);
+
+    Header actual;
+    bool success =
+      std::fread(&actual, sizeof(Header), 1, file) == 1 &&
+      std::memcmp(&actual, &expected, offsetof(Header, tokenCount)) == 0 &&
+      actual.lineCount > 0;
+
+    if (success)
+    {
+      pEntry->tokens.resize(actual.tokenCount);
+      pEntry->lines.resize(actual.lineCount);
+      success =
+        (actual.tokenCount == 0 ||
+         std::fread(&pEntry->tokens[0], sizeof(CompactToken), actual.tokenCount, file) == actual.tokenCount) &&
+        std::fread(&pEntry->lines[0], sizeof(unsigned int), actual.lineCount, file) == actual.lineCount &&
+        std::fgetc(file) == EOF;
+    }
+
+    std::fclose(file);
+    return success && valid(key, *pEntry);
+  }
+
+  // Check that the tokens and lines of an entry read from disk lie
+  // within the code, so that a corrupt entry cannot be used to read
+  // out of bounds.
+  static bool valid(const Key& key, const Entry& entry)
+  {
+    return tokens::withinCode(entry.tokens.empty() ? NULL : &entry.tokens[0],
+                              entry.tokens.size(),
+                              entry.lines.empty() ? NULL : &entry.lines[0],
+                              entry.lines.size(),
+                              key.size);
+  }
+
+  // Entries are written to a temporary file, and then moved into
+  // place, so that readers never see a partially written entry.
+  // Failures are ignored: the entry simply remains uncached.
+  void store(const Key& key, const TokenBuffer& buffer) const
+  {
+    std::string target = path(key);
+    std::string temporary = utils::temporaryPath(target);
+
+    std::FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (file == NULL)
+      return;
+
+    const std::vector<CompactToken>& tokens = buffer.tokens();
+    const std::vector<unsigned int>& lines = buffer.lines();
+
+    Header header;
+    this->header(key, &header);
+    header.tokenCount = static_cast<unsigned int>(tokens.size());
+    header.lineCount = static_cast<unsigned int>(lines.size());
+
+    bool success =
+      std::fwrite(&header, sizeof(Header), 1, file) == 1 &&
+      (tokens.empty() ||
+       std::fwrite(&tokens[0], sizeof(CompactToken), tokens.size(), file) == tokens.size()) &&
+      (lines.empty() ||
+       std::fwrite(&lines[0], sizeof(unsigned int), lines.size(), file) == lines.size());
+
+    success = std::fclose(file) == 0 && success;
+
+    if (!success || !utils::replaceFile(temporary.c_str(), target.c_str()))
+      std::remove(temporary.c_str());
+  }
+
+private:
+  Entries entries_;
+  std::map<Key, Entries::iterator> index_;
+  std::string directory_;
+  std::size_t capacity_;
+  std::size_t size_;
+  std::size_t hits_;
+  std::size_t diskHits_;
+  std::size_t misses_;
+  std::size_t evictions_;
+};
+
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_TOKEN_CACHE_H */
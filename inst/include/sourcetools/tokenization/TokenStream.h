@@ -0,0 +1,125 @@
+#ifndef SOURCETOOLS_TOKENIZATION_TOKEN_STREAM_H
+#define SOURCETOOLS_TOKENIZATION_TOKEN_STREAM_H
+
+#include <vector>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/SymbolTable.h>
+#include <sourcetools/tokenization/Tokenizer.h>
+
+namespace sourcetools {
+namespace tokenizer {
+
+// A stream of tokens supporting arbitrary lookahead. Tokens that have
+// been scanned but not yet consumed are kept in a ring buffer, so
+// that 'peek()' and 'consume()' are amortized constant time; unlike
+// 'Tokenizer::peek()', nothing is re-tokenized, and the buffer only
+// grows when peeking further ahead than ever before.
+//
+// The stream produces exactly the tokens of the 'tokenize()' loop.
+class TokenStream
+{
+private:
+  typedef tokens::Token Token;
+
+public:
+
+  TokenStream(const char* code,
+              std::size_t n,
+              tokens::SymbolTable* pSymbols = NULL)
+    : tokenizer_(code, n, pSymbols),
+      buffer_(8),
+      head_(0),
+      size_(0),
+      done_(false),
+      end_(tokens::END)
+  {
+  }
+
+  // Peek at an upcoming token, without consuming it: 'peek(1)' is the
+  // token the next call to 'consume()' will produce. As with
+  // 'Tokenizer::peek()', an 'END' token is returned when peeking past
+  // the end of the code. The returned reference is invalidated by
+  // the next call to 'peek()' or 'consume()'.
+  const Token& peek(std::size_t lookahead = 1)
+  {
+    if (UNLIKELY(lookahead == 0 || !fill(lookahead)))
+      return end_;
+
+    return buffer_[(head_ + lookahead - 1) & (buffer_.size() - 1)];
+  }
+
+  // Consume the next token; returns false (with an 'END' token) once
+  // the code is exhausted.
+  bool consume(Token* pToken)
+  {
+    if (UNLIKELY(!fill(1)))
+    {
+      *pToken = end_;
+      return false;
+    }
+
+    *pToken = buffer_[head_];
+    head_ = (head_ + 1) & (buffer_.size() - 1);
+    --size_;
+    return true;
+  }
+
+  bool atEnd()
+  {
+    return !fill(1);
+  }
+
+private:
+
+  // Ensure that at least 'count' tokens are buffered, returning
+  // false if the code runs out first.
+  bool fill(std::size_t count)
+  {
+    while (size_ < count)
+    {
+      if (done_)
+        return false;
+
+      if (size_ == buffer_.size())
+        grow();
+
+      Token& slot = buffer_[(head_ + size_) & (buffer_.size() - 1)];
+      if (!tokenizer_.tokenize(&slot))
+      {
+        done_ = true;
+        return false;
+      }
+
+      ++size_;
+    }
+
+    return true;
+  }
+
+  // Double the capacity (always a power of two), unwrapping the
+  // buffered tokens to the front of the new buffer.
+  void grow()
+  {
+    std::vector<Token> buffer(2 * buffer_.size());
+    for (std::size_t i = 0; i < size_; ++i)
+      buffer[i] = buffer_[(head_ + i) & (buffer_.size() - 1)];
+
+    buffer_.swap(buffer);
+    head_ = 0;
+  }
+
+private:
+  Tokenizer tokenizer_;
+  std::vector<Token> buffer_;
+  std::size_t head_;
+  std::size_t size_;
+  bool done_;
+  Token end_;
+};
+
+} // namespace tokenizer
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_TOKEN_STREAM_H */
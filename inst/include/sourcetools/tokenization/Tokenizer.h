@@ -3,15 +3,80 @@
 
 #include <sourcetools/core/core.h>
 #include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+#include <sourcetools/tokenization/SymbolTable.h>
+#include <sourcetools/tokenization/TokenizerTables.h>
 #include <sourcetools/cursor/TextCursor.h>
 
+#include <cstring>
+
 #include <vector>
-#include <stack>
+#include <algorithm>
 #include <sstream>
 
 namespace sourcetools {
 namespace tokenizer {
 
+namespace detail {
+
+// Find the first (optionally, unescaped) instance of 'ch' in the
+// range '[begin, end)', returning 'end' if no such character exists.
+// 'std::memchr()' is used to scan for both the terminator and any
+// escapes, as it is typically vectorized by the C library, rather
+// than stepping a 'TextCursor' over each character.
+template <bool SkipEscaped>
+inline const char* findTerminator(const char* begin,
+                                  const char* end,
+                                  char ch)
+{
+  const char* it = begin;
+  while (it < end)
+  {
+    const char* match =
+      static_cast<const char*>(std::memchr(it, ch, end - it));
+
+    if (match == NULL)
+      return end;
+
+    if (!SkipEscaped)
+      return match;
+
+    // Skip over any escapes preceding the candidate terminator.
+    // If the candidate terminator was itself escaped, search for
+    // the next one following it.
+    const char* escape;
+    while ((escape = static_cast<const char*>(std::memchr(it, '\\', match - it))))
+    {
+      it = escape + 2;
+      if (it > match)
+        break;
+    }
+
+    if (it <= match)
+      return match;
+  }
+
+  return end;
+}
+
+} // namespace detail
+
+// Tags used to select a tokenizer backend. The chained backend
+// dispatches on the leading character of a token through a chain
+// of comparisons; the table backend instead looks up the class of
+// that character in a 256-entry table, and matches fixed-length
+// operators against a table of candidates built from the operator
+// registrations. Define 'SOURCE_TOOLS_TOKENIZER_TABLE_BACKEND' to
+// make the table backend the default.
+struct ChainedBackend {};
+struct TableBackend {};
+
+#ifdef SOURCE_TOOLS_TOKENIZER_TABLE_BACKEND
+typedef TableBackend DefaultBackend;
+#else
+typedef ChainedBackend DefaultBackend;
+#endif
+
 class Tokenizer
 {
 private:
@@ -36,33 +101,16 @@ private:
                     TokenType type,
                     Token* pToken)
   {
-    TextCursor lookahead = cursor_;
-
-    bool success = false;
-    std::size_t distance = 0;
-
-    while (lookahead != lookahead.end()) {
-      lookahead.advance();
-      ++distance;
-
-      if (SkipEscaped && lookahead.peek() == '\\') {
-        lookahead.advance();
-        ++distance;
-        continue;
-      }
+    const char* begin = cursor_;
+    const char* end = cursor_.end();
+    const char* it = detail::findTerminator<SkipEscaped>(begin + 1, end, ch);
 
-      if (lookahead.peek() == ch) {
-        success = true;
-        break;
-      }
-    }
-
-    if (success) {
-      consumeToken(type, distance + 1, pToken);
+    if (it != end) {
+      consumeToken(type, it - begin + 1, pToken);
     } else {
       consumeToken(
         InvalidOnError ? tokens::INVALID : type,
-        distance,
+        end - begin,
         pToken
       );
     }
@@ -81,6 +129,8 @@ private:
   void consumeQuotedSymbol(Token* pToken)
   {
     consumeUntil<true, true>('`', tokens::SYMBOL, pToken);
+    if (pSymbols_ != NULL && pToken->isType(tokens::SYMBOL))
+      pToken->setSymbol(pSymbols_->internSymbol(pToken->begin(), pToken->size()));
   }
 
   void consumeQString(Token* pToken)
@@ -214,6 +264,95 @@ private:
     consumeToken(success ? tokens::NUMBER : tokens::INVALID, distance, pToken);
   }
 
+  void consumeLeftBracket(Token* pToken)
+  {
+    if (cursor_.peek(1) == '[') {
+      tokenStack_.push_back(tokens::LDBRACKET);
+      consumeToken(tokens::LDBRACKET, 2, pToken);
+    } else {
+      tokenStack_.push_back(tokens::LBRACKET);
+      consumeToken(tokens::LBRACKET, 1, pToken);
+    }
+  }
+
+  void consumeRightBracket(Token* pToken)
+  {
+    if (tokenStack_.empty()) {
+      consumeToken(tokens::INVALID, 1, pToken);
+    } else if (tokenStack_.back() == tokens::LDBRACKET) {
+      tokenStack_.pop_back();
+      if (cursor_.peek(1) == ']')
+        consumeToken(tokens::RDBRACKET, 2, pToken);
+      else
+        consumeToken(tokens::INVALID, 1, pToken);
+    } else {
+      tokenStack_.pop_back();
+      consumeToken(tokens::RBRACKET, 1, pToken);
+    }
+  }
+
+  // NOTE: the cursor is bounds-checked here, as the code being
+  // tokenized need not be NUL-terminated (e.g. a memory-mapped file).
+  void consumeWhitespace(Token* pToken)
+  {
+    std::size_t distance = 1;
+    while (utils::isWhitespace(cursor_.peek(distance)))
+      ++distance;
+
+    consumeToken(tokens::WHITESPACE, distance, pToken);
+  }
+
+  void consumeOperator(const detail::TokenizerTables& tables,
+                       Token* pToken)
+  {
+    char ch = cursor_.peek();
+    const detail::OperatorEntry* it = tables.operatorsBegin(ch);
+    const detail::OperatorEntry* end = tables.operatorsEnd(ch);
+
+    // Candidates are ordered from longest to shortest, so the
+    // first match is the longest match.
+    for (; it != end; ++it)
+    {
+      std::size_t i = 1;
+      while (i < it->length && cursor_.peek(i) == it->string[i])
+        ++i;
+
+      if (i == it->length)
+      {
+        consumeToken(it->type, it->length, pToken);
+        return;
+      }
+    }
+
+    consumeToken(tokens::INVALID, 1, pToken);
+  }
+
+  void consumeSymbol(std::size_t distance, Token* pToken)
+  {
+    const char* ptr = &*(cursor_.begin() + cursor_.offset());
+    if (pSymbols_ == NULL)
+    {
+      consumeToken(tokens::symbolType(ptr, distance), distance, pToken);
+      return;
+    }
+
+    // Keywords are registered in the symbol table up front, so
+    // interning the symbol also determines its type.
+    tokens::SymbolId id = pSymbols_->intern(ptr, distance);
+    consumeToken(pSymbols_->type(id), distance, pToken);
+    pToken->setSymbol(id);
+  }
+
+  void consumeSymbol(const detail::TokenizerTables& tables,
+                     Token* pToken)
+  {
+    std::size_t distance = 1;
+    while (tables.isValidForSymbol(cursor_.peek(distance)))
+      ++distance;
+
+    consumeSymbol(distance, pToken);
+  }
+
   void consumeSymbol(Token* pToken)
   {
     std::size_t distance = 1;
@@ -223,18 +362,109 @@ private:
       ch = cursor_.peek(distance);
     }
 
-    const char* ptr = &*(cursor_.begin() + cursor_.offset());
-    consumeToken(tokens::symbolType(ptr, distance), distance, pToken);
+    consumeSymbol(distance, pToken);
   }
 
 public:
 
-  Tokenizer(const char* code, std::size_t n)
-    : cursor_(code, n)
+  // When a symbol table is supplied, the names of symbols and
+  // keywords are interned as they are tokenized.
+  Tokenizer(const char* code,
+            std::size_t n,
+            tokens::SymbolTable* pSymbols = NULL)
+    : cursor_(code, n),
+      pSymbols_(pSymbols)
   {
   }
 
+  // Resume tokenization from a checkpoint: a token boundary at
+  // 'offset' (with the given row and column), where the brackets
+  // in 'brackets' were open.
+  Tokenizer(const char* code,
+            std::size_t n,
+            std::size_t offset,
+            const collections::Position& position,
+            const std::vector<TokenType>& brackets,
+            tokens::SymbolTable* pSymbols = NULL)
+    : cursor_(code, n, offset, position),
+      tokenStack_(brackets),
+      pSymbols_(pSymbols)
+  {
+  }
+
+  // The tokenizer's state, as needed to checkpoint it: the offset
+  // (and position) of the next token, and the stack of open '[' and
+  // '[[' brackets.
+  std::size_t offset() const { return cursor_.offset(); }
+  const collections::Position& position() const { return cursor_.position(); }
+  const std::vector<TokenType>& brackets() const { return tokenStack_; }
+
   bool tokenize(Token* pToken)
+  {
+    return tokenize(pToken, DefaultBackend());
+  }
+
+  bool tokenize(Token* pToken, TableBackend)
+  {
+    if (cursor_ >= cursor_.end())
+    {
+      *pToken = Token(tokens::END);
+      return false;
+    }
+
+    const detail::TokenizerTables& tables = detail::tables();
+
+    char ch = cursor_.peek();
+    switch (tables.characterClass(ch))
+    {
+    case detail::CLASS_OPERATOR:
+      consumeOperator(tables, pToken);
+      break;
+    case detail::CLASS_WHITESPACE:
+      consumeWhitespace(pToken);
+      break;
+    case detail::CLASS_SYMBOL:
+      consumeSymbol(tables, pToken);
+      break;
+    case detail::CLASS_DIGIT:
+      consumeNumber(pToken);
+      break;
+    case detail::CLASS_DOT:
+      if (utils::isDigit(cursor_.peek(1)))
+        consumeNumber(pToken);
+      else
+        consumeSymbol(tables, pToken);
+      break;
+    case detail::CLASS_STRING:
+      if (ch == '"')
+        consumeQQString(pToken);
+      else
+        consumeQString(pToken);
+      break;
+    case detail::CLASS_QUOTED_SYMBOL:
+      consumeQuotedSymbol(pToken);
+      break;
+    case detail::CLASS_COMMENT:
+      consumeComment(pToken);
+      break;
+    case detail::CLASS_USER_OPERATOR:
+      consumeUserOperator(pToken);
+      break;
+    case detail::CLASS_LEFT_BRACKET:
+      consumeLeftBracket(pToken);
+      break;
+    case detail::CLASS_RIGHT_BRACKET:
+      consumeRightBracket(pToken);
+      break;
+    default:
+      consumeToken(tokens::INVALID, 1, pToken);
+      break;
+    }
+
+    return true;
+  }
+
+  bool tokenize(Token* pToken, ChainedBackend)
   {
     if (cursor_ >= cursor_.end())
     {
@@ -243,7 +473,6 @@ public:
     }
 
     char ch = cursor_.peek();
-    int n = 0;
 
     // Block-related tokens
     if (ch == '{')
@@ -254,28 +483,10 @@ public:
       consumeToken(tokens::LPAREN, 1, pToken);
     else if (ch == ')')
       consumeToken(tokens::RPAREN, 1, pToken);
-    else if (ch == '[') {
-      if (cursor_.peek(1) == '[') {
-        tokenStack_.push(tokens::LDBRACKET);
-        consumeToken(tokens::LDBRACKET, 2, pToken);
-      } else {
-        tokenStack_.push(tokens::LBRACKET);
-        consumeToken(tokens::LBRACKET, 1, pToken);
-      }
-    } else if (ch == ']') {
-      if (tokenStack_.empty()) {
-        consumeToken(tokens::INVALID, 1, pToken);
-      } else if (tokenStack_.top() == tokens::LDBRACKET) {
-        tokenStack_.pop();
-        if (cursor_.peek(1) == ']')
-          consumeToken(tokens::RDBRACKET, 2, pToken);
-        else
-          consumeToken(tokens::INVALID, 1, pToken);
-      } else {
-        tokenStack_.pop();
-        consumeToken(tokens::RBRACKET, 1, pToken);
-      }
-    }
+    else if (ch == '[')
+      consumeLeftBracket(pToken);
+    else if (ch == ']')
+      consumeRightBracket(pToken);
 
     // Operators
     else if (ch == '<')  // <<-, <=, <-, <
@@ -385,8 +596,8 @@ public:
       consumeToken(tokens::SEMI, 1, pToken);
 
     // Whitespace
-    else if (utils::countWhitespaceBytes(cursor_, &n))
-      consumeToken(tokens::WHITESPACE, n, pToken);
+    else if (utils::isWhitespace(ch))
+      consumeWhitespace(pToken);
 
     // Strings and symbols
     else if (ch == '\'')
@@ -415,6 +626,9 @@ public:
     return true;
   }
 
+  // NOTE: This copies the tokenizer, and re-tokenizes up to the
+  // requested token on each call; prefer a 'TokenStream' when
+  // peeking repeatedly.
   Token peek(std::size_t lookahead = 1)
   {
     Tokenizer clone(*this);
@@ -431,31 +645,376 @@ public:
 
 private:
   TextCursor cursor_;
-  std::stack<TokenType, std::vector<TokenType> > tokenStack_;
+  std::vector<TokenType> tokenStack_;
+  tokens::SymbolTable* pSymbols_;
 };
 
 } // namespace tokenizer
 
-inline std::vector<tokens::Token> tokenize(const char* code, std::size_t n)
+namespace tokenizer {
+namespace detail {
+
+// Writes tokens through an output iterator.
+template <typename OutputIterator>
+class TokenCopier
+{
+public:
+
+  explicit TokenCopier(OutputIterator output)
+    : output_(output)
+  {
+  }
+
+  void operator()(const tokens::Token& token)
+  {
+    *output_++ = token;
+  }
+
+  OutputIterator output() const { return output_; }
+
+private:
+  OutputIterator output_;
+};
+
+// Appends tokens to a vector.
+class TokenAppender
+{
+public:
+
+  explicit TokenAppender(std::vector<tokens::Token>* pTokens)
+    : pTokens_(pTokens)
+  {
+  }
+
+  void operator()(const tokens::Token& token)
+  {
+    pTokens_->push_back(token);
+  }
+
+private:
+  std::vector<tokens::Token>* pTokens_;
+};
+
+} // namespace detail
+} // namespace tokenizer
+
+// Tokenize R code, invoking 'f(token)' for each token matching
+// 'mask' as it is scanned, so that tokens can be counted, filtered or
+// stored without first being collected. Returns (a copy of) 'f', as
+// with 'std::for_each()'.
+template <typename F>
+inline F forEachToken(const char* code,
+                      std::size_t n,
+                      F f,
+                      tokens::TokenType mask = tokens::ALL_TOKENS_MASK)
 {
   typedef tokenizer::Tokenizer Tokenizer;
   typedef tokens::Token Token;
 
-  std::vector<Token> tokens;
   if (n == 0)
-    return tokens;
+    return f;
 
+  SOURCETOOLS_STATS_TIMER(timer, STAGE_TOKENIZE);
+
+  std::size_t count = 0;
   Token token;
   Tokenizer tokenizer(code, n);
   while (tokenizer.tokenize(&token))
-    tokens.push_back(token);
+  {
+    if (tokens::matchesMask(token.type(), mask))
+    {
+      f(token);
+      ++count;
+    }
+  }
 
+  SOURCETOOLS_STATS_ADD(COUNTER_TOKENS, count);
+  return f;
+}
+
+template <typename F>
+inline F forEachToken(const std::string& code,
+                      F f,
+                      tokens::TokenType mask = tokens::ALL_TOKENS_MASK)
+{
+  return forEachToken(code.data(), code.size(), f, mask);
+}
+
+// Tokenize R code, writing the tokens matching 'mask' through the
+// output iterator 'output'. Returns the iterator past the last token
+// written, as with 'std::copy()'.
+template <typename OutputIterator>
+inline OutputIterator copyTokens(const char* code,
+                                 std::size_t n,
+                                 OutputIterator output,
+                                 tokens::TokenType mask = tokens::ALL_TOKENS_MASK)
+{
+  tokenizer::detail::TokenCopier<OutputIterator> copier(output);
+  return forEachToken(code, n, copier, mask).output();
+}
+
+// Tokenize R code into 'pTokens', replacing its contents. The
+// vector's capacity is kept, so that a vector re-used across calls
+// is only grown when the code has more tokens than seen before; it
+// is initially reserved from a guess at the number of tokens, going
+// by their typical size.
+inline void tokenizeInto(const char* code,
+                         std::size_t n,
+                         std::vector<tokens::Token>* pTokens,
+                         tokens::TokenType mask = tokens::ALL_TOKENS_MASK)
+{
+  pTokens->clear();
+  pTokens->reserve(n / 8 + 1);
+
+  tokenizer::detail::TokenAppender appender(pTokens);
+  forEachToken(code, n, appender, mask);
+}
+
+inline void tokenizeInto(const std::string& code,
+                         std::vector<tokens::Token>* pTokens,
+                         tokens::TokenType mask = tokens::ALL_TOKENS_MASK)
+{
+  tokenizeInto(code.data(), code.size(), pTokens, mask);
+}
+
+// Tokenize R code. Only tokens matching 'mask' (a set of token
+// categories; see 'tokens::matchesMask()') are returned, although
+// all tokens are still scanned.
+inline std::vector<tokens::Token> tokenize(const char* code,
+                                           std::size_t n,
+                                           tokens::TokenType mask = tokens::ALL_TOKENS_MASK)
+{
+  std::vector<tokens::Token> tokens;
+  tokenizeInto(code, n, &tokens, mask);
   return tokens;
 }
 
-inline std::vector<tokens::Token> tokenize(const std::string& code)
+inline std::vector<tokens::Token> tokenize(const std::string& code,
+                                           tokens::TokenType mask = tokens::ALL_TOKENS_MASK)
+{
+  return tokenize(code.data(), code.size(), mask);
+}
+
+// Tokenize into a compact token buffer, optionally interning symbols
+// into 'pSymbols', and keeping only the tokens matching 'mask'.
+// Returns false if the code is too large to be indexed with 32-bit
+// offsets.
+inline bool tokenize(const char* code,
+                     std::size_t n,
+                     tokens::TokenBuffer* pBuffer,
+                     tokens::SymbolTable* pSymbols = NULL,
+                     tokens::TokenType mask = tokens::ALL_TOKENS_MASK)
+{
+  typedef tokenizer::Tokenizer Tokenizer;
+  typedef tokens::Token Token;
+
+  if (!pBuffer->reset(code, n))
+    return false;
+
+  if (n == 0)
+    return true;
+
+  SOURCETOOLS_STATS_TIMER(timer, STAGE_TOKENIZE);
+
+  Token token;
+  Tokenizer tokenizer(code, n, pSymbols);
+  while (tokenizer.tokenize(&token))
+    if (tokens::matchesMask(token.type(), mask))
+      pBuffer->push_back(token);
+
+  SOURCETOOLS_STATS_ADD(COUNTER_TOKENS, pBuffer->size());
+  return true;
+}
+
+inline bool tokenize(const std::string& code,
+                     tokens::TokenBuffer* pBuffer,
+                     tokens::SymbolTable* pSymbols = NULL,
+                     tokens::TokenType mask = tokens::ALL_TOKENS_MASK)
+{
+  return tokenize(code.data(), code.size(), pBuffer, pSymbols, mask);
+}
+
+namespace tokenizer {
+namespace detail {
+
+// The tokenizer looks at most this many characters past the end of
+// a token when deciding where that token ends (e.g. '<' is only
+// known not to begin '<<-' after peeking two characters ahead).
+static const std::size_t LOOKAHEAD = 2;
+
+// Replay the effect of a token on the stack of open brackets, as
+// the tokenizer would have applied it. 'ch' is the first character
+// of the token; it is only consulted for invalid tokens while a
+// bracket is open, and a NUL character implies it is unknown.
+// Returns false if the stack could not be determined.
+inline bool replayBrackets(std::vector<tokens::TokenType>* pStack,
+                           tokens::TokenType type,
+                           char ch)
+{
+  if (type == tokens::LBRACKET || type == tokens::LDBRACKET)
+    pStack->push_back(type);
+  else if (type == tokens::RBRACKET || type == tokens::RDBRACKET)
+    pStack->pop_back();
+  else if (type == tokens::INVALID && !pStack->empty())
+  {
+    // A ']' closing '[[' without a second ']' is invalid, but
+    // still pops the stack.
+    if (ch == '\0')
+      return false;
+    if (ch == ']')
+      pStack->pop_back();
+  }
+
+  return true;
+}
+
+// Whether the tokenizer started the token at 'index' right where
+// the previous token ended.
+inline bool isBoundary(const std::vector<tokens::CompactToken>& tokens,
+                       std::size_t index)
+{
+  if (index == 0)
+    return tokens[0].offset == 0;
+
+  const tokens::CompactToken& previous = tokens[index - 1];
+  return previous.offset + previous.length == tokens[index].offset;
+}
+
+} // namespace detail
+} // namespace tokenizer
+
+// Update a token buffer after an edit replaced 'removed' bytes at
+// 'offset' with 'inserted' bytes, producing the 'n' bytes of 'code'.
+//
+// Tokenization restarts from the last token boundary that the edit
+// cannot have affected, with the bracket stack recovered by replaying
+// the (unchanged) preceding tokens. It stops as soon as, past the
+// edit, the tokenizer reaches the start of an old token with the same
+// bracket stack; from there on the old tokens are still valid, and
+// are just shifted to their new offsets and rows.
+//
+// The buffer must hold all the tokens of the code prior to the edit
+// (i.e. it must not have been filtered with a mask). Only the code
+// before and after the edited region needs to have been preserved,
+// as it is in 'code'. Returns false if the edit is inconsistent with
+// the buffer, or the code is too large to be indexed with 32-bit
+// offsets.
+inline bool retokenize(const char* code,
+                       std::size_t n,
+                       std::size_t offset,
+                       std::size_t removed,
+                       std::size_t inserted,
+                       tokens::TokenBuffer* pBuffer,
+                       tokens::SymbolTable* pSymbols = NULL)
+{
+  typedef tokenizer::Tokenizer Tokenizer;
+  typedef tokens::Token Token;
+  typedef tokens::TokenType TokenType;
+  typedef tokens::CompactToken CompactToken;
+
+  std::size_t size = pBuffer->codeSize();
+  if (UNLIKELY(pBuffer->lines().empty()))
+    return false;
+
+  if (UNLIKELY(offset > size || removed > size - offset))
+    return false;
+
+  if (UNLIKELY(n != size - removed + inserted || n > tokens::TokenBuffer::maxSize()))
+    return false;
+
+  std::ptrdiff_t delta =
+    static_cast<std::ptrdiff_t>(inserted) -
+    static_cast<std::ptrdiff_t>(removed);
+
+  const std::vector<CompactToken>& old = pBuffer->tokens();
+
+  // Find the checkpoint: the first token whose extent (including the
+  // characters peeked at past its end) reaches the edit.
+  std::size_t checkpoint = 0;
+  std::size_t upper = old.size();
+  while (checkpoint < upper)
+  {
+    std::size_t middle = checkpoint + (upper - checkpoint) / 2;
+    const CompactToken& token = old[middle];
+    if (token.offset + token.length + tokenizer::detail::LOOKAHEAD > offset)
+      upper = middle;
+    else
+      checkpoint = middle + 1;
+  }
+
+  // Tokens are not necessarily contiguous (e.g. an invalid '0x' is
+  // not emitted); only restart where the previous token ended.
+  while (checkpoint > 0 && !tokenizer::detail::isBoundary(old, checkpoint))
+    --checkpoint;
+
+  // Recover the bracket stack at the checkpoint. This only scans the
+  // types of the preceding tokens, which is cheap next to tokenizing.
+  std::vector<TokenType> brackets;
+  for (std::size_t i = 0; i < checkpoint; ++i)
+    tokenizer::detail::replayBrackets(&brackets, old[i].type, code[old[i].offset]);
+
+  std::size_t start = checkpoint > 0 ? old[checkpoint].offset : 0;
+  std::size_t row = checkpoint > 0 ? old[checkpoint].row : 0;
+  std::ptrdiff_t rowDelta = pBuffer->edit(code, n, offset, removed, inserted);
+  collections::Position position(row, start - pBuffer->lines()[row]);
+
+  // Tokenize until the stream re-synchronizes with the old tokens.
+  // 'next' indexes the old token that the tokenizer is approaching,
+  // with 'stack' being the bracket stack prior to that token.
+  std::size_t next = checkpoint;
+  std::vector<TokenType> stack = brackets;
+  bool known = true;
+
+  std::vector<Token> tokens;
+  Tokenizer tokenizer(code, n, start, position, brackets, pSymbols);
+  Token token;
+  while (tokenizer.tokenize(&token))
+  {
+    tokens.push_back(token);
+
+    std::size_t current = tokenizer.offset();
+    std::ptrdiff_t target = static_cast<std::ptrdiff_t>(current) - delta;
+    while (known && next < old.size() &&
+           static_cast<std::ptrdiff_t>(old[next].offset) < target)
+    {
+      // The first character of an old token is known unless it
+      // lies within the removed text.
+      std::size_t begin = old[next].offset;
+      char ch = '\0';
+      if (begin < offset)
+        ch = code[begin];
+      else if (begin >= offset + removed)
+        ch = code[begin + delta];
+
+      known = tokenizer::detail::replayBrackets(&stack, old[next].type, ch);
+      ++next;
+    }
+
+    if (!known || next == old.size())
+      continue;
+
+    if (old[next].offset >= offset + removed &&
+        static_cast<std::ptrdiff_t>(old[next].offset) == target &&
+        tokenizer::detail::isBoundary(old, next) &&
+        tokenizer.brackets() == stack)
+    {
+      pBuffer->splice(checkpoint, next, tokens, delta, rowDelta);
+      return true;
+    }
+  }
+
+  pBuffer->splice(checkpoint, old.size(), tokens, delta, rowDelta);
+  return true;
+}
+
+inline bool retokenize(const std::string& code,
+                       std::size_t offset,
+                       std::size_t removed,
+                       std::size_t inserted,
+                       tokens::TokenBuffer* pBuffer,
+                       tokens::SymbolTable* pSymbols = NULL)
 {
-  return tokenize(code.data(), code.size());
+  return retokenize(code.data(), code.size(), offset, removed, inserted, pBuffer, pSymbols);
 }
 
 } // namespace sourcetools
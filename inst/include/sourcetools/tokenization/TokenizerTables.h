@@ -0,0 +1,196 @@
+#ifndef SOURCETOOLS_TOKENIZATION_TOKENIZER_TABLES_H
+#define SOURCETOOLS_TOKENIZATION_TOKENIZER_TABLES_H
+
+#include <cstring>
+
+#include <vector>
+#include <algorithm>
+
+#include <sourcetools/core/core.h>
+#include <sourcetools/tokenization/Registration.h>
+
+namespace sourcetools {
+namespace tokenizer {
+namespace detail {
+
+// The class of a character, in terms of the kind of token
+// that character can start.
+enum CharacterClass
+{
+  CLASS_INVALID,
+  CLASS_WHITESPACE,
+  CLASS_DIGIT,
+  CLASS_DOT,
+  CLASS_SYMBOL,
+  CLASS_STRING,
+  CLASS_QUOTED_SYMBOL,
+  CLASS_COMMENT,
+  CLASS_USER_OPERATOR,
+  CLASS_OPERATOR,
+  CLASS_LEFT_BRACKET,
+  CLASS_RIGHT_BRACKET
+};
+
+struct OperatorEntry
+{
+  const char* string;
+  std::size_t length;
+  tokens::TokenType type;
+};
+
+class TokenizerTables
+{
+private:
+  typedef tokens::TokenType TokenType;
+
+  // Characters that can appear within (but not necessarily
+  // start) a symbol are flagged in the upper bit.
+  static const unsigned char SYMBOL_BIT = 0x80;
+
+public:
+
+  TokenizerTables()
+  {
+    std::memset(classes_, CLASS_INVALID, sizeof(classes_));
+    std::memset(begin_, 0, sizeof(begin_));
+    std::memset(end_, 0, sizeof(end_));
+
+    // Register operators, alongside the other fixed-length
+    // tokens that are not tracked on the bracket stack. User
+    // operators ('%%') are scanned separately.
+#define SOURCE_TOOLS_TABLE_OPERATOR(__NAME__, __STRING__, __INDEX__)   \
+    addOperator(__STRING__, tokens::OPERATOR_ ## __NAME__);
+
+    SOURCE_TOOLS_OPERATORS(SOURCE_TOOLS_TABLE_OPERATOR,
+                           SOURCE_TOOLS_TABLE_OPERATOR)
+
+#undef SOURCE_TOOLS_TABLE_OPERATOR
+
+    addOperator("(", tokens::LPAREN);
+    addOperator(")", tokens::RPAREN);
+    addOperator("{", tokens::LBRACE);
+    addOperator("}", tokens::RBRACE);
+    addOperator(",", tokens::COMMA);
+    addOperator(";", tokens::SEMI);
+
+    // Order operators sharing a leading character from longest
+    // to shortest, so that the first match is the longest match.
+    std::sort(operators_.begin(), operators_.end(), compareOperators);
+    for (std::size_t i = 0; i < operators_.size(); ++i)
+    {
+      unsigned char ch = operators_[i].string[0];
+      if (begin_[ch] == end_[ch])
+        begin_[ch] = i;
+      end_[ch] = i + 1;
+      classes_[ch] = CLASS_OPERATOR;
+    }
+
+    for (int i = 0; i < 256; ++i)
+    {
+      char ch = static_cast<char>(i);
+      unsigned char& entry = classes_[i];
+
+      if (utils::isWhitespace(ch))
+        entry = CLASS_WHITESPACE;
+      else if (utils::isDigit(ch))
+        entry = CLASS_DIGIT;
+      else if (ch == '.')
+        entry = CLASS_DOT;
+      else if (utils::isValidForStartOfRSymbol(ch))
+        entry = CLASS_SYMBOL;
+      else if (ch == '\'' || ch == '"')
+        entry = CLASS_STRING;
+      else if (ch == '`')
+        entry = CLASS_QUOTED_SYMBOL;
+      else if (ch == '#')
+        entry = CLASS_COMMENT;
+      else if (ch == '%')
+        entry = CLASS_USER_OPERATOR;
+      else if (ch == '[')
+        entry = CLASS_LEFT_BRACKET;
+      else if (ch == ']')
+        entry = CLASS_RIGHT_BRACKET;
+
+      if (utils::isValidForRSymbol(ch))
+        entry |= SYMBOL_BIT;
+    }
+  }
+
+  CharacterClass characterClass(char ch) const
+  {
+    return static_cast<CharacterClass>(
+      classes_[static_cast<unsigned char>(ch)] & ~SYMBOL_BIT);
+  }
+
+  bool isValidForSymbol(char ch) const
+  {
+    return (classes_[static_cast<unsigned char>(ch)] & SYMBOL_BIT) != 0;
+  }
+
+  // The operators beginning with 'ch', from longest to shortest.
+  const OperatorEntry* operatorsBegin(char ch) const
+  {
+    return &operators_[0] + begin_[static_cast<unsigned char>(ch)];
+  }
+
+  const OperatorEntry* operatorsEnd(char ch) const
+  {
+    return &operators_[0] + end_[static_cast<unsigned char>(ch)];
+  }
+
+private:
+
+  void addOperator(const char* string, TokenType type)
+  {
+    // User operators are scanned until their closing '%'.
+    if (string[0] == '%')
+      return;
+
+    OperatorEntry entry;
+    entry.string = string;
+    entry.length = std::strlen(string);
+    entry.type = type;
+    operators_.push_back(entry);
+  }
+
+  static bool compareOperators(const OperatorEntry& lhs,
+                               const OperatorEntry& rhs)
+  {
+    if (lhs.string[0] != rhs.string[0])
+      return lhs.string[0] < rhs.string[0];
+    return lhs.length > rhs.length;
+  }
+
+private:
+  unsigned char classes_[256];
+  unsigned char begin_[256];
+  unsigned char end_[256];
+  std::vector<OperatorEntry> operators_;
+};
+
+// NOTE: C++98 cannot inspect the registered operator strings in
+// a constant expression, so the tables are generated from the
+// registrations at load time. They are held at namespace scope (as
+// the static member of a class template, so that the header can be
+// included in several translation units), rather than as a local
+// static: before C++11, a local static's initialization is not
+// thread-safe, and the tables are first used on worker threads.
+template <typename T>
+struct TokenizerTablesHolder
+{
+  static const TokenizerTables instance;
+};
+
+template <typename T>
+const TokenizerTables TokenizerTablesHolder<T>::instance;
+
+inline const TokenizerTables& tables()
+{
+  return TokenizerTablesHolder<void>::instance;
+}
+
+} // namespace detail
+} // namespace tokenizer
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_TOKENIZATION_TOKENIZER_TABLES_H */
@@ -2,7 +2,18 @@
 #define SOURCETOOLS_TOKENIZATION_TOKENIZATION_H
 
 #include <sourcetools/tokenization/Registration.h>
+#include <sourcetools/tokenization/SymbolTable.h>
 #include <sourcetools/tokenization/Token.h>
+#include <sourcetools/tokenization/TokenBuffer.h>
+#include <sourcetools/tokenization/BracketTable.h>
+#include <sourcetools/tokenization/LineTable.h>
+#include <sourcetools/tokenization/SkipTable.h>
+#include <sourcetools/tokenization/StringDecoder.h>
+#include <sourcetools/tokenization/ColumnTable.h>
 #include <sourcetools/tokenization/Tokenizer.h>
+#include <sourcetools/tokenization/TokenStream.h>
+#include <sourcetools/tokenization/ChunkedTokenizer.h>
+#include <sourcetools/tokenization/TokenCache.h>
+#include <sourcetools/tokenization/ParallelTokenizer.h>
 
 #endif /* SOURCETOOLS_TOKENIZATION_TOKENIZATION_H */
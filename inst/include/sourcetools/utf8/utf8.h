@@ -2,6 +2,7 @@
 #define SOURCETOOLS_UTF8_UTF8_H
 
 #include <cstddef>
+#include <cstring>
 
 #include <sourcetools/core/core.h>
 
@@ -20,6 +21,136 @@ static const unsigned char mask[] = {
 };
 } // namespace detail
 
+// Encode a code point as UTF-8, into 'output' (which must have room
+// for four bytes). Returns the number of bytes written, or zero for
+// surrogates and values beyond the range of Unicode.
+inline std::size_t encode(unsigned int value, char* output)
+{
+  if (value < 0x80)
+  {
+    output[0] = static_cast<char>(value);
+    return 1;
+  }
+  else if (value < 0x800)
+  {
+    output[0] = static_cast<char>(0xC0 | (value >> 6));
+    output[1] = static_cast<char>(0x80 | (value & 0x3F));
+    return 2;
+  }
+  else if (value < 0x10000)
+  {
+    if (value >= 0xD800 && value <= 0xDFFF)
+      return 0;
+
+    output[0] = static_cast<char>(0xE0 | (value >> 12));
+    output[1] = static_cast<char>(0x80 | ((value >> 6) & 0x3F));
+    output[2] = static_cast<char>(0x80 | (value & 0x3F));
+    return 3;
+  }
+  else if (value < 0x110000)
+  {
+    output[0] = static_cast<char>(0xF0 | (value >> 18));
+    output[1] = static_cast<char>(0x80 | ((value >> 12) & 0x3F));
+    output[2] = static_cast<char>(0x80 | ((value >> 6) & 0x3F));
+    output[3] = static_cast<char>(0x80 | (value & 0x3F));
+    return 4;
+  }
+
+  return 0;
+}
+
+// Skip the ASCII bytes at the start of '[begin, end)', returning a
+// pointer to the first non-ASCII byte (or 'end'). Bytes are checked a
+// word at a time.
+inline const char* skipAscii(const char* begin, const char* end)
+{
+  static const std::size_t high = static_cast<std::size_t>(-1) / 0xFF * 0x80;
+
+  const char* it = begin;
+  while (static_cast<std::size_t>(end - it) >= sizeof(std::size_t))
+  {
+    std::size_t word;
+    std::memcpy(&word, it, sizeof(word));
+    if (word & high)
+      break;
+    it += sizeof(word);
+  }
+
+  while (it != end && static_cast<signed char>(*it) >= 0)
+    ++it;
+
+  return it;
+}
+
+// The length of the well-formed UTF-8 sequence starting at 'begin',
+// or zero when the bytes there do not form one (e.g. a truncated or
+// overlong sequence, or an encoded surrogate).
+inline std::size_t sequenceLength(const char* begin, const char* end)
+{
+  const unsigned char* it = reinterpret_cast<const unsigned char*>(begin);
+  std::size_t available = end - begin;
+  if (available == 0)
+    return 0;
+
+  unsigned char ch = it[0];
+  if (ch < 0x80)
+    return 1;
+
+  // The length of the sequence, and the range of its second byte.
+  std::size_t n;
+  unsigned char lo = 0x80, hi = 0xBF;
+  if (ch < 0xC2)
+    return 0;
+  else if (ch < 0xE0)
+    n = 2;
+  else if (ch < 0xF0)
+  {
+    n = 3;
+    if (ch == 0xE0)
+      lo = 0xA0;
+    else if (ch == 0xED)
+      hi = 0x9F;
+  }
+  else if (ch < 0xF5)
+  {
+    n = 4;
+    if (ch == 0xF0)
+      lo = 0x90;
+    else if (ch == 0xF4)
+      hi = 0x8F;
+  }
+  else
+    return 0;
+
+  if (available < n || it[1] < lo || it[1] > hi)
+    return 0;
+
+  for (std::size_t i = 2; i < n; ++i)
+    if ((it[i] & 0xC0) != 0x80)
+      return 0;
+
+  return n;
+}
+
+// Validate the UTF-8 in '[begin, end)', returning a pointer to the
+// start of the first ill-formed sequence (or 'end').
+inline const char* validate(const char* begin, const char* end)
+{
+  const char* it = begin;
+  while (true)
+  {
+    it = skipAscii(it, end);
+    if (it == end)
+      return end;
+
+    std::size_t n = sequenceLength(it, end);
+    if (n == 0)
+      return it;
+
+    it += n;
+  }
+}
+
 class iterator
 {
 public:
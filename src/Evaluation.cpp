@@ -0,0 +1,54 @@
+#include <sourcetools/r/r.h>
+
+#define R_NO_REMAP
+#include <R.h>
+#include <Rinternals.h>
+
+extern "C" SEXP sourcetools_performs_nse(SEXP dataSEXP, SEXP allSEXP)
+{
+  using namespace sourcetools::r::nse;
+
+  if (Rf_isEnvironment(dataSEXP))
+    return performsNonStandardEvaluation(dataSEXP, Rf_asLogical(allSEXP) == TRUE);
+
+  if (Rf_isFunction(dataSEXP) || TYPEOF(dataSEXP) == LANGSXP)
+    return Rf_ScalarLogical(performsNonStandardEvaluation(dataSEXP));
+
+  Rf_error("expected a function, call or environment");
+  return R_NilValue;
+}
+
+extern "C" SEXP sourcetools_nse_cache_info()
+{
+  using namespace sourcetools::r::nse;
+
+  Database& db = database();
+
+  sourcetools::r::ListBuilder builder;
+  builder.add("capacity", Rf_ScalarReal(static_cast<double>(db.capacity())));
+  builder.add("hits",     Rf_ScalarReal(static_cast<double>(db.hits())));
+  builder.add("misses",   Rf_ScalarReal(static_cast<double>(db.misses())));
+  return builder;
+}
+
+extern "C" SEXP sourcetools_nse_cache_flush()
+{
+  sourcetools::r::nse::database().clear();
+  return R_NilValue;
+}
+
+extern "C" SEXP sourcetools_search_path_contains(SEXP namesSEXP)
+{
+  if (TYPEOF(namesSEXP) != STRSXP)
+    Rf_error("expected a character vector");
+
+  const sourcetools::r::SearchPath& searchPath = sourcetools::r::searchPath();
+
+  R_xlen_t n = Rf_xlength(namesSEXP);
+  sourcetools::r::Protect protect;
+  SEXP resultSEXP = protect(Rf_allocVector(LGLSXP, n));
+  for (R_xlen_t i = 0; i < n; ++i)
+    LOGICAL(resultSEXP)[i] = searchPath.contains(STRING_ELT(namesSEXP, i));
+
+  return resultSEXP;
+}
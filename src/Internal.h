@@ -0,0 +1,28 @@
+#ifndef SOURCETOOLS_INTERNAL_H
+#define SOURCETOOLS_INTERNAL_H
+
+// Declarations shared by the package's translation units.
+
+#include <cstddef>
+
+#include <sourcetools/read/read.h>
+#include <sourcetools/r/r.h>
+
+namespace sourcetools {
+
+// Defined in 'Reader.cpp'.
+void configureReader();
+MappedFileCache& fileCache();
+LineIndex* asLineIndex(SEXP indexSEXP);
+void asLineRange(const LineIndex& index,
+                 SEXP fromSEXP,
+                 SEXP toSEXP,
+                 std::size_t* pFrom,
+                 std::size_t* pTo);
+
+// Defined in 'Tokenizer.cpp'.
+int asThreadCount(SEXP threadsSEXP);
+
+} // namespace sourcetools
+
+#endif /* SOURCETOOLS_INTERNAL_H */
@@ -1,19 +1,319 @@
 #include <cstring>
 
 #include <sourcetools/read/read.h>
+#include <sourcetools/parallel/parallel.h>
 #include <sourcetools/r/r.h>
 
+#include "Internal.h"
+
 #define R_NO_REMAP
 #include <R.h>
 #include <Rinternals.h>
 
+namespace sourcetools {
+
+// Fill the elements of a character vector with lines.
+class StringLineFiller
+{
+public:
+
+  explicit StringLineFiller(SEXP resultSEXP)
+    : resultSEXP_(resultSEXP),
+      index_(0)
+  {
+  }
+
+  void operator()(const char* begin, const char* end)
+  {
+    SET_STRING_ELT(resultSEXP_, index_++, Rf_mkCharLen(begin, end - begin));
+  }
+
+private:
+  SEXP resultSEXP_;
+  R_xlen_t index_;
+};
+
+// Fill the elements of a list with lines, as raw vectors.
+class RawLineFiller
+{
+public:
+
+  explicit RawLineFiller(SEXP resultSEXP)
+    : resultSEXP_(resultSEXP),
+      index_(0)
+  {
+  }
+
+  void operator()(const char* begin, const char* end)
+  {
+    SEXP rawSEXP = Rf_allocVector(RAWSXP, end - begin);
+    std::memcpy(RAW(rawSEXP), begin, end - begin);
+    SET_VECTOR_ELT(resultSEXP_, index_++, rawSEXP);
+  }
+
+private:
+  SEXP resultSEXP_;
+  R_xlen_t index_;
+};
+
+// Convert the lines of some code into an R vector, in two passes:
+// the first counts the lines, so that the vector can be allocated up
+// front, and the second fills it directly from the code, without
+// copying each line out first. For use with 'r::unwindProtect()'.
+template <typename Filler>
+class LinesConverter
+{
+public:
+
+  LinesConverter(SEXPTYPE type, const char* begin, const char* end)
+    : type_(type),
+      begin_(begin),
+      end_(end)
+  {
+  }
+
+  SEXP operator()() const
+  {
+    typedef detail::MemoryMappedReader MemoryMappedReader;
+
+    r::Protect protect;
+    std::size_t n = MemoryMappedReader::countLines(begin_, end_);
+    SEXP resultSEXP = protect(Rf_allocVector(type_, n));
+
+    Filler filler(resultSEXP);
+    MemoryMappedReader::forEachLine(begin_, end_, filler);
+    return resultSEXP;
+  }
+
+private:
+  SEXPTYPE type_;
+  const char* begin_;
+  const char* end_;
+};
+
+// Convert some code into a single R string. For use with
+// 'r::unwindProtect()'.
+class StringConverter
+{
+public:
+
+  StringConverter(const char* begin, const char* end)
+    : begin_(begin),
+      end_(end)
+  {
+  }
+
+  SEXP operator()() const
+  {
+    return Rf_mkCharLen(begin_, end_ - begin_);
+  }
+
+private:
+  const char* begin_;
+  const char* end_;
+};
+
+// Read the lines of a memory-mapped file into an R vector. The vector
+// is filled while the file is mapped, and so under 'unwindProtect()',
+// such that an R error unmaps the file before it is resumed.
+template <typename Filler>
+class LinesReader
+{
+public:
+
+  LinesReader(SEXPTYPE type, SEXP* pResultSEXP)
+    : type_(type),
+      pResultSEXP_(pResultSEXP)
+  {
+  }
+
+  void operator()(const char* begin, const char* end)
+  {
+    LinesConverter<Filler> converter(type_, begin, end);
+    *pResultSEXP_ = r::unwindProtect(converter);
+  }
+
+private:
+  SEXPTYPE type_;
+  SEXP* pResultSEXP_;
+};
+
+// Apply the read strategy options: files of at most
+// 'sourcetools.read_small_size' bytes are read into a buffer, and
+// files of at least 'sourcetools.read_large_size' bytes are mapped
+// without being populated up front (and, with
+// 'sourcetools.read_huge_pages', advised to use huge pages).
+void configureReader()
+{
+  detail::ReadOptions& options = detail::MemoryMappedReader::options();
+  detail::ReadOptions defaults;
+
+  double small = static_cast<double>(defaults.smallFileSize);
+  SEXP smallSEXP = Rf_GetOption1(Rf_install("sourcetools.read_small_size"));
+  if (smallSEXP != R_NilValue)
+    small = Rf_asReal(smallSEXP);
+
+  double large = static_cast<double>(defaults.largeFileSize);
+  SEXP largeSEXP = Rf_GetOption1(Rf_install("sourcetools.read_large_size"));
+  if (largeSEXP != R_NilValue)
+    large = Rf_asReal(largeSEXP);
+
+  SEXP hugePagesSEXP = Rf_GetOption1(Rf_install("sourcetools.read_huge_pages"));
+
+  options.smallFileSize = ISNAN(small) || small < 0 ? 0 : static_cast<std::size_t>(small);
+  options.largeFileSize = ISNAN(large) || large < 0 ? 0 : static_cast<std::size_t>(large);
+  options.hugePages = hugePagesSEXP != R_NilValue && Rf_asLogical(hugePagesSEXP) == TRUE;
+}
+
+// The process-wide cache of mapped files. Its budget, in bytes, is
+// given by the 'sourcetools.file_cache_size' option; by default, the
+// cache is disabled.
+MappedFileCache& fileCache()
+{
+  MappedFileCache& cache = MappedFileCache::instance();
+
+  double capacity = 0;
+  SEXP optionSEXP = Rf_GetOption1(Rf_install("sourcetools.file_cache_size"));
+  if (optionSEXP != R_NilValue)
+    capacity = Rf_asReal(optionSEXP);
+
+  if (ISNAN(capacity) || capacity < 0)
+    capacity = 0;
+
+  cache.setCapacity(static_cast<std::size_t>(capacity));
+  return cache;
+}
+
+// Collect the paths and sizes of the cached files.
+class FileCacheLister
+{
+public:
+
+  FileCacheLister(SEXP pathSEXP, SEXP sizeSEXP)
+    : pathSEXP_(pathSEXP),
+      sizeSEXP_(sizeSEXP),
+      index_(0)
+  {
+  }
+
+  void operator()(const std::string& path, std::size_t size)
+  {
+    SET_STRING_ELT(pathSEXP_, index_, Rf_mkCharLen(path.c_str(), path.size()));
+    REAL(sizeSEXP_)[index_] = static_cast<double>(size);
+    ++index_;
+  }
+
+private:
+  SEXP pathSEXP_;
+  SEXP sizeSEXP_;
+  R_xlen_t index_;
+};
+
+// Reads a set of files into strings. Safe to invoke from worker
+// threads, as no R APIs (nor the file cache) are touched.
+class FilesReader
+{
+public:
+
+  FilesReader(const std::vector<std::string>& paths,
+              std::vector<std::string>* pContents,
+              std::vector<char>* pSuccess)
+    : paths_(paths),
+      pContents_(pContents),
+      pSuccess_(pSuccess)
+  {
+  }
+
+  void operator()(std::size_t i)
+  {
+    (*pSuccess_)[i] = read(paths_[i], &(*pContents_)[i]);
+  }
+
+private:
+  const std::vector<std::string>& paths_;
+  std::vector<std::string>* pContents_;
+  std::vector<char>* pSuccess_;
+};
+
+// Read a set of files in parallel, warning for those that could not be
+// read. Returns false if the files could not be read at all.
+bool readFiles(SEXP absolutePathsSEXP,
+               int threads,
+               std::vector<std::string>* pContents,
+               std::vector<char>* pSuccess)
+{
+  std::size_t n = Rf_xlength(absolutePathsSEXP);
+
+  std::vector<std::string> paths(n);
+  for (std::size_t i = 0; i < n; ++i)
+    paths[i] = CHAR(STRING_ELT(absolutePathsSEXP, i));
+
+  pContents->resize(n);
+  pSuccess->resize(n);
+  FilesReader reader(paths, pContents, pSuccess);
+  if (!parallel::forEach(n, threads, reader))
+    return false;
+
+  for (std::size_t i = 0; i < n; ++i)
+    if (!(*pSuccess)[i])
+      r::warning("Failed to read file '%s'", paths[i].c_str());
+
+  return true;
+}
+
+void finalizeLineIndex(SEXP indexSEXP)
+{
+  delete static_cast<LineIndex*>(R_ExternalPtrAddr(indexSEXP));
+  R_ClearExternalPtr(indexSEXP);
+}
+
+// Line indices are passed to R as tagged external pointers.
+SEXP lineIndexTag()
+{
+  return Rf_install("sourcetools_line_index");
+}
+
+LineIndex* asLineIndex(SEXP indexSEXP)
+{
+  if (TYPEOF(indexSEXP) != EXTPTRSXP || R_ExternalPtrTag(indexSEXP) != lineIndexTag())
+    Rf_error("Expected a line index");
+
+  // External pointers are not preserved across sessions.
+  LineIndex* pIndex = static_cast<LineIndex*>(R_ExternalPtrAddr(indexSEXP));
+  if (pIndex == NULL)
+    Rf_error("Line index is no longer valid");
+
+  return pIndex;
+}
+
+// Convert a (one-based, inclusive) range of lines '[from, to]' to a
+// zero-based, exclusive, range. An empty range is allowed.
+void asLineRange(const LineIndex& index,
+                 SEXP fromSEXP,
+                 SEXP toSEXP,
+                 std::size_t* pFrom,
+                 std::size_t* pTo)
+{
+  double from = Rf_asReal(fromSEXP);
+  double to = Rf_asReal(toSEXP);
+  double n = static_cast<double>(index.lineCount());
+  if (ISNAN(from) || ISNAN(to) || from < 1 || to > n || from > to + 1)
+    Rf_error("Invalid line range");
+
+  *pFrom = static_cast<std::size_t>(from) - 1;
+  *pTo = static_cast<std::size_t>(to);
+}
+
+} // namespace sourcetools
+
 extern "C" SEXP sourcetools_read(SEXP absolutePathSEXP)
 {
+  sourcetools::configureReader();
   const char* absolutePath = CHAR(STRING_ELT(absolutePathSEXP, 0));
 
   std::string contents;
-  bool result = sourcetools::read(absolutePath, &contents);
-  if (!result)
+  sourcetools::detail::MemoryMappedReader::StringReader reader(&contents);
+  if (!sourcetools::fileCache().map(absolutePath, reader))
   {
     Rf_warning("Failed to read file");
     return R_NilValue;
@@ -27,31 +327,32 @@ extern "C" SEXP sourcetools_read(SEXP absolutePathSEXP)
 
 extern "C" SEXP sourcetools_read_lines(SEXP absolutePathSEXP)
 {
+  SOURCETOOLS_BEGIN_UNWIND
+
+  sourcetools::configureReader();
   const char* absolutePath = CHAR(STRING_ELT(absolutePathSEXP, 0));
 
-  std::vector<std::string> lines;
-  bool result = sourcetools::read_lines(absolutePath, &lines);
-  if (!result)
+  SEXP resultSEXP = R_NilValue;
+  sourcetools::LinesReader<sourcetools::StringLineFiller> reader(STRSXP, &resultSEXP);
+  if (!sourcetools::fileCache().map(absolutePath, reader))
   {
     Rf_warning("Failed to read file");
     return R_NilValue;
   }
 
-  std::size_t n = lines.size();
-  sourcetools::r::Protect protect;
-  SEXP resultSEXP = protect(Rf_allocVector(STRSXP, n));
-  for (std::size_t i = 0; i < n; ++i)
-    SET_STRING_ELT(resultSEXP, i, Rf_mkCharLen(lines[i].c_str(), lines[i].size()));
   return resultSEXP;
+
+  SOURCETOOLS_END_UNWIND
 }
 
 extern "C" SEXP sourcetools_read_bytes(SEXP absolutePathSEXP)
 {
+  sourcetools::configureReader();
   const char* absolutePath = CHAR(STRING_ELT(absolutePathSEXP, 0));
 
   std::string contents;
-  bool result = sourcetools::read(absolutePath, &contents);
-  if (!result)
+  sourcetools::detail::MemoryMappedReader::StringReader reader(&contents);
+  if (!sourcetools::fileCache().map(absolutePath, reader))
   {
     Rf_warning("Failed to read file");
     return R_NilValue;
@@ -65,24 +366,269 @@ extern "C" SEXP sourcetools_read_bytes(SEXP absolutePathSEXP)
 
 extern "C" SEXP sourcetools_read_lines_bytes(SEXP absolutePathSEXP)
 {
+  SOURCETOOLS_BEGIN_UNWIND
+
+  sourcetools::configureReader();
   const char* absolutePath = CHAR(STRING_ELT(absolutePathSEXP, 0));
 
-  std::vector<std::string> lines;
-  bool result = sourcetools::read_lines(absolutePath, &lines);
-  if (!result)
+  SEXP resultSEXP = R_NilValue;
+  sourcetools::LinesReader<sourcetools::RawLineFiller> reader(VECSXP, &resultSEXP);
+  if (!sourcetools::fileCache().map(absolutePath, reader))
   {
     Rf_warning("Failed to read file");
     return R_NilValue;
   }
 
-  std::size_t n = lines.size();
+  return resultSEXP;
+
+  SOURCETOOLS_END_UNWIND
+}
+
+extern "C" SEXP sourcetools_read_many(SEXP absolutePathsSEXP,
+                                      SEXP threadsSEXP)
+{
+  SOURCETOOLS_BEGIN_UNWIND
+
+  sourcetools::configureReader();
+  int threads = sourcetools::asThreadCount(threadsSEXP);
+
+  // Files that could not be read yield NA.
+  std::size_t n = Rf_xlength(absolutePathsSEXP);
+  sourcetools::r::Protect protect;
+  SEXP resultSEXP = protect(Rf_allocVector(STRSXP, n));
+
+  std::vector<std::string> contents;
+  std::vector<char> success;
+  if (!sourcetools::readFiles(absolutePathsSEXP, threads, &contents, &success))
+  {
+    sourcetools::r::warning("Failed to read files");
+    return R_NilValue;
+  }
+
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    if (!success[i])
+    {
+      SET_STRING_ELT(resultSEXP, i, NA_STRING);
+      continue;
+    }
+
+    const std::string& content = contents[i];
+    sourcetools::StringConverter converter(content.data(), content.data() + content.size());
+    SET_STRING_ELT(resultSEXP, i, sourcetools::r::unwindProtect(converter));
+    std::string().swap(contents[i]);
+  }
+
+  return resultSEXP;
+
+  SOURCETOOLS_END_UNWIND
+}
+
+extern "C" SEXP sourcetools_read_lines_many(SEXP absolutePathsSEXP,
+                                            SEXP threadsSEXP)
+{
+  SOURCETOOLS_BEGIN_UNWIND
+
+  typedef sourcetools::LinesReader<sourcetools::StringLineFiller> LinesReader;
+
+  sourcetools::configureReader();
+  int threads = sourcetools::asThreadCount(threadsSEXP);
+
+  // Files that could not be read yield NULL.
+  std::size_t n = Rf_xlength(absolutePathsSEXP);
   sourcetools::r::Protect protect;
   SEXP resultSEXP = protect(Rf_allocVector(VECSXP, n));
+
+  std::vector<std::string> contents;
+  std::vector<char> success;
+  if (!sourcetools::readFiles(absolutePathsSEXP, threads, &contents, &success))
+  {
+    sourcetools::r::warning("Failed to read files");
+    return R_NilValue;
+  }
+
   for (std::size_t i = 0; i < n; ++i)
   {
-    SEXP rawSEXP = Rf_allocVector(RAWSXP, lines[i].size());
-    std::memcpy(RAW(rawSEXP), lines[i].c_str(), lines[i].size());
-    SET_VECTOR_ELT(resultSEXP, i, rawSEXP);
+    if (!success[i])
+      continue;
+
+    const std::string& content = contents[i];
+    SEXP linesSEXP = R_NilValue;
+    LinesReader reader(STRSXP, &linesSEXP);
+    reader(content.data(), content.data() + content.size());
+    SET_VECTOR_ELT(resultSEXP, i, linesSEXP);
+    std::string().swap(contents[i]);
   }
+
   return resultSEXP;
+
+  SOURCETOOLS_END_UNWIND
+}
+
+extern "C" SEXP sourcetools_line_index(SEXP absolutePathSEXP)
+{
+  const char* absolutePath = CHAR(STRING_ELT(absolutePathSEXP, 0));
+
+  sourcetools::r::Protect protect;
+  SEXP indexSEXP = protect(R_MakeExternalPtr(NULL, sourcetools::lineIndexTag(), R_NilValue));
+  sourcetools::LineIndex* pIndex = new sourcetools::LineIndex;
+  R_SetExternalPtrAddr(indexSEXP, pIndex);
+  R_RegisterCFinalizerEx(indexSEXP, sourcetools::finalizeLineIndex, TRUE);
+
+  if (!pIndex->open(absolutePath))
+  {
+    Rf_warning("Failed to read file");
+    return R_NilValue;
+  }
+
+  return indexSEXP;
+}
+
+extern "C" SEXP sourcetools_line_index_count(SEXP indexSEXP)
+{
+  const sourcetools::LineIndex& index = *sourcetools::asLineIndex(indexSEXP);
+  return Rf_ScalarReal(static_cast<double>(index.lineCount()));
+}
+
+extern "C" SEXP sourcetools_line_index_lines(SEXP indexSEXP,
+                                             SEXP fromSEXP,
+                                             SEXP toSEXP)
+{
+  const sourcetools::LineIndex& index = *sourcetools::asLineIndex(indexSEXP);
+
+  std::size_t from, to;
+  sourcetools::asLineRange(index, fromSEXP, toSEXP, &from, &to);
+
+  sourcetools::r::Protect protect;
+  SEXP resultSEXP = protect(Rf_allocVector(STRSXP, to - from));
+  for (std::size_t i = from; i < to; ++i)
+  {
+    const char* begin = index.lineBegin(i);
+    const char* end = index.lineEnd(i);
+    SET_STRING_ELT(resultSEXP, i - from, Rf_mkCharLen(begin, end - begin));
+  }
+  return resultSEXP;
+}
+
+extern "C" SEXP sourcetools_line_index_position(SEXP indexSEXP,
+                                                SEXP offsetsSEXP)
+{
+  const sourcetools::LineIndex& index = *sourcetools::asLineIndex(indexSEXP);
+
+  R_xlen_t n = Rf_xlength(offsetsSEXP);
+  const double* offsets = REAL(offsetsSEXP);
+  double size = static_cast<double>(index.size());
+
+  sourcetools::r::Protect protect;
+  SEXP resultSEXP = protect(Rf_allocVector(VECSXP, 2));
+  SEXP rowSEXP = protect(Rf_allocVector(INTSXP, n));
+  SET_VECTOR_ELT(resultSEXP, 0, rowSEXP);
+  SEXP columnSEXP = protect(Rf_allocVector(INTSXP, n));
+  SET_VECTOR_ELT(resultSEXP, 1, columnSEXP);
+
+  for (R_xlen_t i = 0; i < n; ++i)
+  {
+    // Offsets are one-based.
+    double offset = offsets[i];
+    if (ISNAN(offset) || offset < 1 || offset > size)
+    {
+      INTEGER(rowSEXP)[i] = NA_INTEGER;
+      INTEGER(columnSEXP)[i] = NA_INTEGER;
+      continue;
+    }
+
+    sourcetools::collections::Position position =
+      index.position(static_cast<std::size_t>(offset) - 1);
+    INTEGER(rowSEXP)[i] = position.row + 1;
+    INTEGER(columnSEXP)[i] = position.column + 1;
+  }
+
+  return resultSEXP;
+}
+
+extern "C" SEXP sourcetools_file_cache_info()
+{
+  sourcetools::MappedFileCache& cache = sourcetools::fileCache();
+
+  sourcetools::r::Protect protect;
+  R_xlen_t n = static_cast<R_xlen_t>(cache.count());
+  SEXP pathSEXP = protect(Rf_allocVector(STRSXP, n));
+  SEXP sizeSEXP = protect(Rf_allocVector(REALSXP, n));
+  sourcetools::FileCacheLister lister(pathSEXP, sizeSEXP);
+  cache.list(lister);
+
+  sourcetools::r::ListBuilder builder;
+  builder.add("capacity", Rf_ScalarReal(static_cast<double>(cache.capacity())));
+  builder.add("size", Rf_ScalarReal(static_cast<double>(cache.size())));
+  builder.add("hits", Rf_ScalarReal(static_cast<double>(cache.hits())));
+  builder.add("misses", Rf_ScalarReal(static_cast<double>(cache.misses())));
+  builder.add("evictions", Rf_ScalarReal(static_cast<double>(cache.evictions())));
+  builder.add("path", pathSEXP);
+  builder.add("file_size", sizeSEXP);
+  return builder;
+}
+
+extern "C" SEXP sourcetools_file_cache_flush()
+{
+  sourcetools::MappedFileCache& cache = sourcetools::MappedFileCache::instance();
+  double count = static_cast<double>(cache.count());
+  cache.clear();
+  return Rf_ScalarReal(count);
+}
+
+extern "C" SEXP sourcetools_read_stats()
+{
+  sourcetools::configureReader();
+  const sourcetools::detail::ReadOptions& options =
+    sourcetools::detail::MemoryMappedReader::options();
+  const sourcetools::detail::ReadStats& stats =
+    sourcetools::detail::MemoryMappedReader::stats();
+
+  sourcetools::r::ListBuilder builder;
+  builder.add("small_size", Rf_ScalarReal(static_cast<double>(options.smallFileSize)));
+  builder.add("large_size", Rf_ScalarReal(static_cast<double>(options.largeFileSize)));
+  builder.add("huge_pages", Rf_ScalarLogical(options.hugePages));
+  builder.add("reads", Rf_ScalarReal(static_cast<double>(stats.reads)));
+  builder.add("maps", Rf_ScalarReal(static_cast<double>(stats.maps)));
+  builder.add("streams", Rf_ScalarReal(static_cast<double>(stats.streams)));
+  return builder;
+}
+
+extern "C" SEXP sourcetools_stats(SEXP resetSEXP, SEXP enableSEXP)
+{
+  using namespace sourcetools::stats;
+
+  int enable = Rf_asLogical(enableSEXP);
+  Stats& stats = global();
+  sourcetools::r::Protect protect;
+
+  SEXP stageSEXP = protect(Rf_allocVector(STRSXP, STAGE_COUNT));
+  SEXP callsSEXP = protect(Rf_allocVector(REALSXP, STAGE_COUNT));
+  SEXP secondsSEXP = protect(Rf_allocVector(REALSXP, STAGE_COUNT));
+  for (std::size_t i = 0; i < STAGE_COUNT; ++i)
+  {
+    SET_STRING_ELT(stageSEXP, i, Rf_mkChar(stageName(static_cast<Stage>(i))));
+    REAL(callsSEXP)[i] = static_cast<double>(stats.calls[i]);
+    REAL(secondsSEXP)[i] = stats.seconds[i];
+  }
+
+  sourcetools::r::ListBuilder builder;
+  builder.add("stage", stageSEXP);
+  builder.add("calls", callsSEXP);
+  builder.add("seconds", secondsSEXP);
+  for (std::size_t i = 0; i < COUNTER_COUNT; ++i)
+  {
+    double value = static_cast<double>(stats.counters[i]);
+    builder.add(counterName(static_cast<Counter>(i)), Rf_ScalarReal(value));
+  }
+
+  builder.add("enabled", Rf_ScalarLogical(enabled()));
+
+  if (Rf_asLogical(resetSEXP) == TRUE)
+    stats.reset();
+
+  if (enable != NA_LOGICAL)
+    enabled() = enable == TRUE;
+
+  return builder;
 }
@@ -1,8 +1,31 @@
+#include <algorithm>
+#include <cstring>
+
 #include <sourcetools.h>
 
+#include "Internal.h"
+
 #define R_NO_REMAP
 #include <R.h>
 #include <Rinternals.h>
+#include <Rversion.h>
+#include <R_ext/Rdynload.h>
+
+// Token values are materialized lazily, through ALTREP, on R >= 3.5.
+#if defined(R_VERSION) && R_VERSION >= R_Version(3, 5, 0)
+# define SOURCE_TOOLS_LAZY_VALUES
+# if R_VERSION < R_Version(3, 6, 0)
+// Prior to R 3.6.0, <R_ext/Altrep.h> lacks C++ guards, and uses
+// 'class' as a parameter name.
+#  define class klass
+extern "C" {
+#  include <R_ext/Altrep.h>
+}
+#  undef class
+# else
+#  include <R_ext/Altrep.h>
+# endif
+#endif
 
 namespace sourcetools {
 namespace {
@@ -19,46 +42,707 @@ void asDataFrame(SEXP listSEXP, int n)
   Rf_setAttrib(listSEXP, R_RowNamesSymbol, rownamesSEXP);
 }
 
-SEXP asSEXP(const std::vector<tokens::Token>& tokens)
+// Maps token types to CHARSXPs holding their names, so that the
+// name of each type is only constructed once per conversion. As
+// with 'r::CharacterCache', the CHARSXPs held are not protected.
+class TypeNameCache
+{
+public:
+
+  TypeNameCache()
+  {
+    for (std::size_t i = 0; i < SIZE; ++i)
+      slots_[i] = NULL;
+  }
+
+  SEXP get(tokens::TokenType type)
+  {
+    std::size_t index = (type * 2654435761u) >> 24;
+    if (slots_[index] != NULL && types_[index] == type)
+      return slots_[index];
+
+    const std::string& name = toString(type);
+    types_[index] = type;
+    SOURCETOOLS_STATS_ADD(COUNTER_CHARSXPS, 1);
+    slots_[index] = Rf_mkCharLen(name.c_str(), name.size());
+    return slots_[index];
+  }
+
+private:
+  static const std::size_t SIZE = 256;
+  tokens::TokenType types_[SIZE];
+  SEXP slots_[SIZE];
+};
+
+// Convert the symbol ids of one or more token buffers into a factor,
+// with one level per symbol interned in 'symbols'. Tokens without a
+// symbol id are 'NA'.
+SEXP asSymbolFactor(const tokens::TokenBuffer* pBuffers,
+                    std::size_t count,
+                    std::size_t n,
+                    const tokens::SymbolTable& symbols)
 {
   r::Protect protect;
-  std::size_t n = tokens.size();
-  SEXP resultSEXP = protect(Rf_allocVector(VECSXP, 4));
+  SEXP factorSEXP = protect(Rf_allocVector(INTSXP, n));
 
-  // Set vector elements
+  std::size_t index = 0;
+  for (std::size_t k = 0; k < count; ++k)
+  {
+    tokens::TokenView tokens = pBuffers[k].view();
+    std::size_t size = tokens.size();
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      tokens::SymbolId id = tokens.symbol(i);
+      INTEGER(factorSEXP)[index + i] =
+        id == tokens::NO_SYMBOL ? NA_INTEGER : static_cast<int>(id) + 1;
+    }
+    index += size;
+  }
+
+  std::size_t levels = symbols.size();
+  SEXP levelsSEXP = protect(Rf_allocVector(STRSXP, levels));
+  SOURCETOOLS_STATS_ADD(COUNTER_CHARSXPS, levels);
+  for (std::size_t i = 0; i < levels; ++i)
+  {
+    tokens::SymbolId id = static_cast<tokens::SymbolId>(i);
+    SEXP charSEXP = Rf_mkCharLen(symbols.data(id), symbols.length(id));
+    SET_STRING_ELT(levelsSEXP, i, charSEXP);
+  }
+
+  Rf_setAttrib(factorSEXP, R_LevelsSymbol, levelsSEXP);
+
+  SEXP classSEXP = protect(Rf_mkString("factor"));
+  Rf_setAttrib(factorSEXP, R_ClassSymbol, classSEXP);
+  return factorSEXP;
+}
+
+// Describes how the source code referenced by a set of token buffers
+// can be kept alive, so that token values can be materialized lazily:
+// the code is owned by an R object ('sourceSEXP'; e.g. a string, or a
+// list of the 'MappedFile' external pointers holding a set of files).
+// When none is supplied, token values are materialized eagerly.
+struct Sources
+{
+  Sources()
+    : sourceSEXP(R_NilValue)
+  {
+  }
+
+  explicit Sources(SEXP sourceSEXP)
+    : sourceSEXP(sourceSEXP)
+  {
+  }
+
+  bool empty() const
+  {
+    return sourceSEXP == R_NilValue;
+  }
+
+  SEXP sourceSEXP;
+};
+
+SEXP asValueSEXP(const tokens::TokenBuffer* pBuffers,
+                 std::size_t count,
+                 std::size_t n)
+{
+  r::Protect protect;
   SEXP valueSEXP = protect(Rf_allocVector(STRSXP, n));
-  SET_VECTOR_ELT(resultSEXP, 0, valueSEXP);
-  for (std::size_t i = 0; i < n; ++i) {
-    const std::string& contents = tokens[i].contents();
-    SEXP charSEXP = Rf_mkCharLen(contents.c_str(), contents.size());
-    SET_STRING_ELT(valueSEXP, i, charSEXP);
+
+  r::CharacterCache cache;
+
+  std::size_t index = 0;
+  for (std::size_t k = 0; k < count; ++k)
+  {
+    tokens::TokenView tokens = pBuffers[k].view();
+    std::size_t size = tokens.size();
+    for (std::size_t i = 0; i < size; ++i) {
+      SEXP charSEXP = cache.get(tokens.begin(i), tokens.length(i));
+      SET_STRING_ELT(valueSEXP, index + i, charSEXP);
+    }
+    index += size;
+  }
+
+  return valueSEXP;
+}
+
+#ifdef SOURCE_TOOLS_LAZY_VALUES
+
+// The source code, and extents of each token within that code,
+// backing a lazily materialized vector of token values.
+class TokenValues : noncopyable
+{
+public:
+
+  void reserve(std::size_t n)
+  {
+    begins_.reserve(n);
+    lengths_.reserve(n);
+  }
+
+  // Add the tokens in 'buffer', whose source code must outlive the
+  // values.
+  void add(const tokens::TokenBuffer& buffer)
+  {
+    const char* code = buffer.code();
+    const std::vector<tokens::CompactToken>& tokens = buffer.tokens();
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+    {
+      begins_.push_back(code + tokens[i].offset);
+      lengths_.push_back(tokens[i].length);
+    }
+  }
+
+  std::size_t size() const { return lengths_.size(); }
+  const char* begin(std::size_t index) const { return begins_[index]; }
+  std::size_t length(std::size_t index) const { return lengths_[index]; }
+
+private:
+  std::vector<const char*> begins_;
+  std::vector<unsigned int> lengths_;
+};
+
+// An ALTREP character vector of token values. CHARSXPs are only
+// created for elements as they are accessed; the vector is fully
+// materialized only when a pointer to its data is requested (e.g.
+// on modification, or serialization), after which the source code
+// is released.
+//
+// The first data slot holds an external pointer to the token values
+// (protecting any R object owning the source code), whose tag caches
+// the CHARSXPs created so far, as a character vector ('NA' for those
+// not yet created); the second data slot holds the materialized
+// vector, or 'R_NilValue'.
+class LazyValues
+{
+public:
+
+  static void initialize(DllInfo* pInfo)
+  {
+    class_ = R_make_altstring_class("sourcetools_values", "sourcetools", pInfo);
+
+    R_set_altrep_Length_method(class_, length);
+    R_set_altrep_Inspect_method(class_, inspect);
+    R_set_altrep_Serialized_state_method(class_, serializedState);
+    R_set_altrep_Unserialize_method(class_, unserialize);
+
+    R_set_altvec_Dataptr_method(class_, dataptr);
+    R_set_altvec_Dataptr_or_null_method(class_, dataptrOrNull);
+
+    R_set_altstring_Elt_method(class_, elt);
+    R_set_altstring_Set_elt_method(class_, setElt);
+
+    initialized_ = true;
+  }
+
+  static bool initialized() { return initialized_; }
+
+  static SEXP create(const tokens::TokenBuffer* pBuffers,
+                     std::size_t count,
+                     std::size_t n,
+                     const Sources& sources)
+  {
+    r::Protect protect;
+
+    SEXP valuesSEXP = protect(R_MakeExternalPtr(NULL, R_NilValue, sources.sourceSEXP));
+    TokenValues* pValues = new TokenValues;
+    R_SetExternalPtrAddr(valuesSEXP, pValues);
+    R_RegisterCFinalizerEx(valuesSEXP, finalize, TRUE);
+
+    pValues->reserve(n);
+    for (std::size_t k = 0; k < count; ++k)
+      pValues->add(pBuffers[k]);
+
+    return R_new_altrep(class_, valuesSEXP, R_NilValue);
+  }
+
+private:
+
+  static TokenValues* values(SEXP x)
+  {
+    return static_cast<TokenValues*>(R_ExternalPtrAddr(R_altrep_data1(x)));
+  }
+
+  static void finalize(SEXP valuesSEXP)
+  {
+    delete static_cast<TokenValues*>(R_ExternalPtrAddr(valuesSEXP));
+    R_ClearExternalPtr(valuesSEXP);
+  }
+
+  // The CHARSXPs created so far, allocated on first use.
+  static SEXP created(SEXP x)
+  {
+    SEXP valuesSEXP = R_altrep_data1(x);
+    SEXP createdSEXP = R_ExternalPtrTag(valuesSEXP);
+    if (createdSEXP != R_NilValue)
+      return createdSEXP;
+
+    R_xlen_t n = values(x)->size();
+    createdSEXP = Rf_allocVector(STRSXP, n);
+    for (R_xlen_t i = 0; i < n; ++i)
+      SET_STRING_ELT(createdSEXP, i, NA_STRING);
+
+    R_SetExternalPtrTag(valuesSEXP, createdSEXP);
+    return createdSEXP;
+  }
+
+  static SEXP materialize(SEXP x)
+  {
+    SEXP dataSEXP = R_altrep_data2(x);
+    if (dataSEXP != R_NilValue)
+      return dataSEXP;
+
+    const TokenValues& values = *LazyValues::values(x);
+    std::size_t n = values.size();
+    dataSEXP = created(x);
+
+    r::CharacterCache cache;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      if (STRING_ELT(dataSEXP, i) != NA_STRING)
+        continue;
+
+      SEXP charSEXP = cache.get(values.begin(i), values.length(i));
+      SET_STRING_ELT(dataSEXP, i, charSEXP);
+    }
+
+    R_set_altrep_data2(x, dataSEXP);
+
+    // The source code is no longer needed.
+    SEXP valuesSEXP = R_altrep_data1(x);
+    finalize(valuesSEXP);
+    R_SetExternalPtrTag(valuesSEXP, R_NilValue);
+    R_SetExternalPtrProtected(valuesSEXP, R_NilValue);
+
+    return dataSEXP;
+  }
+
+  static R_xlen_t length(SEXP x)
+  {
+    SEXP dataSEXP = R_altrep_data2(x);
+    if (dataSEXP != R_NilValue)
+      return XLENGTH(dataSEXP);
+
+    return values(x)->size();
+  }
+
+  static Rboolean inspect(SEXP x, int, int, int,
+                          void (*)(SEXP, int, int, int))
+  {
+    Rprintf("sourcetools_values (materialized = %s)\n",
+            R_altrep_data2(x) == R_NilValue ? "FALSE" : "TRUE");
+    return TRUE;
+  }
+
+  static SEXP serializedState(SEXP x)
+  {
+    return materialize(x);
+  }
+
+  static SEXP unserialize(SEXP, SEXP stateSEXP)
+  {
+    return stateSEXP;
+  }
+
+  // 'DATAPTR()' is not part of the API; a writable pointer to the
+  // materialized vector is obtained by casting away 'const'.
+  static void* dataptr(SEXP x, Rboolean)
+  {
+    return const_cast<SEXP*>(STRING_PTR_RO(materialize(x)));
+  }
+
+  static const void* dataptrOrNull(SEXP x)
+  {
+    SEXP dataSEXP = R_altrep_data2(x);
+    return dataSEXP == R_NilValue ? NULL : STRING_PTR_RO(dataSEXP);
+  }
+
+  static SEXP elt(SEXP x, R_xlen_t i)
+  {
+    SEXP dataSEXP = R_altrep_data2(x);
+    if (dataSEXP != R_NilValue)
+      return STRING_ELT(dataSEXP, i);
+
+    SEXP createdSEXP = created(x);
+    SEXP charSEXP = STRING_ELT(createdSEXP, i);
+    if (charSEXP != NA_STRING)
+      return charSEXP;
+
+    const TokenValues& values = *LazyValues::values(x);
+    SOURCETOOLS_STATS_ADD(COUNTER_CHARSXPS, 1);
+    charSEXP = Rf_mkCharLen(values.begin(i), values.length(i));
+    SET_STRING_ELT(createdSEXP, i, charSEXP);
+    return charSEXP;
+  }
+
+  static void setElt(SEXP x, R_xlen_t i, SEXP value)
+  {
+    SET_STRING_ELT(materialize(x), i, value);
+  }
+
+private:
+  static R_altrep_class_t class_;
+  static bool initialized_;
+};
+
+R_altrep_class_t LazyValues::class_;
+bool LazyValues::initialized_ = false;
+
+#endif /* SOURCE_TOOLS_LAZY_VALUES */
+
+// Token values are materialized lazily when possible, unless the
+// 'sourcetools.lazy_values' option is set to 'FALSE'.
+bool useLazyValues()
+{
+#ifdef SOURCE_TOOLS_LAZY_VALUES
+  if (!LazyValues::initialized())
+    return false;
+
+  SEXP optionSEXP = Rf_GetOption1(Rf_install("sourcetools.lazy_values"));
+  return optionSEXP == R_NilValue || Rf_asLogical(optionSEXP) == TRUE;
+#else
+  return false;
+#endif
+}
+
+SEXP asValueSEXP(const tokens::TokenBuffer* pBuffers,
+                 std::size_t count,
+                 std::size_t n,
+                 const Sources& sources)
+{
+#ifdef SOURCE_TOOLS_LAZY_VALUES
+  if (!sources.empty() && useLazyValues())
+    return LazyValues::create(pBuffers, count, n, sources);
+#else
+  (void) sources;
+#endif
+
+  return asValueSEXP(pBuffers, count, n);
+}
+
+// Decodes the strings in pieces of token buffers. Safe to invoke
+// from worker threads, as no R APIs are touched.
+class StringsDecoder
+{
+public:
+
+  StringsDecoder(const std::vector<tokens::TokenView>& pieces,
+                 std::vector<tokens::DecodedStrings>* pStrings)
+    : pieces_(pieces),
+      pStrings_(pStrings)
+  {
+  }
+
+  void operator()(std::size_t i)
+  {
+    (*pStrings_)[i].decode(pieces_[i]);
+  }
+
+private:
+  const std::vector<tokens::TokenView>& pieces_;
+  std::vector<tokens::DecodedStrings>* pStrings_;
+};
+
+// Split a set of token buffers into pieces of at most 'PIECE_SIZE'
+// tokens, in order, so that per-token work on a single large buffer
+// can also be spread across threads.
+void splitPieces(const tokens::TokenBuffer* pBuffers,
+                 std::size_t count,
+                 std::vector<tokens::TokenView>* pPieces)
+{
+  static const std::size_t PIECE_SIZE = 65536;
+
+  std::vector<tokens::TokenView>& pieces = *pPieces;
+  for (std::size_t k = 0; k < count; ++k)
+  {
+    tokens::TokenView tokens = pBuffers[k].view();
+    for (std::size_t i = 0; i < tokens.size(); i += PIECE_SIZE)
+    {
+      std::size_t size = std::min(PIECE_SIZE, tokens.size() - i);
+      pieces.push_back(tokens::TokenView(
+        tokens.code(),
+        tokens.tokens() + i,
+        size,
+        tokens.lines(),
+        tokens.lineCount()
+      ));
+    }
+  }
+}
+
+// Move the pieces covering the next 'size' tokens from '*pPieces'
+// (starting from '*pIndex') into '*pTaken'.
+template <typename T>
+void takePieces(std::vector<T>* pPieces,
+                std::size_t* pIndex,
+                std::size_t size,
+                std::vector<T>* pTaken)
+{
+  for (std::size_t count = 0; count < size; ++*pIndex)
+  {
+    T& piece = (*pPieces)[*pIndex];
+    count += piece.size();
+    pTaken->push_back(T());
+    pTaken->back().swap(piece);
+  }
+}
+
+// Decode the strings in a set of token buffers, in parallel, with
+// the decoded strings for each piece stored, in order, in 'pStrings'.
+bool decodeStrings(const tokens::TokenBuffer* pBuffers,
+                   std::size_t count,
+                   std::size_t threads,
+                   std::vector<tokens::DecodedStrings>* pStrings)
+{
+  std::vector<tokens::TokenView> pieces;
+  splitPieces(pBuffers, count, &pieces);
+
+  pStrings->clear();
+  pStrings->resize(pieces.size());
+  StringsDecoder decoder(pieces, pStrings);
+  return parallel::forEach(pieces.size(), threads, decoder);
+}
+
+// Counts the columns of pieces of token buffers. Safe to invoke from
+// worker threads, as no R APIs are touched.
+class ColumnsCounter
+{
+public:
+
+  ColumnsCounter(const std::vector<tokens::TokenView>& pieces,
+                 tokens::ColumnUnit unit,
+                 std::vector<tokens::ColumnTable>* pColumns)
+    : pieces_(pieces),
+      unit_(unit),
+      pColumns_(pColumns)
+  {
+  }
+
+  void operator()(std::size_t i)
+  {
+    (*pColumns_)[i].build(pieces_[i], unit_);
+  }
+
+private:
+  const std::vector<tokens::TokenView>& pieces_;
+  tokens::ColumnUnit unit_;
+  std::vector<tokens::ColumnTable>* pColumns_;
+};
+
+// Count the columns of the tokens in a set of token buffers (and
+// validate their UTF-8), in parallel, with the table for each piece
+// stored, in order, in 'pColumns'.
+bool countColumns(const tokens::TokenBuffer* pBuffers,
+                  std::size_t count,
+                  std::size_t threads,
+                  tokens::ColumnUnit unit,
+                  std::vector<tokens::ColumnTable>* pColumns)
+{
+  std::vector<tokens::TokenView> pieces;
+  splitPieces(pBuffers, count, &pieces);
+
+  pColumns->clear();
+  pColumns->resize(pieces.size());
+  ColumnsCounter counter(pieces, unit, pColumns);
+  return parallel::forEach(pieces.size(), threads, counter);
+}
+
+// The units in which token columns are reported, as given by the
+// 'sourcetools.columns' option: one of "bytes" (the default),
+// "characters" or "utf16". Columns in characters or UTF-16 code
+// units are counted only for UTF-8 code.
+tokens::ColumnUnit columnUnit()
+{
+  SEXP unitSEXP = Rf_GetOption1(Rf_install("sourcetools.columns"));
+  if (unitSEXP == R_NilValue)
+    return tokens::COLUMN_BYTES;
+
+  if (TYPEOF(unitSEXP) != STRSXP ||
+      Rf_length(unitSEXP) != 1 ||
+      STRING_ELT(unitSEXP, 0) == NA_STRING)
+  {
+    Rf_error("'sourcetools.columns' must be a string");
+  }
+
+  const char* unit = CHAR(STRING_ELT(unitSEXP, 0));
+  if (std::strcmp(unit, "bytes") == 0)
+    return tokens::COLUMN_BYTES;
+  else if (std::strcmp(unit, "characters") == 0)
+    return tokens::COLUMN_CHARACTERS;
+  else if (std::strcmp(unit, "utf16") == 0)
+    return tokens::COLUMN_UTF16;
+
+  Rf_error("Unknown column unit '%s'", unit);
+  return tokens::COLUMN_BYTES;
+}
+
+// Convert decoded strings to a character vector. Values containing
+// nul bytes (which R strings cannot hold) are 'NA', as are the values
+// of tokens other than strings and symbols.
+SEXP asStringSEXP(const std::vector<tokens::DecodedStrings>& strings,
+                  std::size_t n)
+{
+  r::Protect protect;
+  SEXP stringSEXP = protect(Rf_allocVector(STRSXP, n));
+
+  r::CharacterCache cache;
+
+  std::size_t index = 0;
+  for (std::size_t k = 0; k < strings.size(); ++k)
+  {
+    const tokens::DecodedStrings& decoded = strings[k];
+    for (std::size_t i = 0; i < decoded.size(); ++i, ++index)
+    {
+      int flags = decoded.flags(i);
+      if (!decoded.hasValue(i) || (flags & tokens::STRING_NUL))
+      {
+        SET_STRING_ELT(stringSEXP, index, NA_STRING);
+        continue;
+      }
+
+      SEXP charSEXP = flags & tokens::STRING_UNICODE
+        ? Rf_mkCharLenCE(decoded.data(i), decoded.length(i), CE_UTF8)
+        : cache.get(decoded.data(i), decoded.length(i));
+      SET_STRING_ELT(stringSEXP, index, charSEXP);
+    }
+  }
+
+  return stringSEXP;
+}
+
+// Convert one or more token buffers into a single data.frame. The
+// token values are materialized lazily when the buffers' 'sources' are
+// supplied. When 'pSymbols' is supplied, a 'symbol' column is
+// appended, giving the interned symbol for each symbol and keyword (as a factor). When
+// 'idName' is supplied, an extra column is appended identifying the
+// buffer each token was drawn from; the element of 'idSEXP' (an
+// integer or character vector, with one element per buffer) is
+// used as that identifier. When 'pStrings' is supplied, a 'string'
+// column is appended, giving the decoded value of each string and
+// symbol. When 'pColumns' is supplied, columns are taken from it, and
+// tokens containing ill-formed UTF-8 are typed as invalid.
+SEXP asSEXP(const tokens::TokenBuffer* pBuffers,
+            std::size_t count,
+            const Sources& sources = Sources(),
+            const tokens::SymbolTable* pSymbols = NULL,
+            const char* idName = NULL,
+            SEXP idSEXP = R_NilValue,
+            const std::vector<tokens::DecodedStrings>* pStrings = NULL,
+            const std::vector<tokens::ColumnTable>* pColumns = NULL)
+{
+  SOURCETOOLS_STATS_TIMER(timer, STAGE_CONVERT);
+  r::Protect protect;
+
+  std::size_t n = 0;
+  for (std::size_t k = 0; k < count; ++k)
+    n += pBuffers[k].size();
+
+  std::size_t columns = 4;
+  std::size_t symbolColumn = pSymbols == NULL ? 0 : columns++;
+  std::size_t idColumn = idName == NULL ? 0 : columns++;
+  std::size_t stringColumn = pStrings == NULL ? 0 : columns++;
+  SEXP resultSEXP = protect(Rf_allocVector(VECSXP, columns));
+
+  if (pStrings != NULL)
+  {
+    SEXP stringSEXP = asStringSEXP(*pStrings, n);
+    SET_VECTOR_ELT(resultSEXP, stringColumn, stringSEXP);
   }
 
+  // Set vector elements
+  SEXP valueSEXP = asValueSEXP(pBuffers, count, n, sources);
+  SET_VECTOR_ELT(resultSEXP, 0, valueSEXP);
+
   SEXP rowSEXP = protect(Rf_allocVector(INTSXP, n));
   SET_VECTOR_ELT(resultSEXP, 1, rowSEXP);
-  for (std::size_t i = 0; i < n; ++i)
-    INTEGER(rowSEXP)[i] = tokens[i].row() + 1;
 
   SEXP columnSEXP = protect(Rf_allocVector(INTSXP, n));
   SET_VECTOR_ELT(resultSEXP, 2, columnSEXP);
-  for (std::size_t i = 0; i < n; ++i)
-    INTEGER(columnSEXP)[i] = tokens[i].column() + 1;
 
   SEXP typeSEXP = protect(Rf_allocVector(STRSXP, n));
   SET_VECTOR_ELT(resultSEXP, 3, typeSEXP);
-  for (std::size_t i = 0; i < n; ++i) {
-    const std::string& type = toString(tokens[i].type());
-    SEXP charSEXP = Rf_mkCharLen(type.c_str(), type.size());
-    SET_STRING_ELT(typeSEXP, i, charSEXP);
+
+  TypeNameCache types;
+
+  std::size_t index = 0;
+  for (std::size_t k = 0; k < count; ++k)
+  {
+    tokens::TokenView tokens = pBuffers[k].view();
+    std::size_t size = tokens.size();
+
+    for (std::size_t i = 0; i < size; ++i)
+      INTEGER(rowSEXP)[index + i] = tokens.row(i) + 1;
+
+    for (std::size_t i = 0; i < size; ++i)
+      INTEGER(columnSEXP)[index + i] = tokens.column(i) + 1;
+
+    for (std::size_t i = 0; i < size; ++i) {
+      SEXP charSEXP = types.get(tokens.type(i));
+      SET_STRING_ELT(typeSEXP, index + i, charSEXP);
+    }
+
+    index += size;
+  }
+
+  if (pColumns != NULL)
+  {
+    SEXP invalidSEXP = types.get(tokens::INVALID);
+
+    index = 0;
+    for (std::size_t k = 0; k < pColumns->size(); ++k)
+    {
+      const tokens::ColumnTable& table = (*pColumns)[k];
+      for (std::size_t i = 0; i < table.size(); ++i, ++index)
+      {
+        INTEGER(columnSEXP)[index] = table.column(i) + 1;
+        if (!table.valid(i))
+          SET_STRING_ELT(typeSEXP, index, invalidSEXP);
+      }
+    }
+  }
+
+  if (pSymbols != NULL)
+  {
+    SEXP symbolSEXP = asSymbolFactor(pBuffers, count, n, *pSymbols);
+    SET_VECTOR_ELT(resultSEXP, symbolColumn, symbolSEXP);
+  }
+
+  if (idName != NULL)
+  {
+    SEXP columnIdSEXP = protect(Rf_allocVector(TYPEOF(idSEXP), n));
+    SET_VECTOR_ELT(resultSEXP, idColumn, columnIdSEXP);
+
+    std::size_t offset = 0;
+    for (std::size_t k = 0; k < count; ++k)
+    {
+      std::size_t size = pBuffers[k].size();
+      if (TYPEOF(idSEXP) == STRSXP)
+      {
+        SEXP charSEXP = STRING_ELT(idSEXP, k);
+        for (std::size_t i = 0; i < size; ++i)
+          SET_STRING_ELT(columnIdSEXP, offset + i, charSEXP);
+      }
+      else
+      {
+        int* begin = INTEGER(columnIdSEXP) + offset;
+        std::fill(begin, begin + size, INTEGER(idSEXP)[k]);
+      }
+      offset += size;
+    }
   }
 
   // Set names
-  SEXP namesSEXP = protect(Rf_allocVector(STRSXP, 4));
+  SEXP namesSEXP = protect(Rf_allocVector(STRSXP, columns));
 
   SET_STRING_ELT(namesSEXP, 0, Rf_mkChar("value"));
   SET_STRING_ELT(namesSEXP, 1, Rf_mkChar("row"));
   SET_STRING_ELT(namesSEXP, 2, Rf_mkChar("column"));
   SET_STRING_ELT(namesSEXP, 3, Rf_mkChar("type"));
+  if (pSymbols != NULL)
+    SET_STRING_ELT(namesSEXP, symbolColumn, Rf_mkChar("symbol"));
+  if (idName != NULL)
+    SET_STRING_ELT(namesSEXP, idColumn, Rf_mkChar(idName));
+  if (pStrings != NULL)
+    SET_STRING_ELT(namesSEXP, stringColumn, Rf_mkChar("string"));
 
   Rf_setAttrib(resultSEXP, R_NamesSymbol, namesSEXP);
 
@@ -67,30 +751,1680 @@ SEXP asSEXP(const std::vector<tokens::Token>& tokens)
   return resultSEXP;
 }
 
-} // anonymous namespace
-} // namespace sourcetools
+SEXP asSEXP(const tokens::TokenBuffer& buffer,
+            const Sources& sources = Sources(),
+            const tokens::SymbolTable* pSymbols = NULL,
+            const std::vector<tokens::DecodedStrings>* pStrings = NULL,
+            const std::vector<tokens::ColumnTable>* pColumns = NULL)
+{
+  return asSEXP(&buffer, 1, sources, pSymbols, NULL, R_NilValue, pStrings, pColumns);
+}
+
+// Intern the symbols for a set of token buffers into a single symbol
+// table, so that symbol ids are consistent across buffers.
+void intern(std::vector<tokens::TokenBuffer>* pBuffers,
+            tokens::SymbolTable* pSymbols)
+{
+  for (std::size_t i = 0; i < pBuffers->size(); ++i)
+    (*pBuffers)[i].intern(pSymbols);
+}
 
-extern "C" SEXP sourcetools_tokenize_file(SEXP absolutePathSEXP)
+// Tokenizes each element of a character vector into its own
+// token buffer. Safe to invoke from worker threads, as no R
+// APIs are touched.
+class StringTokenizer
 {
-  typedef sourcetools::tokens::Token Token;
+public:
 
-  const char* absolutePath = CHAR(STRING_ELT(absolutePathSEXP, 0));
-  std::string contents;
-  if (!sourcetools::read(absolutePath, &contents))
+  StringTokenizer(const std::vector<const char*>& strings,
+                  const std::vector<std::size_t>& sizes,
+                  tokens::TokenType mask,
+                  std::vector<tokens::TokenBuffer>* pBuffers)
+    : strings_(strings),
+      sizes_(sizes),
+      mask_(mask),
+      pBuffers_(pBuffers)
   {
-    Rf_warning("Failed to read file");
-    return R_NilValue;
   }
 
-  const std::vector<Token>& tokens = sourcetools::tokenize(contents);
-  return sourcetools::asSEXP(tokens);
+  void operator()(std::size_t i)
+  {
+    tokenize(strings_[i], sizes_[i], &(*pBuffers_)[i], NULL, mask_);
+  }
+
+private:
+  const std::vector<const char*>& strings_;
+  const std::vector<std::size_t>& sizes_;
+  tokens::TokenType mask_;
+  std::vector<tokens::TokenBuffer>* pBuffers_;
+};
+
+// The process-wide token cache. Its in-memory budget, in bytes, is
+// given by the 'sourcetools.token_cache_size' option, and the
+// directory for on-disk entries by the 'sourcetools.token_cache_dir'
+// option; by default, the cache is disabled.
+TokenCache& tokenCache()
+{
+  static TokenCache cache;
+
+  double capacity = 0;
+  SEXP sizeSEXP = Rf_GetOption1(Rf_install("sourcetools.token_cache_size"));
+  if (sizeSEXP != R_NilValue)
+    capacity = Rf_asReal(sizeSEXP);
+
+  if (ISNAN(capacity) || capacity < 0)
+    capacity = 0;
+
+  std::string directory;
+  SEXP directorySEXP = Rf_GetOption1(Rf_install("sourcetools.token_cache_dir"));
+  if (TYPEOF(directorySEXP) == STRSXP &&
+      Rf_length(directorySEXP) == 1 &&
+      STRING_ELT(directorySEXP, 0) != NA_STRING)
+  {
+    directory = R_ExpandFileName(CHAR(STRING_ELT(directorySEXP, 0)));
+  }
+
+  cache.setCapacity(static_cast<std::size_t>(capacity));
+  cache.setDirectory(directory);
+  return cache;
 }
 
-extern "C" SEXP sourcetools_tokenize_string(SEXP stringSEXP)
+TokenCache* enabledTokenCache()
 {
-  typedef sourcetools::tokens::Token Token;
-  SEXP charSEXP = STRING_ELT(stringSEXP, 0);
-  const std::vector<Token>& tokens =
-    sourcetools::tokenize(CHAR(charSEXP), Rf_length(charSEXP));
-  return sourcetools::asSEXP(tokens);
+  TokenCache& cache = tokenCache();
+  return cache.enabled() ? &cache : NULL;
+}
+
+// Tokenize through a token cache shared by worker threads. Only the
+// cache lookups and insertions are serialized; the hashing and any
+// tokenizing happen in parallel. A failure to use the cache (e.g. on
+// allocation failure) is not an error.
+bool tokenizeShared(TokenCache* pCache,
+                    const char* code,
+                    std::size_t n,
+                    tokens::TokenBuffer* pBuffer,
+                    tokens::TokenType mask)
+{
+  TokenCache::Key key = TokenCache::key(code, n, mask);
+
+  bool found = false;
+#ifdef _OPENMP
+  #pragma omp critical(sourcetools_token_cache)
+#endif
+  {
+    try
+    {
+      found = pCache->find(key, code, pBuffer);
+    }
+    catch (...)
+    {
+    }
+  }
+
+  if (found)
+    return true;
+
+  if (!tokenize(code, n, pBuffer, NULL, mask))
+    return false;
+
+#ifdef _OPENMP
+  #pragma omp critical(sourcetools_token_cache)
+#endif
+  {
+    try
+    {
+      pCache->insert(key, *pBuffer);
+    }
+    catch (...)
+    {
+    }
+  }
+
+  return true;
+}
+
+// Reads and tokenizes a set of files, each into its 'MappedFile',
+// which holds the code the tokens refer to until they are converted
+// (or for as long as their lazy values are alive). Safe to invoke
+// from worker threads, as no R APIs (nor the file cache) are touched.
+class FilesTokenizer
+{
+public:
+
+  FilesTokenizer(const std::vector<std::string>& paths,
+                 const std::vector<MappedFile*>& files,
+                 tokens::TokenType mask,
+                 TokenCache* pCache,
+                 std::vector<tokens::TokenBuffer>* pBuffers,
+                 std::vector<char>* pSuccess)
+    : paths_(paths),
+      files_(files),
+      mask_(mask),
+      pCache_(pCache),
+      pBuffers_(pBuffers),
+      pSuccess_(pSuccess)
+  {
+  }
+
+  void operator()(std::size_t i)
+  {
+    MappedFile& file = *files_[i];
+    if (!file.open(paths_[i].c_str()))
+      return;
+
+    tokens::TokenBuffer* pBuffer = &(*pBuffers_)[i];
+    (*pSuccess_)[i] = pCache_ != NULL
+      ? tokenizeShared(pCache_, file.data(), file.size(), pBuffer, mask_)
+      : tokenize(file.data(), file.size(), pBuffer, NULL, mask_);
+  }
+
+private:
+  const std::vector<std::string>& paths_;
+  const std::vector<MappedFile*>& files_;
+  tokens::TokenType mask_;
+  TokenCache* pCache_;
+  std::vector<tokens::TokenBuffer>* pBuffers_;
+  std::vector<char>* pSuccess_;
+};
+
+// Convert the name of a token type (as returned in the 'type'
+// column) into the category, or categories, it names.
+tokens::TokenType asTokenCategory(const char* name)
+{
+  using namespace tokens;
+
+  static const struct { const char* name; TokenType category; } categories[] = {
+    { "invalid",    INVALID                     },
+    { "end",        END                         },
+    { "empty",      EMPTY                       },
+    { "missing",    MISSING                     },
+    { "semi",       SEMI                        },
+    { "comma",      COMMA                       },
+    { "symbol",     SYMBOL                      },
+    { "comment",    COMMENT                     },
+    { "whitespace", WHITESPACE                  },
+    { "string",     STRING                      },
+    { "number",     NUMBER                      },
+    { "bracket",    SOURCE_TOOLS_BRACKET_MASK   },
+    { "keyword",    SOURCE_TOOLS_KEYWORD_MASK   },
+    { "operator",   SOURCE_TOOLS_OPERATOR_MASK  }
+  };
+
+  std::size_t n = sizeof(categories) / sizeof(categories[0]);
+  for (std::size_t i = 0; i < n; ++i)
+    if (std::strcmp(name, categories[i].name) == 0)
+      return categories[i].category;
+
+  Rf_error("Unknown token type '%s'", name);
+  return 0;
+}
+
+// Convert a character vector of token types to exclude into a mask
+// of types to keep.
+tokens::TokenType asTokenMask(SEXP excludeSEXP)
+{
+  tokens::TokenType mask = tokens::ALL_TOKENS_MASK;
+  if (TYPEOF(excludeSEXP) != STRSXP)
+    return mask;
+
+  for (R_xlen_t i = 0; i < Rf_xlength(excludeSEXP); ++i)
+    mask &= ~asTokenCategory(CHAR(STRING_ELT(excludeSEXP, i)));
+
+  return mask;
+}
+
+// Converts a token buffer to an R data.frame, through 'asSEXP()';
+// for use with 'r::unwindProtect()'.
+class TokensConverter
+{
+public:
+
+  TokensConverter(const tokens::TokenBuffer& buffer,
+                  const Sources& sources,
+                  const tokens::SymbolTable* pSymbols,
+                  const std::vector<tokens::DecodedStrings>* pStrings,
+                  const std::vector<tokens::ColumnTable>* pColumns)
+    : buffer_(buffer),
+      sources_(sources),
+      pSymbols_(pSymbols),
+      pStrings_(pStrings),
+      pColumns_(pColumns)
+  {
+  }
+
+  SEXP operator()() const
+  {
+    return asSEXP(buffer_, sources_, pSymbols_, pStrings_, pColumns_);
+  }
+
+private:
+  const tokens::TokenBuffer& buffer_;
+  const Sources& sources_;
+  const tokens::SymbolTable* pSymbols_;
+  const std::vector<tokens::DecodedStrings>* pStrings_;
+  const std::vector<tokens::ColumnTable>* pColumns_;
+};
+
+// Converts a set of token buffers to a single R data.frame, with an
+// identifying 'idName' column, through 'asSEXP()'; for use with
+// 'r::unwindProtect()'.
+class BuffersConverter
+{
+public:
+
+  BuffersConverter(const std::vector<tokens::TokenBuffer>& buffers,
+                   const Sources& sources,
+                   const tokens::SymbolTable* pSymbols,
+                   const char* idName,
+                   SEXP idSEXP,
+                   const std::vector<tokens::DecodedStrings>* pStrings,
+                   const std::vector<tokens::ColumnTable>* pColumns)
+    : buffers_(buffers),
+      sources_(sources),
+      pSymbols_(pSymbols),
+      idName_(idName),
+      idSEXP_(idSEXP),
+      pStrings_(pStrings),
+      pColumns_(pColumns)
+  {
+  }
+
+  SEXP operator()() const
+  {
+    return asSEXP(buffers_.empty() ? NULL : &buffers_[0],
+                  buffers_.size(),
+                  sources_,
+                  pSymbols_,
+                  idName_,
+                  idSEXP_,
+                  pStrings_,
+                  pColumns_);
+  }
+
+private:
+  const std::vector<tokens::TokenBuffer>& buffers_;
+  const Sources& sources_;
+  const tokens::SymbolTable* pSymbols_;
+  const char* idName_;
+  SEXP idSEXP_;
+  const std::vector<tokens::DecodedStrings>* pStrings_;
+  const std::vector<tokens::ColumnTable>* pColumns_;
+};
+
+// Tokenizes the contents of a file (as mapped by the file cache, or
+// held by a 'MappedFile'), and converts the tokens to an R data.frame
+// while the contents are held. Token values are lazy when 'sources'
+// (which must hold the contents) is given, and are otherwise created
+// up front.
+class FileTokenizer
+{
+public:
+
+  FileTokenizer(const Sources& sources,
+                tokens::SymbolTable* pSymbols,
+                tokens::TokenType mask,
+                bool decode,
+                tokens::ColumnUnit unit,
+                TokenCache* pCache,
+                std::size_t threads,
+                std::size_t chunkSize,
+                SEXP* pResultSEXP,
+                bool* pTooLarge)
+    : sources_(sources),
+      pSymbols_(pSymbols),
+      mask_(mask),
+      decode_(decode),
+      unit_(unit),
+      pCache_(pCache),
+      threads_(threads),
+      chunkSize_(chunkSize),
+      pResultSEXP_(pResultSEXP),
+      pTooLarge_(pTooLarge)
+  {
+  }
+
+  void operator()(const char* begin, const char* end)
+  {
+    // Cached tokens carry no symbol ids, so symbols are interned
+    // after the fact.
+    tokens::TokenBuffer buffer;
+    bool success = pCache_ != NULL
+      ? pCache_->tokenize(begin, end - begin, &buffer, mask_)
+      : tokenizeParallel(begin, end - begin, &buffer, threads_, pSymbols_, mask_, chunkSize_);
+
+    if (!success)
+    {
+      *pTooLarge_ = true;
+      return;
+    }
+
+    if (pCache_ != NULL && pSymbols_ != NULL)
+      buffer.intern(pSymbols_);
+
+    std::vector<tokens::DecodedStrings> decoded;
+    if (decode_ && !decodeStrings(&buffer, 1, threads_, &decoded))
+    {
+      *pTooLarge_ = true;
+      return;
+    }
+
+    std::vector<tokens::ColumnTable> columns;
+    bool count = unit_ != tokens::COLUMN_BYTES;
+    if (count && !countColumns(&buffer, 1, threads_, unit_, &columns))
+    {
+      *pTooLarge_ = true;
+      return;
+    }
+
+    // Converting can raise an R error (e.g. on an embedded nul), which
+    // must not jump over the mapping, nor the tokens.
+    TokensConverter converter(buffer,
+                              sources_,
+                              pSymbols_,
+                              decode_ ? &decoded : NULL,
+                              count ? &columns : NULL);
+    *pResultSEXP_ = r::unwindProtect(converter);
+  }
+
+private:
+  Sources sources_;
+  tokens::SymbolTable* pSymbols_;
+  tokens::TokenType mask_;
+  bool decode_;
+  tokens::ColumnUnit unit_;
+  TokenCache* pCache_;
+  std::size_t threads_;
+  std::size_t chunkSize_;
+  SEXP* pResultSEXP_;
+  bool* pTooLarge_;
+};
+
+// Tokenizes the contents of a memory-mapped file, and writes the
+// tokens to a token file.
+class TokenFileWriter
+{
+public:
+
+  TokenFileWriter(const char* output,
+                  bool symbols,
+                  tokens::TokenType mask,
+                  bool includeSource,
+                  bool* pSuccess)
+    : output_(output),
+      symbols_(symbols),
+      mask_(mask),
+      includeSource_(includeSource),
+      pSuccess_(pSuccess)
+  {
+  }
+
+  void operator()(const char* begin, const char* end)
+  {
+    tokens::SymbolTable symbols;
+    tokens::SymbolTable* pSymbols = symbols_ ? &symbols : NULL;
+
+    tokens::TokenBuffer buffer;
+    *pSuccess_ =
+      tokenize(begin, end - begin, &buffer, pSymbols, mask_) &&
+      TokenFile::write(output_, buffer, pSymbols, includeSource_, mask_);
+  }
+
+private:
+  const char* output_;
+  bool symbols_;
+  tokens::TokenType mask_;
+  bool includeSource_;
+  bool* pSuccess_;
+};
+
+// A match of a token pattern: the position of its first token, and
+// the code it spans.
+struct TokenMatch
+{
+  std::size_t row;
+  std::size_t column;
+  std::string value;
+};
+
+// Records the matches of a token pattern in a token view.
+class MatchCollector
+{
+public:
+
+  MatchCollector(const tokens::TokenView& view,
+                 tokens::ColumnUnit unit,
+                 std::vector<TokenMatch>* pMatches)
+    : view_(view),
+      unit_(unit),
+      pMatches_(pMatches)
+  {
+  }
+
+  void operator()(std::size_t first, std::size_t last)
+  {
+    pMatches_->push_back(TokenMatch());
+    TokenMatch& match = pMatches_->back();
+    match.row = view_.row(first);
+    match.column = view_.column(first);
+    match.value.assign(view_.begin(first), view_.end(last));
+
+    if (unit_ != tokens::COLUMN_BYTES)
+    {
+      bool valid = true;
+      const char* line = view_.code() + view_.lines()[match.row];
+      match.column = tokens::detail::countColumns(line, view_.begin(first), unit_, &valid);
+    }
+  }
+
+private:
+  tokens::TokenView view_;
+  tokens::ColumnUnit unit_;
+  std::vector<TokenMatch>* pMatches_;
+};
+
+// Searches the contents of a memory-mapped file for a token pattern.
+// Only significant tokens are kept: whitespace and comments are
+// never matched, and so need not be stored.
+class FileSearcher
+{
+public:
+
+  FileSearcher(const cursors::TokenPattern& pattern,
+               tokens::ColumnUnit unit,
+               TokenCache* pCache,
+               std::vector<TokenMatch>* pMatches,
+               bool* pSuccess)
+    : pattern_(pattern),
+      unit_(unit),
+      pCache_(pCache),
+      pMatches_(pMatches),
+      pSuccess_(pSuccess)
+  {
+  }
+
+  void operator()(const char* begin, const char* end)
+  {
+    using namespace tokens;
+
+    TokenType mask = ALL_TOKENS_MASK & ~(WHITESPACE | COMMENT);
+    TokenBuffer buffer;
+    *pSuccess_ = pCache_ != NULL
+      ? tokenizeShared(pCache_, begin, end - begin, &buffer, mask)
+      : tokenize(begin, end - begin, &buffer, NULL, mask);
+
+    if (!*pSuccess_)
+      return;
+
+    TokenView view = buffer.view();
+    MatchCollector collector(view, unit_, pMatches_);
+    pattern_.search(cursors::CompactTokenCursor(view), collector);
+  }
+
+private:
+  const cursors::TokenPattern& pattern_;
+  tokens::ColumnUnit unit_;
+  TokenCache* pCache_;
+  std::vector<TokenMatch>* pMatches_;
+  bool* pSuccess_;
+};
+
+// Searches a set of files for a token pattern. Safe to invoke from
+// worker threads, as no R APIs are touched; each file is only mapped
+// while it is searched.
+class FilesSearcher
+{
+public:
+
+  FilesSearcher(const std::vector<std::string>& paths,
+                const cursors::TokenPattern& pattern,
+                tokens::ColumnUnit unit,
+                TokenCache* pCache,
+                std::vector< std::vector<TokenMatch> >* pMatches,
+                std::vector<char>* pSuccess)
+    : paths_(paths),
+      pattern_(pattern),
+      unit_(unit),
+      pCache_(pCache),
+      pMatches_(pMatches),
+      pSuccess_(pSuccess)
+  {
+  }
+
+  void operator()(std::size_t i)
+  {
+    bool success = false;
+    FileSearcher searcher(pattern_, unit_, pCache_, &(*pMatches_)[i], &success);
+    (*pSuccess_)[i] =
+      detail::MemoryMappedReader::map(paths_[i].c_str(), searcher) && success;
+  }
+
+private:
+  const std::vector<std::string>& paths_;
+  const cursors::TokenPattern& pattern_;
+  tokens::ColumnUnit unit_;
+  TokenCache* pCache_;
+  std::vector< std::vector<TokenMatch> >* pMatches_;
+  std::vector<char>* pSuccess_;
+};
+
+// Convert the matches of a token pattern into a data frame, with a
+// row per match. For use with 'r::unwindProtect()'. Values containing
+// nul bytes (which R strings cannot hold) are 'NA'; others are in the
+// native encoding, as are the values of tokens.
+class MatchesConverter
+{
+public:
+
+  MatchesConverter(SEXP pathsSEXP,
+                   const std::vector< std::vector<TokenMatch> >& matches)
+    : pathsSEXP_(pathsSEXP),
+      matches_(matches)
+  {
+  }
+
+  SEXP operator()() const
+  {
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < matches_.size(); ++i)
+      total += matches_[i].size();
+
+    r::Protect protect;
+    SEXP fileSEXP = protect(Rf_allocVector(STRSXP, total));
+    SEXP rowSEXP = protect(Rf_allocVector(INTSXP, total));
+    SEXP columnSEXP = protect(Rf_allocVector(INTSXP, total));
+    SEXP valueSEXP = protect(Rf_allocVector(STRSXP, total));
+
+    std::size_t index = 0;
+    for (std::size_t i = 0; i < matches_.size(); ++i)
+    {
+      SEXP pathSEXP = STRING_ELT(pathsSEXP_, i);
+      for (std::size_t k = 0; k < matches_[i].size(); ++k, ++index)
+      {
+        const TokenMatch& match = matches_[i][k];
+        SET_STRING_ELT(fileSEXP, index, pathSEXP);
+        INTEGER(rowSEXP)[index] = match.row + 1;
+        INTEGER(columnSEXP)[index] = match.column + 1;
+
+        const std::string& value = match.value;
+        SEXP charSEXP = std::memchr(value.data(), '\0', value.size()) != NULL
+          ? NA_STRING
+          : Rf_mkCharLen(value.data(), value.size());
+        SET_STRING_ELT(valueSEXP, index, charSEXP);
+      }
+    }
+
+    r::ListBuilder builder;
+    builder.add("file", fileSEXP);
+    builder.add("row", rowSEXP);
+    builder.add("column", columnSEXP);
+    builder.add("value", valueSEXP);
+
+    SEXP resultSEXP = protect(static_cast<SEXP>(builder));
+    asDataFrame(resultSEXP, total);
+    return resultSEXP;
+  }
+
+private:
+  SEXP pathsSEXP_;
+  const std::vector< std::vector<TokenMatch> >& matches_;
+};
+
+void finalizeTokenFile(SEXP fileSEXP)
+{
+  delete static_cast<TokenFile*>(R_ExternalPtrAddr(fileSEXP));
+  R_ClearExternalPtr(fileSEXP);
+}
+
+void finalizeMappedFile(SEXP fileSEXP)
+{
+  delete static_cast<MappedFile*>(R_ExternalPtrAddr(fileSEXP));
+  R_ClearExternalPtr(fileSEXP);
+}
+
+// An external pointer owning a new 'MappedFile', so that lazy token
+// values can hold the file's contents (as their 'Sources').
+SEXP createMappedFile()
+{
+  r::Protect protect;
+  SEXP fileSEXP = protect(R_MakeExternalPtr(NULL, R_NilValue, R_NilValue));
+  R_SetExternalPtrAddr(fileSEXP, new MappedFile);
+  R_RegisterCFinalizerEx(fileSEXP, finalizeMappedFile, TRUE);
+  return fileSEXP;
+}
+
+MappedFile* asMappedFile(SEXP fileSEXP)
+{
+  return static_cast<MappedFile*>(R_ExternalPtrAddr(fileSEXP));
+}
+
+// Release the files held by a list of 'MappedFile' external pointers
+// (once no token values refer to them).
+void releaseMappedFiles(SEXP filesSEXP)
+{
+  for (R_xlen_t i = 0; i < Rf_xlength(filesSEXP); ++i)
+    finalizeMappedFile(VECTOR_ELT(filesSEXP, i));
+}
+
+// Used by the test-only entry points below: the code they work on,
+// which must be a single (non-NA) string.
+SEXP asCodeSEXP(SEXP stringSEXP)
+{
+  if (TYPEOF(stringSEXP) != STRSXP ||
+      Rf_length(stringSEXP) != 1 ||
+      STRING_ELT(stringSEXP, 0) == NA_STRING)
+  {
+    Rf_error("expected a single string");
+  }
+
+  return STRING_ELT(stringSEXP, 0);
+}
+
+// Used by the test-only entry points below: do two tokens have the
+// same type, extent and position?
+bool sameToken(const tokens::Token& lhs, const tokens::Token& rhs)
+{
+  return
+    lhs.type() == rhs.type() &&
+    lhs.offset() == rhs.offset() &&
+    lhs.size() == rhs.size() &&
+    lhs.position() == rhs.position();
+}
+
+// Checks each token (or batch of tokens, as from a chunked tokenizer)
+// it is passed against the next of the expected tokens, including
+// their contents (which need only be valid during the call).
+class TokenComparer
+{
+public:
+
+  explicit TokenComparer(const std::vector<tokens::Token>& expected)
+    : expected_(expected),
+      index_(0),
+      same_(true)
+  {
+  }
+
+  void operator()(const tokens::Token* pTokens, std::size_t n)
+  {
+    for (std::size_t i = 0; same_ && i < n; ++i, ++index_)
+    {
+      same_ =
+        index_ < expected_.size() &&
+        sameToken(pTokens[i], expected_[index_]) &&
+        std::equal(pTokens[i].begin(), pTokens[i].end(), expected_[index_].begin());
+    }
+  }
+
+  void operator()(const tokens::Token& token)
+  {
+    (*this)(&token, 1);
+  }
+
+  bool same() const { return same_ && index_ == expected_.size(); }
+
+private:
+  const std::vector<tokens::Token>& expected_;
+  std::size_t index_;
+  bool same_;
+};
+
+} // anonymous namespace
+
+int asThreadCount(SEXP threadsSEXP)
+{
+  // Use all available threads when 'threads' is zero.
+  int threads = Rf_asInteger(threadsSEXP);
+  if (threads == NA_INTEGER || threads < 0)
+    threads = 1;
+  return threads;
+}
+
+// The smallest chunk of a single document tokenized on its own
+// thread, as given by the 'sourcetools.parallel_chunk_size' option
+// (by default, 1 MiB); smaller documents are tokenized serially.
+std::size_t parallelChunkSize()
+{
+  double size = 1024 * 1024;
+  SEXP sizeSEXP = Rf_GetOption1(Rf_install("sourcetools.parallel_chunk_size"));
+  if (sizeSEXP != R_NilValue)
+    size = Rf_asReal(sizeSEXP);
+
+  return ISNAN(size) || size < 1 ? 1 : static_cast<std::size_t>(size);
+}
+
+} // namespace sourcetools
+
+extern "C" SEXP sourcetools_tokenize_file(SEXP absolutePathSEXP,
+                                          SEXP threadsSEXP,
+                                          SEXP symbolsSEXP,
+                                          SEXP excludeSEXP,
+                                          SEXP decodeSEXP)
+{
+  SOURCETOOLS_BEGIN_UNWIND
+
+  sourcetools::configureReader();
+
+  // Arguments and options are read before any C++ objects are
+  // constructed, as an error would skip their destructors.
+  const char* absolutePath = CHAR(STRING_ELT(absolutePathSEXP, 0));
+  int threads = sourcetools::asThreadCount(threadsSEXP);
+  bool useSymbols = Rf_asLogical(symbolsSEXP) == TRUE;
+  sourcetools::tokens::TokenType mask = sourcetools::asTokenMask(excludeSEXP);
+  bool decode = Rf_asLogical(decodeSEXP) == TRUE;
+  sourcetools::tokens::ColumnUnit unit = sourcetools::columnUnit();
+  std::size_t chunkSize = sourcetools::parallelChunkSize();
+  sourcetools::TokenCache* pCache = sourcetools::enabledTokenCache();
+  sourcetools::MappedFileCache& cache = sourcetools::fileCache();
+
+  // Lazy token values hold the file's contents, and so the file is
+  // read into a 'MappedFile' of its own, unless the file cache (which
+  // holds its mappings itself) is in use.
+  sourcetools::r::Protect protect;
+  bool lazy = sourcetools::useLazyValues() && cache.capacity() == 0;
+  SEXP fileSEXP = lazy ? protect(sourcetools::createMappedFile()) : R_NilValue;
+
+  sourcetools::tokens::SymbolTable symbols;
+  sourcetools::tokens::SymbolTable* pSymbols = useSymbols ? &symbols : NULL;
+
+  SEXP resultSEXP = R_NilValue;
+  bool tooLarge = false;
+  sourcetools::FileTokenizer tokenizer(sourcetools::Sources(fileSEXP),
+                                       pSymbols,
+                                       mask,
+                                       decode,
+                                       unit,
+                                       pCache,
+                                       threads,
+                                       chunkSize,
+                                       &resultSEXP,
+                                       &tooLarge);
+
+  bool success = false;
+  if (lazy)
+  {
+    sourcetools::MappedFile& file = *sourcetools::asMappedFile(fileSEXP);
+    success = file.open(absolutePath);
+    if (success)
+      tokenizer(file.data(), file.data() + file.size());
+  }
+  else
+  {
+    success = cache.map(absolutePath, tokenizer);
+  }
+
+  if (!success)
+  {
+    sourcetools::r::warning("Failed to read file");
+    return R_NilValue;
+  }
+
+  if (tooLarge)
+  {
+    sourcetools::r::warning("File too large to tokenize");
+    return R_NilValue;
+  }
+
+  return resultSEXP;
+
+  SOURCETOOLS_END_UNWIND
+}
+
+extern "C" SEXP sourcetools_tokenize_string(SEXP stringSEXP,
+                                            SEXP threadsSEXP,
+                                            SEXP symbolsSEXP,
+                                            SEXP excludeSEXP,
+                                            SEXP decodeSEXP)
+{
+  SOURCETOOLS_BEGIN_UNWIND
+
+  // There is nothing to tokenize for an NA string.
+  SEXP charSEXP = STRING_ELT(stringSEXP, 0);
+  if (charSEXP == NA_STRING)
+    return R_NilValue;
+
+  int threads = sourcetools::asThreadCount(threadsSEXP);
+  bool useSymbols = Rf_asLogical(symbolsSEXP) == TRUE;
+  sourcetools::tokens::TokenType mask = sourcetools::asTokenMask(excludeSEXP);
+  bool decode = Rf_asLogical(decodeSEXP) == TRUE;
+  sourcetools::tokens::ColumnUnit unit = sourcetools::columnUnit();
+  std::size_t chunkSize = sourcetools::parallelChunkSize();
+
+  sourcetools::tokens::SymbolTable symbols;
+  sourcetools::tokens::SymbolTable* pSymbols = useSymbols ? &symbols : NULL;
+
+  sourcetools::tokens::TokenBuffer buffer;
+  sourcetools::tokenizeParallel(CHAR(charSEXP),
+                                Rf_length(charSEXP),
+                                &buffer,
+                                threads,
+                                pSymbols,
+                                mask,
+                                chunkSize);
+
+  std::vector<sourcetools::tokens::DecodedStrings> decoded;
+  if (decode && !sourcetools::decodeStrings(&buffer, 1, threads, &decoded))
+  {
+    sourcetools::r::warning("Failed to decode strings");
+    return R_NilValue;
+  }
+
+  std::vector<sourcetools::tokens::ColumnTable> columns;
+  bool count = unit != sourcetools::tokens::COLUMN_BYTES;
+  if (count && !sourcetools::countColumns(&buffer, 1, threads, unit, &columns))
+  {
+    sourcetools::r::warning("Failed to count columns");
+    return R_NilValue;
+  }
+
+  sourcetools::Sources sources(charSEXP);
+  sourcetools::TokensConverter converter(buffer,
+                                         sources,
+                                         pSymbols,
+                                         decode ? &decoded : NULL,
+                                         count ? &columns : NULL);
+  return sourcetools::r::unwindProtect(converter);
+
+  SOURCETOOLS_END_UNWIND
+}
+
+extern "C" SEXP sourcetools_tokenize_strings(SEXP stringsSEXP,
+                                             SEXP threadsSEXP,
+                                             SEXP symbolsSEXP,
+                                             SEXP excludeSEXP,
+                                             SEXP decodeSEXP)
+{
+  SOURCETOOLS_BEGIN_UNWIND
+
+  std::size_t n = Rf_xlength(stringsSEXP);
+  int threads = sourcetools::asThreadCount(threadsSEXP);
+  bool useSymbols = Rf_asLogical(symbolsSEXP) == TRUE;
+  sourcetools::tokens::TokenType mask = sourcetools::asTokenMask(excludeSEXP);
+  bool decode = Rf_asLogical(decodeSEXP) == TRUE;
+  sourcetools::tokens::ColumnUnit unit = sourcetools::columnUnit();
+
+  sourcetools::r::Protect protect;
+  SEXP documentSEXP = protect(Rf_allocVector(INTSXP, n));
+  for (std::size_t i = 0; i < n; ++i)
+    INTEGER(documentSEXP)[i] = i + 1;
+
+  // Retain the strings themselves (rather than the vector holding
+  // them, which could be modified) for lazily materialized values.
+  SEXP sourceSEXP = protect(Rf_allocVector(STRSXP, n));
+  for (std::size_t i = 0; i < n; ++i)
+    SET_STRING_ELT(sourceSEXP, i, STRING_ELT(stringsSEXP, i));
+
+  // Collect the string data up front, as R APIs cannot be
+  // used from the worker threads. NA strings yield no tokens here;
+  // 'tokenize_strings()' gives them a row of NAs.
+  std::vector<const char*> strings(n);
+  std::vector<std::size_t> sizes(n);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    SEXP charSEXP = STRING_ELT(stringsSEXP, i);
+    bool missing = charSEXP == NA_STRING;
+    strings[i] = missing ? "" : CHAR(charSEXP);
+    sizes[i] = missing ? 0 : Rf_length(charSEXP);
+  }
+
+  std::vector<sourcetools::tokens::TokenBuffer> buffers(n);
+  sourcetools::StringTokenizer tokenizer(strings, sizes, mask, &buffers);
+  if (!sourcetools::parallel::forEach(n, threads, tokenizer))
+  {
+    sourcetools::r::warning("Failed to tokenize strings");
+    return R_NilValue;
+  }
+
+  // Symbols are interned after the fact, on the main thread, so
+  // that ids are shared by all documents.
+  sourcetools::tokens::SymbolTable symbols;
+  sourcetools::tokens::SymbolTable* pSymbols = NULL;
+  if (useSymbols)
+  {
+    pSymbols = &symbols;
+    sourcetools::intern(&buffers, pSymbols);
+  }
+
+  // Strings are decoded on the worker threads.
+  std::vector<sourcetools::tokens::DecodedStrings> decoded;
+  if (decode && !sourcetools::decodeStrings(buffers.empty() ? NULL : &buffers[0], n, threads, &decoded))
+  {
+    sourcetools::r::warning("Failed to decode strings");
+    return R_NilValue;
+  }
+
+  std::vector<sourcetools::tokens::ColumnTable> columns;
+  bool count = unit != sourcetools::tokens::COLUMN_BYTES;
+  if (count && !sourcetools::countColumns(buffers.empty() ? NULL : &buffers[0], n, threads, unit, &columns))
+  {
+    sourcetools::r::warning("Failed to count columns");
+    return R_NilValue;
+  }
+
+  sourcetools::Sources sources(sourceSEXP);
+  sourcetools::BuffersConverter converter(buffers,
+                                          sources,
+                                          pSymbols,
+                                          "document",
+                                          documentSEXP,
+                                          decode ? &decoded : NULL,
+                                          count ? &columns : NULL);
+  return sourcetools::r::unwindProtect(converter);
+
+  SOURCETOOLS_END_UNWIND
+}
+
+extern "C" SEXP sourcetools_tokenize_files(SEXP absolutePathsSEXP,
+                                           SEXP threadsSEXP,
+                                           SEXP combineSEXP,
+                                           SEXP symbolsSEXP,
+                                           SEXP excludeSEXP,
+                                           SEXP decodeSEXP)
+{
+  typedef sourcetools::tokens::TokenBuffer TokenBuffer;
+  typedef sourcetools::tokens::DecodedStrings DecodedStrings;
+  typedef sourcetools::tokens::ColumnTable ColumnTable;
+
+  SOURCETOOLS_BEGIN_UNWIND
+
+  sourcetools::configureReader();
+
+  std::size_t n = Rf_xlength(absolutePathsSEXP);
+  int threads = sourcetools::asThreadCount(threadsSEXP);
+  bool combine = Rf_asLogical(combineSEXP) == TRUE;
+  bool useSymbols = Rf_asLogical(symbolsSEXP) == TRUE;
+  sourcetools::tokens::TokenType mask = sourcetools::asTokenMask(excludeSEXP);
+  bool decode = Rf_asLogical(decodeSEXP) == TRUE;
+  sourcetools::tokens::ColumnUnit unit = sourcetools::columnUnit();
+  sourcetools::TokenCache* pCache = sourcetools::enabledTokenCache();
+  bool lazy = sourcetools::useLazyValues();
+
+  // Each file is read into a 'MappedFile', owned by an external
+  // pointer, so that lazy token values can hold the file in turn.
+  sourcetools::r::Protect protect;
+  SEXP filesSEXP = protect(Rf_allocVector(VECSXP, n));
+  for (std::size_t i = 0; i < n; ++i)
+    SET_VECTOR_ELT(filesSEXP, i, sourcetools::createMappedFile());
+
+  SEXP resultSEXP = R_NilValue;
+  if (!combine)
+  {
+    resultSEXP = protect(Rf_allocVector(VECSXP, n));
+    Rf_setAttrib(resultSEXP, R_NamesSymbol, absolutePathsSEXP);
+  }
+
+  std::vector<std::string> paths(n);
+  std::vector<sourcetools::MappedFile*> files(n);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    paths[i] = CHAR(STRING_ELT(absolutePathsSEXP, i));
+    files[i] = sourcetools::asMappedFile(VECTOR_ELT(filesSEXP, i));
+  }
+
+  std::vector<TokenBuffer> buffers(n);
+  std::vector<char> success(n);
+
+  sourcetools::FilesTokenizer tokenizer(paths, files, mask, pCache, &buffers, &success);
+  if (!sourcetools::parallel::forEach(n, threads, tokenizer))
+  {
+    sourcetools::r::warning("Failed to tokenize files");
+    return R_NilValue;
+  }
+
+  for (std::size_t i = 0; i < n; ++i)
+    if (!success[i])
+      sourcetools::r::warning("Failed to read file '%s'", paths[i].c_str());
+
+  // Symbols are interned after the fact, on the main thread, so
+  // that ids are shared by all files.
+  sourcetools::tokens::SymbolTable symbols;
+  sourcetools::tokens::SymbolTable* pSymbols = NULL;
+  if (useSymbols)
+  {
+    pSymbols = &symbols;
+    sourcetools::intern(&buffers, pSymbols);
+  }
+
+  // Strings are decoded on the worker threads, for all files at once.
+  std::vector<DecodedStrings> decoded;
+  if (decode && !sourcetools::decodeStrings(buffers.empty() ? NULL : &buffers[0], n, threads, &decoded))
+  {
+    sourcetools::r::warning("Failed to decode strings");
+    return R_NilValue;
+  }
+
+  std::vector<ColumnTable> columns;
+  bool count = unit != sourcetools::tokens::COLUMN_BYTES;
+  if (count && !sourcetools::countColumns(buffers.empty() ? NULL : &buffers[0], n, threads, unit, &columns))
+  {
+    sourcetools::r::warning("Failed to count columns");
+    return R_NilValue;
+  }
+
+  if (combine)
+  {
+    sourcetools::Sources sources(lazy ? filesSEXP : R_NilValue);
+    sourcetools::BuffersConverter converter(buffers,
+                                            sources,
+                                            pSymbols,
+                                            "file",
+                                            absolutePathsSEXP,
+                                            decode ? &decoded : NULL,
+                                            count ? &columns : NULL);
+    resultSEXP = protect(sourcetools::r::unwindProtect(converter));
+  }
+  else
+  {
+    // Each file's decoded strings, and columns, are in consecutive
+    // pieces.
+    std::size_t stringsPiece = 0;
+    std::size_t columnsPiece = 0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      std::vector<DecodedStrings> fileStrings;
+      if (decode)
+        sourcetools::takePieces(&decoded, &stringsPiece, buffers[i].size(), &fileStrings);
+
+      std::vector<ColumnTable> fileColumns;
+      if (count)
+        sourcetools::takePieces(&columns, &columnsPiece, buffers[i].size(), &fileColumns);
+
+      if (!success[i])
+        continue;
+
+      sourcetools::Sources sources(lazy ? VECTOR_ELT(filesSEXP, i) : R_NilValue);
+      sourcetools::TokensConverter converter(buffers[i],
+                                             sources,
+                                             pSymbols,
+                                             decode ? &fileStrings : NULL,
+                                             count ? &fileColumns : NULL);
+      SET_VECTOR_ELT(resultSEXP, i, sourcetools::r::unwindProtect(converter));
+    }
+  }
+
+  if (!lazy)
+    sourcetools::releaseMappedFiles(filesSEXP);
+
+  return resultSEXP;
+
+  SOURCETOOLS_END_UNWIND
+}
+
+// Search a set of files for a token pattern, given as a list of the
+// values each token may take (any value, when empty) and a character
+// vector of their types (any significant token, when 'NA'). Files
+// are searched on the worker threads; only the matches are returned.
+extern "C" SEXP sourcetools_search_tokens(SEXP absolutePathsSEXP,
+                                          SEXP valuesSEXP,
+                                          SEXP typesSEXP,
+                                          SEXP threadsSEXP)
+{
+  SOURCETOOLS_BEGIN_UNWIND
+
+  // Check the types up front, before anything needs cleaning up.
+  R_xlen_t count = Rf_xlength(valuesSEXP);
+  for (R_xlen_t j = 0; j < count; ++j)
+    if (STRING_ELT(typesSEXP, j) != NA_STRING)
+      sourcetools::asTokenCategory(CHAR(STRING_ELT(typesSEXP, j)));
+
+  sourcetools::configureReader();
+
+  std::size_t n = Rf_xlength(absolutePathsSEXP);
+  int threads = sourcetools::asThreadCount(threadsSEXP);
+  sourcetools::tokens::ColumnUnit unit = sourcetools::columnUnit();
+  sourcetools::TokenCache* pCache = sourcetools::enabledTokenCache();
+
+  sourcetools::cursors::TokenPattern pattern;
+  for (R_xlen_t j = 0; j < count; ++j)
+  {
+    SEXP typeSEXP = STRING_ELT(typesSEXP, j);
+    sourcetools::tokens::TokenType mask = typeSEXP == NA_STRING
+      ? sourcetools::tokens::ALL_TOKENS_MASK
+      : sourcetools::asTokenCategory(CHAR(typeSEXP));
+
+    std::vector<std::string> values;
+    SEXP elementSEXP = VECTOR_ELT(valuesSEXP, j);
+    for (R_xlen_t k = 0; k < Rf_xlength(elementSEXP); ++k)
+    {
+      SEXP charSEXP = STRING_ELT(elementSEXP, k);
+      if (charSEXP != NA_STRING)
+        values.push_back(std::string(CHAR(charSEXP), LENGTH(charSEXP)));
+    }
+
+    pattern.push_back(mask, values);
+  }
+
+  std::vector<std::string> paths(n);
+  for (std::size_t i = 0; i < n; ++i)
+    paths[i] = CHAR(STRING_ELT(absolutePathsSEXP, i));
+
+  std::vector< std::vector<sourcetools::TokenMatch> > matches(n);
+  std::vector<char> success(n);
+
+  sourcetools::FilesSearcher searcher(paths, pattern, unit, pCache, &matches, &success);
+  if (!sourcetools::parallel::forEach(n, threads, searcher))
+  {
+    sourcetools::r::warning("Failed to search files");
+    return R_NilValue;
+  }
+
+  for (std::size_t i = 0; i < n; ++i)
+    if (!success[i])
+      sourcetools::r::warning("Failed to read file '%s'", paths[i].c_str());
+
+  sourcetools::MatchesConverter converter(absolutePathsSEXP, matches);
+  return sourcetools::r::unwindProtect(converter);
+
+  SOURCETOOLS_END_UNWIND
+}
+
+// Tokenize a range of lines from a line index. Rows are those of
+// the indexed file; the token values refer to the index's mapping,
+// which they keep alive.
+extern "C" SEXP sourcetools_line_index_tokenize(SEXP indexSEXP,
+                                                SEXP fromSEXP,
+                                                SEXP toSEXP)
+{
+  const sourcetools::LineIndex& index = *sourcetools::asLineIndex(indexSEXP);
+
+  std::size_t from, to;
+  sourcetools::asLineRange(index, fromSEXP, toSEXP, &from, &to);
+
+  sourcetools::tokens::ColumnUnit unit = sourcetools::columnUnit();
+
+  std::size_t begin = index.endOffset(from);
+  std::size_t end = index.endOffset(to);
+
+  sourcetools::tokens::TokenBuffer buffer;
+  sourcetools::tokenize(index.data() + begin, end - begin, &buffer);
+
+  std::vector<sourcetools::tokens::ColumnTable> columns;
+  if (unit != sourcetools::tokens::COLUMN_BYTES)
+    columns.push_back(sourcetools::tokens::ColumnTable(buffer.view(), unit));
+
+  sourcetools::r::Protect protect;
+  SEXP resultSEXP = protect(sourcetools::asSEXP(buffer,
+                                                sourcetools::Sources(indexSEXP),
+                                                NULL,
+                                                NULL,
+                                                columns.empty() ? NULL : &columns));
+
+  int* rows = INTEGER(VECTOR_ELT(resultSEXP, 1));
+  for (std::size_t i = 0; i < buffer.size(); ++i)
+    rows[i] += static_cast<int>(from);
+
+  return resultSEXP;
+}
+
+extern "C" SEXP sourcetools_write_token_file(SEXP absolutePathSEXP,
+                                             SEXP outputSEXP,
+                                             SEXP symbolsSEXP,
+                                             SEXP excludeSEXP,
+                                             SEXP sourceSEXP)
+{
+  sourcetools::configureReader();
+
+  const char* absolutePath = CHAR(STRING_ELT(absolutePathSEXP, 0));
+  const char* output = R_ExpandFileName(CHAR(STRING_ELT(outputSEXP, 0)));
+  bool useSymbols = Rf_asLogical(symbolsSEXP) == TRUE;
+  sourcetools::tokens::TokenType mask = sourcetools::asTokenMask(excludeSEXP);
+  bool source = Rf_asLogical(sourceSEXP) == TRUE;
+
+  bool success = false;
+  sourcetools::TokenFileWriter writer(output, useSymbols, mask, source, &success);
+  if (!sourcetools::fileCache().map(absolutePath, writer))
+  {
+    Rf_warning("Failed to read file");
+    return R_NilValue;
+  }
+
+  if (!success)
+  {
+    Rf_warning("Failed to write token file '%s'", output);
+    return R_NilValue;
+  }
+
+  return Rf_ScalarLogical(TRUE);
+}
+
+// Read a token file. The tokens refer to the code in the file (which
+// is kept mapped for as long as the token values are), or else to
+// 'textSEXP', which must match the code the tokens were drawn from.
+extern "C" SEXP sourcetools_read_token_file(SEXP pathSEXP, SEXP textSEXP)
+{
+  sourcetools::tokens::ColumnUnit unit = sourcetools::columnUnit();
+
+  sourcetools::r::Protect protect;
+  SEXP fileSEXP = protect(R_MakeExternalPtr(NULL, R_NilValue, R_NilValue));
+  sourcetools::TokenFile* pFile = new sourcetools::TokenFile;
+  R_SetExternalPtrAddr(fileSEXP, pFile);
+  R_RegisterCFinalizerEx(fileSEXP, sourcetools::finalizeTokenFile, TRUE);
+
+  const char* path = R_ExpandFileName(CHAR(STRING_ELT(pathSEXP, 0)));
+  if (!pFile->open(path))
+  {
+    Rf_warning("Failed to read token file '%s'", path);
+    return R_NilValue;
+  }
+
+  const char* code = pFile->source();
+  sourcetools::Sources sources(fileSEXP);
+  if (!pFile->hasSource())
+  {
+    if (TYPEOF(textSEXP) != STRSXP || Rf_length(textSEXP) != 1 || STRING_ELT(textSEXP, 0) == NA_STRING)
+    {
+      Rf_warning("Token file '%s' does not include its source", path);
+      return R_NilValue;
+    }
+
+    SEXP charSEXP = STRING_ELT(textSEXP, 0);
+    if (!pFile->matches(CHAR(charSEXP), Rf_length(charSEXP)))
+    {
+      Rf_warning("Source does not match the code tokenized in '%s'", path);
+      return R_NilValue;
+    }
+
+    code = CHAR(charSEXP);
+    sources = sourcetools::Sources(charSEXP);
+  }
+
+  sourcetools::tokens::SymbolTable symbols;
+  sourcetools::tokens::SymbolTable* pSymbols = NULL;
+  if (pFile->hasSymbols())
+  {
+    if (!pFile->symbols(&symbols))
+    {
+      Rf_warning("Failed to read symbols from token file '%s'", path);
+      return R_NilValue;
+    }
+    pSymbols = &symbols;
+  }
+
+  sourcetools::tokens::TokenBuffer buffer;
+  buffer.assign(pFile->view(code), pFile->sourceSize());
+
+  std::vector<sourcetools::tokens::ColumnTable> columns;
+  if (unit != sourcetools::tokens::COLUMN_BYTES)
+    columns.push_back(sourcetools::tokens::ColumnTable(buffer.view(), unit));
+
+  return sourcetools::asSEXP(buffer,
+                             sources,
+                             pSymbols,
+                             NULL,
+                             columns.empty() ? NULL : &columns);
+}
+
+// Used in tests, to validate that the table-driven tokenizer backend
+// produces the same tokens as the chained backend.
+extern "C" SEXP sourcetools_compare_backends(SEXP stringSEXP)
+{
+  using namespace sourcetools;
+  typedef tokens::Token Token;
+
+  SEXP charSEXP = asCodeSEXP(stringSEXP);
+  const char* code = CHAR(charSEXP);
+  std::size_t n = Rf_length(charSEXP);
+
+  tokenizer::Tokenizer chained(code, n);
+  tokenizer::Tokenizer table(code, n);
+
+  Token lhs, rhs;
+  bool same = true;
+  while (same)
+  {
+    bool lhsOk = chained.tokenize(&lhs, tokenizer::ChainedBackend());
+    bool rhsOk = table.tokenize(&rhs, tokenizer::TableBackend());
+
+    same = lhsOk == rhsOk && sameToken(lhs, rhs);
+
+    if (!lhsOk)
+      break;
+  }
+
+  return Rf_ScalarLogical(same);
+}
+
+// Used in tests, to validate that retokenizing the tokens of 'before'
+// after an edit producing 'after' gives the tokens of 'after'. The
+// edit replaces whatever lies between their common prefix and suffix.
+extern "C" SEXP sourcetools_compare_retokenize(SEXP beforeSEXP, SEXP afterSEXP)
+{
+  using namespace sourcetools;
+
+  SEXP beforeCharSEXP = asCodeSEXP(beforeSEXP);
+  const char* before = CHAR(beforeCharSEXP);
+  std::size_t nBefore = Rf_length(beforeCharSEXP);
+
+  SEXP afterCharSEXP = asCodeSEXP(afterSEXP);
+  const char* after = CHAR(afterCharSEXP);
+  std::size_t nAfter = Rf_length(afterCharSEXP);
+
+  std::size_t prefix = 0;
+  while (prefix < nBefore && prefix < nAfter && before[prefix] == after[prefix])
+    ++prefix;
+
+  std::size_t suffix = 0;
+  while (suffix < nBefore - prefix && suffix < nAfter - prefix &&
+         before[nBefore - suffix - 1] == after[nAfter - suffix - 1])
+  {
+    ++suffix;
+  }
+
+  tokens::TokenBuffer buffer;
+  if (!tokenize(before, nBefore, &buffer))
+    return Rf_ScalarLogical(FALSE);
+
+  std::size_t removed = nBefore - prefix - suffix;
+  std::size_t inserted = nAfter - prefix - suffix;
+  if (!retokenize(after, nAfter, prefix, removed, inserted, &buffer))
+    return Rf_ScalarLogical(FALSE);
+
+  std::vector<tokens::Token> expected = tokenize(after, nAfter);
+  bool same = buffer.size() == expected.size();
+  for (std::size_t i = 0; same && i < expected.size(); ++i)
+    same = sameToken(buffer.token(i), expected[i]);
+
+  return Rf_ScalarLogical(same);
+}
+
+// Used in tests, to validate that a token stream, peeking up to
+// 'lookahead' tokens ahead before consuming each token, produces
+// the tokens of 'tokenize()'.
+extern "C" SEXP sourcetools_compare_token_stream(SEXP stringSEXP,
+                                                 SEXP lookaheadSEXP)
+{
+  using namespace sourcetools;
+
+  SEXP charSEXP = asCodeSEXP(stringSEXP);
+  const char* code = CHAR(charSEXP);
+  std::size_t n = Rf_length(charSEXP);
+  std::size_t lookahead = Rf_asInteger(lookaheadSEXP);
+
+  std::vector<tokens::Token> expected = tokenize(code, n);
+  tokenizer::TokenStream stream(code, n);
+
+  bool same = true;
+  for (std::size_t i = 0; same && i <= expected.size(); ++i)
+  {
+    for (std::size_t k = lookahead; same && k > 0; --k)
+    {
+      const tokens::Token& token = stream.peek(k);
+      same = i + k <= expected.size()
+        ? sameToken(token, expected[i + k - 1])
+        : token.isType(tokens::END);
+    }
+
+    if (!same)
+      break;
+
+    tokens::Token token;
+    bool consumed = stream.consume(&token);
+    if (i < expected.size())
+      same = consumed && sameToken(token, expected[i]);
+    else
+      same = !consumed && token.isType(tokens::END) && stream.atEnd();
+  }
+
+  return Rf_ScalarLogical(same);
+}
+
+// Used in tests, to validate that feeding code to a chunked tokenizer
+// 'chunkSize' bytes at a time, with tokens delivered in batches of
+// 'batchSize', produces the tokens of 'tokenize()'.
+extern "C" SEXP sourcetools_compare_chunked(SEXP stringSEXP,
+                                            SEXP chunkSizeSEXP,
+                                            SEXP batchSizeSEXP)
+{
+  using namespace sourcetools;
+
+  SEXP charSEXP = asCodeSEXP(stringSEXP);
+  const char* code = CHAR(charSEXP);
+  std::size_t n = Rf_length(charSEXP);
+  std::size_t chunkSize = std::max(Rf_asInteger(chunkSizeSEXP), 1);
+  std::size_t batchSize = std::max(Rf_asInteger(batchSizeSEXP), 1);
+
+  std::vector<tokens::Token> expected = tokenize(code, n);
+  TokenComparer comparer(expected);
+
+  tokenizer::ChunkedTokenizer tokenizer(NULL, batchSize);
+  for (std::size_t offset = 0; offset < n; offset += chunkSize)
+    tokenizer.feed(code + offset, std::min(chunkSize, n - offset), comparer);
+  tokenizer.finish(comparer);
+
+  return Rf_ScalarLogical(comparer.same() && tokenizer.offset() == n);
+}
+
+// Used in tests, to validate that 'forEachToken()', 'copyTokens()'
+// and 'tokenizeInto()' produce the tokens of the 'tokenize()' loop,
+// excluding those of the types in 'exclude'.
+extern "C" SEXP sourcetools_compare_token_visitors(SEXP stringSEXP,
+                                                   SEXP excludeSEXP)
+{
+  using namespace sourcetools;
+  typedef tokens::Token Token;
+
+  tokens::TokenType mask = asTokenMask(excludeSEXP);
+
+  SEXP charSEXP = asCodeSEXP(stringSEXP);
+  const char* code = CHAR(charSEXP);
+  std::size_t n = Rf_length(charSEXP);
+
+  std::vector<Token> expected;
+  tokenizer::Tokenizer tokenizer(code, n);
+  Token token;
+  while (tokenizer.tokenize(&token))
+    if (tokens::matchesMask(token.type(), mask))
+      expected.push_back(token);
+
+  TokenComparer comparer(expected);
+  bool same = forEachToken(code, n, comparer, mask).same();
+
+  // Leave room for a token too many.
+  std::vector<Token> copied(expected.size() + 1);
+  std::vector<Token>::iterator end = copyTokens(code, n, copied.begin(), mask);
+  copied.erase(end, copied.end());
+  same = same && std::for_each(copied.begin(), copied.end(), TokenComparer(expected)).same();
+
+  // Any tokens already in the vector are replaced.
+  std::vector<Token> tokens = tokenize("x <- 1 # comment");
+  tokenizeInto(code, n, &tokens, mask);
+  same = same && std::for_each(tokens.begin(), tokens.end(), TokenComparer(expected)).same();
+
+  return Rf_ScalarLogical(same);
+}
+
+// Used in tests, to validate that a cursor using a bracket table
+// matches the same brackets as a cursor walking the tokens, and that
+// the table's unmatched brackets are those with no match.
+extern "C" SEXP sourcetools_compare_bracket_table(SEXP stringSEXP)
+{
+  using namespace sourcetools;
+  typedef cursors::TokenCursor TokenCursor;
+
+  SEXP charSEXP = asCodeSEXP(stringSEXP);
+  const char* code = CHAR(charSEXP);
+  std::size_t n = Rf_length(charSEXP);
+
+  std::vector<tokens::Token> tokens = tokenize(code, n);
+  tokens::BracketTable table(tokens);
+
+  std::vector<std::size_t> unmatched;
+  bool same = table.size() == tokens.size();
+
+  TokenCursor cursor(tokens);
+  for (std::size_t i = 0; same && i < tokens.size(); ++i)
+  {
+    TokenCursor walkedFwd(cursor), jumpedFwd(cursor);
+    jumpedFwd.use(table);
+    bool matchedFwd = walkedFwd.fwdToMatchingBracket();
+    same = matchedFwd == jumpedFwd.fwdToMatchingBracket() &&
+      (!matchedFwd || walkedFwd.offset() == jumpedFwd.offset());
+
+    TokenCursor walkedBwd(cursor), jumpedBwd(cursor);
+    jumpedBwd.use(table);
+    bool matchedBwd = walkedBwd.bwdToMatchingBracket();
+    same = same && matchedBwd == jumpedBwd.bwdToMatchingBracket() &&
+      (!matchedBwd || walkedBwd.offset() == jumpedBwd.offset());
+
+    if (tokens::isBracket(tokens[i]) && !matchedFwd && !matchedBwd)
+      unmatched.push_back(i);
+
+    cursor.moveToNextToken();
+  }
+
+  return Rf_ScalarLogical(same && unmatched == table.unmatched());
+}
+
+// Used in tests, to validate that a cursor using a skip table moves
+// over whitespace and comments as a cursor walking the tokens does.
+extern "C" SEXP sourcetools_compare_skip_table(SEXP stringSEXP)
+{
+  using namespace sourcetools;
+  typedef cursors::TokenCursor TokenCursor;
+
+  SEXP charSEXP = asCodeSEXP(stringSEXP);
+  const char* code = CHAR(charSEXP);
+  std::size_t n = Rf_length(charSEXP);
+
+  typedef bool (TokenCursor::*Move)();
+  const Move moves[] = {
+    &TokenCursor::moveToNextSignificantToken,
+    &TokenCursor::moveToPreviousSignificantToken,
+    &TokenCursor::fwdOverWhitespaceAndComments,
+    &TokenCursor::bwdOverWhitespaceAndComments
+  };
+
+  std::vector<tokens::Token> tokens = tokenize(code, n);
+  tokens::SkipTable table(tokens);
+
+  bool same = table.size() == tokens.size();
+
+  TokenCursor cursor(tokens);
+  for (std::size_t i = 0; same && i < tokens.size(); ++i)
+  {
+    TokenCursor skipping(cursor);
+    same = skipping.use(table);
+
+    for (std::size_t times = 1; same && times <= 3; ++times)
+    {
+      same =
+        sameToken(cursor.nextSignificantToken(times),
+                  skipping.nextSignificantToken(times)) &&
+        sameToken(cursor.previousSignificantToken(times),
+                  skipping.previousSignificantToken(times));
+    }
+
+    for (std::size_t k = 0; same && k < sizeof(moves) / sizeof(moves[0]); ++k)
+    {
+      TokenCursor lhs(cursor), rhs(skipping);
+      bool lhsOk = (lhs.*moves[k])();
+      bool rhsOk = (rhs.*moves[k])();
+      same = lhsOk == rhsOk && lhs.offset() == rhs.offset();
+    }
+
+    cursor.moveToNextToken();
+  }
+
+  return Rf_ScalarLogical(same);
+}
+
+// Used in tests, to validate a line table's positions against a walk
+// over the code, its rows' tokens against a walk over the tokens, and
+// that a cursor using it moves to the same positions as one without.
+extern "C" SEXP sourcetools_compare_line_table(SEXP stringSEXP)
+{
+  using namespace sourcetools;
+  typedef cursors::CompactTokenCursor CompactTokenCursor;
+  typedef collections::Position Position;
+
+  SEXP charSEXP = asCodeSEXP(stringSEXP);
+  const char* code = CHAR(charSEXP);
+  std::size_t n = Rf_length(charSEXP);
+
+  tokens::TokenBuffer buffer;
+  if (!tokenize(code, n, &buffer))
+    return Rf_ScalarLogical(FALSE);
+
+  tokens::TokenView view = buffer.view();
+  tokens::LineTable table(view);
+  bool same = table.tokenCount() == view.size();
+
+  Position position;
+  for (std::size_t offset = 0; same && offset < n; ++offset)
+  {
+    same =
+      table.position(offset) == position &&
+      table.offset(position) == offset;
+
+    if (code[offset] == '\n')
+    {
+      ++position.row;
+      position.column = 0;
+    }
+    else
+    {
+      ++position.column;
+    }
+  }
+
+  std::size_t index = 0;
+  for (std::size_t row = 0; same && row < table.lineCount(); ++row)
+  {
+    same = table.firstToken(row) == index;
+    while (index < view.size() && view.row(index) == row)
+      ++index;
+  }
+
+  CompactTokenCursor plain(buffer), indexed(buffer);
+  same = same && indexed.use(table);
+  for (std::size_t row = 0; same && row <= table.lineCount(); ++row)
+  {
+    for (std::size_t column = 0; same && column < 8; ++column)
+    {
+      bool moved = plain.moveToPosition(row, column);
+      bool found = indexed.moveToPosition(row, column);
+      same = moved == found && plain.offset() == indexed.offset();
+    }
+  }
+
+  return Rf_ScalarLogical(same);
+}
+
+extern "C" SEXP sourcetools_token_cache_info()
+{
+  sourcetools::TokenCache& cache = sourcetools::tokenCache();
+
+  sourcetools::r::Protect protect;
+  SEXP directorySEXP = protect(Rf_allocVector(STRSXP, 1));
+  SET_STRING_ELT(directorySEXP, 0,
+                 cache.directory().empty()
+                   ? NA_STRING
+                   : Rf_mkCharLen(cache.directory().c_str(), cache.directory().size()));
+
+  sourcetools::r::ListBuilder builder;
+  builder.add("capacity", Rf_ScalarReal(static_cast<double>(cache.capacity())));
+  builder.add("size", Rf_ScalarReal(static_cast<double>(cache.size())));
+  builder.add("entries", Rf_ScalarReal(static_cast<double>(cache.count())));
+  builder.add("directory", directorySEXP);
+  builder.add("hits", Rf_ScalarReal(static_cast<double>(cache.hits())));
+  builder.add("disk_hits", Rf_ScalarReal(static_cast<double>(cache.diskHits())));
+  builder.add("misses", Rf_ScalarReal(static_cast<double>(cache.misses())));
+  builder.add("evictions", Rf_ScalarReal(static_cast<double>(cache.evictions())));
+  return builder;
+}
+
+extern "C" SEXP sourcetools_token_cache_flush()
+{
+  sourcetools::TokenCache& cache = sourcetools::tokenCache();
+  double count = static_cast<double>(cache.count());
+  cache.clear();
+  return Rf_ScalarReal(count);
+}
+
+extern "C" void sourcetools_init_lazy_values(DllInfo* pInfo)
+{
+#ifdef SOURCE_TOOLS_LAZY_VALUES
+  sourcetools::LazyValues::initialize(pInfo);
+#else
+  (void) pInfo;
+#endif
 }
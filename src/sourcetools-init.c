@@ -4,20 +4,91 @@
 #include <R_ext/Rdynload.h>
 
 /* .Call calls */
+
+/* Internal: the 'sourcetools_compare_*' routines are only used by the
+ * package's tests, to check one implementation against another. They
+ * are not part of the package's API, and error unless each code
+ * argument is a single string. */
+extern SEXP sourcetools_compare_backends(SEXP);
+extern SEXP sourcetools_compare_bracket_table(SEXP);
+extern SEXP sourcetools_compare_chunked(SEXP, SEXP, SEXP);
+extern SEXP sourcetools_compare_line_table(SEXP);
+extern SEXP sourcetools_compare_retokenize(SEXP, SEXP);
+extern SEXP sourcetools_compare_skip_table(SEXP);
+extern SEXP sourcetools_compare_token_stream(SEXP, SEXP);
+extern SEXP sourcetools_compare_token_visitors(SEXP, SEXP);
+
+extern SEXP sourcetools_file_cache_flush(void);
+extern SEXP sourcetools_file_cache_info(void);
+extern SEXP sourcetools_line_index(SEXP);
+extern SEXP sourcetools_line_index_count(SEXP);
+extern SEXP sourcetools_line_index_lines(SEXP, SEXP, SEXP);
+extern SEXP sourcetools_line_index_position(SEXP, SEXP);
+extern SEXP sourcetools_line_index_tokenize(SEXP, SEXP, SEXP);
+extern SEXP sourcetools_nse_cache_flush(void);
+extern SEXP sourcetools_nse_cache_info(void);
+extern SEXP sourcetools_performs_nse(SEXP, SEXP);
 extern SEXP sourcetools_read(SEXP);
 extern SEXP sourcetools_read_bytes(SEXP);
 extern SEXP sourcetools_read_lines(SEXP);
 extern SEXP sourcetools_read_lines_bytes(SEXP);
-extern SEXP sourcetools_tokenize_file(SEXP);
-extern SEXP sourcetools_tokenize_string(SEXP);
+extern SEXP sourcetools_read_lines_many(SEXP, SEXP);
+extern SEXP sourcetools_read_many(SEXP, SEXP);
+extern SEXP sourcetools_read_stats(void);
+extern SEXP sourcetools_read_token_file(SEXP, SEXP);
+extern SEXP sourcetools_search_path_contains(SEXP);
+extern SEXP sourcetools_search_tokens(SEXP, SEXP, SEXP, SEXP);
+extern SEXP sourcetools_stats(SEXP, SEXP);
+extern SEXP sourcetools_token_cache_flush(void);
+extern SEXP sourcetools_token_cache_info(void);
+extern SEXP sourcetools_tokenize_file(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP sourcetools_tokenize_files(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP sourcetools_tokenize_string(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP sourcetools_tokenize_strings(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP sourcetools_write_token_file(SEXP, SEXP, SEXP, SEXP, SEXP);
+
+/* ALTREP classes */
+extern void sourcetools_init_lazy_values(DllInfo *);
 
 static const R_CallMethodDef CallEntries[] = {
+    /* Internal, test-only routines (see above). */
+    {"sourcetools_compare_backends", (DL_FUNC) &sourcetools_compare_backends, 1},
+    {"sourcetools_compare_bracket_table", (DL_FUNC) &sourcetools_compare_bracket_table, 1},
+    {"sourcetools_compare_chunked",  (DL_FUNC) &sourcetools_compare_chunked,  3},
+    {"sourcetools_compare_line_table", (DL_FUNC) &sourcetools_compare_line_table, 1},
+    {"sourcetools_compare_retokenize", (DL_FUNC) &sourcetools_compare_retokenize, 2},
+    {"sourcetools_compare_skip_table", (DL_FUNC) &sourcetools_compare_skip_table, 1},
+    {"sourcetools_compare_token_stream", (DL_FUNC) &sourcetools_compare_token_stream, 2},
+    {"sourcetools_compare_token_visitors", (DL_FUNC) &sourcetools_compare_token_visitors, 2},
+
+    {"sourcetools_file_cache_flush", (DL_FUNC) &sourcetools_file_cache_flush, 0},
+    {"sourcetools_file_cache_info",  (DL_FUNC) &sourcetools_file_cache_info,  0},
+    {"sourcetools_line_index",       (DL_FUNC) &sourcetools_line_index,       1},
+    {"sourcetools_line_index_count", (DL_FUNC) &sourcetools_line_index_count, 1},
+    {"sourcetools_line_index_lines", (DL_FUNC) &sourcetools_line_index_lines, 3},
+    {"sourcetools_line_index_position", (DL_FUNC) &sourcetools_line_index_position, 2},
+    {"sourcetools_line_index_tokenize", (DL_FUNC) &sourcetools_line_index_tokenize, 3},
+    {"sourcetools_nse_cache_flush",  (DL_FUNC) &sourcetools_nse_cache_flush,  0},
+    {"sourcetools_nse_cache_info",   (DL_FUNC) &sourcetools_nse_cache_info,   0},
+    {"sourcetools_performs_nse",     (DL_FUNC) &sourcetools_performs_nse,     2},
     {"sourcetools_read",             (DL_FUNC) &sourcetools_read,             1},
     {"sourcetools_read_bytes",       (DL_FUNC) &sourcetools_read_bytes,       1},
     {"sourcetools_read_lines",       (DL_FUNC) &sourcetools_read_lines,       1},
     {"sourcetools_read_lines_bytes", (DL_FUNC) &sourcetools_read_lines_bytes, 1},
-    {"sourcetools_tokenize_file",    (DL_FUNC) &sourcetools_tokenize_file,    1},
-    {"sourcetools_tokenize_string",  (DL_FUNC) &sourcetools_tokenize_string,  1},
+    {"sourcetools_read_lines_many",  (DL_FUNC) &sourcetools_read_lines_many,  2},
+    {"sourcetools_read_many",        (DL_FUNC) &sourcetools_read_many,        2},
+    {"sourcetools_read_stats",       (DL_FUNC) &sourcetools_read_stats,       0},
+    {"sourcetools_read_token_file",  (DL_FUNC) &sourcetools_read_token_file,  2},
+    {"sourcetools_search_path_contains", (DL_FUNC) &sourcetools_search_path_contains, 1},
+    {"sourcetools_search_tokens",    (DL_FUNC) &sourcetools_search_tokens,    4},
+    {"sourcetools_stats",            (DL_FUNC) &sourcetools_stats,            2},
+    {"sourcetools_token_cache_flush", (DL_FUNC) &sourcetools_token_cache_flush, 0},
+    {"sourcetools_token_cache_info", (DL_FUNC) &sourcetools_token_cache_info, 0},
+    {"sourcetools_tokenize_file",    (DL_FUNC) &sourcetools_tokenize_file,    5},
+    {"sourcetools_tokenize_files",   (DL_FUNC) &sourcetools_tokenize_files,   6},
+    {"sourcetools_tokenize_string",  (DL_FUNC) &sourcetools_tokenize_string,  5},
+    {"sourcetools_tokenize_strings", (DL_FUNC) &sourcetools_tokenize_strings, 5},
+    {"sourcetools_write_token_file", (DL_FUNC) &sourcetools_write_token_file, 5},
     {NULL, NULL, 0}
 };
 
@@ -25,4 +96,5 @@ void R_init_sourcetools(DllInfo *dll)
 {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    sourcetools_init_lazy_values(dll);
 }